@@ -1,22 +1,30 @@
 #include "HttpServer.h"
+#include "../src/ClipExport.h"
+#include "../src/SegmentIndex.h"
+#include "../src/ThumbnailCache.h"
+#include "utils/Logger.h"
+#include "utils/Metrics.h"
 #define CROW_RETURNS_OK_ON_HTTP_OPTIONS_REQUEST
 #include <crow.h>
 #include <crow/middlewares/cors.h>
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <filesystem>
-#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace buksan {
 
 namespace {
 using json = nlohmann::json;
-constexpr std::size_t kStreamChunkSize = 64 * 1024;
 
 crow::response jsonResponse(int code, const json& j) {
     crow::response res(code);
@@ -45,6 +53,12 @@ json toJson(const Recording& recording) {
     if (recording.mandatoryMark.has_value()) {
         payload["mandatory_mark"] = recording.mandatoryMark.value();
     }
+    if (recording.endUnixTime.has_value()) {
+        payload["end_unixtime"] = recording.endUnixTime.value();
+    }
+    if (recording.sizeBytes.has_value()) {
+        payload["size_bytes"] = recording.sizeBytes.value();
+    }
     return payload;
 }
 
@@ -71,6 +85,34 @@ json toJson(const Node& node) {
     };
 }
 
+// ?t= seconds into the segment or ?at= unix seconds; nullopt when neither is given.
+// Throws std::invalid_argument on a malformed value.
+std::optional<std::pair<bool, std::int64_t>> parseSeekParams(const crow::request& req) {
+    const char* offsetRaw = req.url_params.get("t");
+    const char* unixRaw = req.url_params.get("at");
+    if (offsetRaw == nullptr && unixRaw == nullptr) {
+        return std::nullopt;
+    }
+    const bool byUnix = offsetRaw == nullptr;
+    const std::string raw = byUnix ? unixRaw : offsetRaw;
+    std::size_t used = 0;
+    const double seconds = std::stod(raw, &used);
+    if (used != raw.size() || !std::isfinite(seconds)) {
+        throw std::invalid_argument("seek time is not a number");
+    }
+    // Keeps the conversion to microseconds within int64
+    constexpr double maxSeconds = static_cast<double>(std::numeric_limits<std::int64_t>::max() / 1000000);
+    if (std::fabs(seconds) > maxSeconds) {
+        throw std::out_of_range("seek time is out of range");
+    }
+    return std::make_pair(byUnix, static_cast<std::int64_t>(seconds * 1e6));
+}
+
+std::optional<KeyframeEntry> findSeekKeyframe(const std::string& path, const std::pair<bool, std::int64_t>& seek) {
+    const auto entries = readSegmentIndex(path);
+    return seek.first ? findKeyframeByUnix(entries, seek.second) : findKeyframeByPts(entries, seek.second);
+}
+
 struct ByteRange {
     std::uint64_t start{0};
     std::uint64_t end{0};
@@ -132,36 +174,108 @@ std::optional<ByteRange> parseRangeHeader(const std::string& headerValue, std::u
     }
 }
 
-void streamFile(const std::string& path, std::uint64_t startOffset, std::uint64_t endOffset, crow::response& res) {
-    std::ifstream input(path, std::ios::binary);
-    if (!input.is_open()) {
+std::string mediaContentType(const std::string& path) {
+    const std::string extension = std::filesystem::path(path).extension().string();
+    if (extension == ".mkv") {
+        return "video/x-matroska";
+    }
+    return "video/mp4";
+}
+
+void streamFile(const std::string& path, std::uint64_t startOffset, std::uint64_t endOffset, crow::response& res,
+                std::string prefix = std::string()) {
+    // The body is sent from the file descriptor by the connection itself (sendfile on plain sockets)
+    if (!res.set_static_file_range_unsafe(path, startOffset, endOffset - startOffset + 1, mediaContentType(path),
+                                          std::move(prefix))) {
         res = errorResponse(404, "media file is missing");
-        res.end();
-        return;
     }
+    res.end();
+}
 
-    input.seekg(static_cast<std::streamoff>(startOffset), std::ios::beg);
-    std::uint64_t remaining = endOffset - startOffset + 1;
-    std::vector<char> buffer(kStreamChunkSize);
+// Hands a live viewer's fragments to the connection, which writes them as HTTP chunks
+class LiveBodySource : public crow::response::body_source {
+public:
+    explicit LiveBodySource(std::shared_ptr<LiveViewer> viewer)
+        : viewer_(std::move(viewer))
+    {
+    }
 
-    while (remaining > 0 && input.good()) {
-        const std::size_t toRead = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, buffer.size()));
-        input.read(buffer.data(), static_cast<std::streamsize>(toRead));
-        const std::streamsize readBytes = input.gcount();
-        if (readBytes <= 0) {
-            break;
-        }
-        res.write(std::string(buffer.data(), static_cast<std::size_t>(readBytes)));
-        remaining -= static_cast<std::uint64_t>(readBytes);
+    std::shared_ptr<const std::string> pull(bool& finished) override {
+        return viewer_->next(finished);
     }
 
-    res.end();
+    void set_notifier(std::function<void()> notify) override {
+        viewer_->setNotifier(std::move(notify));
+    }
+
+    void closed() override {
+        viewer_->close();
+    }
+
+private:
+    std::shared_ptr<LiveViewer> viewer_;
+};
+
+// Hands over pieces the export pool has finished; the remux itself never runs on the io thread
+class ClipBodySource : public crow::response::body_source {
+public:
+    explicit ClipBodySource(std::shared_ptr<ClipStream> clip)
+        : clip_(std::move(clip))
+    {
+    }
+
+    std::shared_ptr<const std::string> pull(bool& finished) override {
+        return clip_->next(finished);
+    }
+
+    void set_notifier(std::function<void()> notify) override {
+        clip_->setNotifier(std::move(notify));
+    }
+
+    void closed() override {
+        clip_->close();
+    }
+
+private:
+    std::shared_ptr<ClipStream> clip_;
+};
+
+// Whole string as a number: std::stoll alone accepts trailing text, which must not reach headers
+std::int64_t parseWholeInt64(const std::string& value) {
+    std::size_t used = 0;
+    const std::int64_t parsed = std::stoll(value, &used);
+    if (used != value.size()) {
+        throw std::invalid_argument("trailing characters");
+    }
+    return parsed;
+}
+
+// ?width=, 0 when absent
+int parseThumbnailWidth(const char* raw) {
+    if (raw == nullptr) {
+        return 0;
+    }
+    const std::int64_t width = parseWholeInt64(raw);
+    if (width < 0 || width > 65535) {
+        throw std::out_of_range("width");
+    }
+    return static_cast<int>(width);
+}
+
+// Hands a response built on a worker thread back to the connection's io thread
+void finishOnIoThread(crow::asio::io_context* io, crow::response& res, crow::response answer) {
+    auto ready = std::make_shared<crow::response>(std::move(answer));
+    crow::asio::post(*io, [&res, ready] {
+        res = std::move(*ready);
+        res.end();
+    });
 }
 } // namespace
 
 struct HttpServerImpl {
     using App = crow::App<crow::CORSHandler>;
     App app;
+    std::shared_ptr<ClipExportPool> exports{ClipExportPool::create()};
 };
 
 HttpServer::HttpServer(CameraManager& manager,
@@ -180,7 +294,22 @@ HttpServer::HttpServer(CameraManager& manager,
     setupRoutes();
 }
 
-HttpServer::~HttpServer() = default;
+HttpServer::~HttpServer() {
+    impl_->exports->stop();
+    // Its jobs answer through this server's routes
+    if (thumbnails_) {
+        thumbnails_->stop();
+    }
+}
+
+void HttpServer::setThumbnailCache(std::shared_ptr<ThumbnailCache> thumbnails) {
+    thumbnails_ = std::move(thumbnails);
+}
+
+void HttpServer::setCameraRegisteredHandler(
+    std::function<void(const std::string& cameraId, std::int64_t deviceId)> handler) {
+    cameraRegistered_ = std::move(handler);
+}
 
 void HttpServer::setupRoutes() {
     auto& app = impl_->app;
@@ -190,6 +319,32 @@ void HttpServer::setupRoutes() {
         return jsonResponse(200, json{{"status", "ok"}, {"pending_metadata_queue", recordingService_.pendingQueueSize()}});
     });
 
+    CROW_ROUTE(app, "/metrics")
+    .methods("GET"_method)
+    ([](const crow::request&) {
+        crow::response res(200);
+        res.set_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+        res.body = metrics().render();
+        return res;
+    });
+
+    CROW_ROUTE(app, "/api/v1/storage/volumes")
+    .methods("GET"_method)
+    ([this](const crow::request&) {
+        json arr = json::array();
+        for (const auto& volume : manager_.getVolumeStats()) {
+            arr.push_back(json{
+                {"path", volume.path},
+                {"healthy", volume.healthy},
+                {"free_bytes", volume.freeBytes},
+                {"write_bytes_per_sec", volume.writeBytesPerSec},
+                {"open_segments", volume.openSegments},
+                {"failures", volume.failures},
+            });
+        }
+        return jsonResponse(200, arr);
+    });
+
     CROW_ROUTE(app, "/api/v1/cameras")
     .methods("POST"_method)
     ([this](const crow::request& req) {
@@ -199,13 +354,37 @@ void HttpServer::setupRoutes() {
             std::string rtsp_url = body.value("rtsp_url", "");
             std::string storage_path = body.value("storage_path", "");
             int segment_duration = body.value("segment_duration", 300);
-            if (id.empty() || rtsp_url.empty() || storage_path.empty()) {
-                return errorResponse(400, "id, rtsp_url and storage_path are required");
+            if (id.empty() || rtsp_url.empty()) {
+                return errorResponse(400, "id and rtsp_url are required");
+            }
+            CameraConfig config;
+            config.id = id;
+            config.rtsp_url = rtsp_url;
+            config.analytics = body.value("analytics", false);
+            if (!parseRecordMode(body.value("record_mode", "transcode"), config.record_mode)) {
+                return errorResponse(400, "record_mode must be 'transcode' or 'passthrough'");
             }
-            if (!manager_.addCamera(id, rtsp_url, storage_path, segment_duration)) {
+            if (!manager_.addCamera(config, storage_path, segment_duration)) {
                 return errorResponse(400, "duplicate id or invalid parameters");
             }
-            return jsonResponse(201, json{{"id", id}});
+
+            // Same registration as cameras from the config file; without a device id no segment is catalogued
+            json payload{{"id", id}, {"device_id", nullptr}};
+            RegisterCameraCommand command;
+            command.type = 0;
+            command.caption = id;
+            command.rtspUrl = rtsp_url;
+            command.status = "active";
+            try {
+                const std::int64_t deviceId = cameraService_.registerCamera(command);
+                if (cameraRegistered_) {
+                    cameraRegistered_(id, deviceId);
+                }
+                payload["device_id"] = deviceId;
+            } catch (const std::exception& e) {
+                logWarn(id) << "camera added but not registered in the database: " << e.what();
+            }
+            return jsonResponse(201, payload);
         } catch (const json::exception& e) {
             return errorResponse(400, std::string("invalid JSON: ") + e.what());
         } catch (const std::exception& e) {
@@ -247,13 +426,15 @@ void HttpServer::setupRoutes() {
     .methods("POST"_method)
     ([this](const std::string& id) {
         try {
-            if (!manager_.cameraExists(id)) {
+            switch (manager_.startRecordingAsync(id)) {
+            case CameraOpResult::NotFound:
                 return errorResponse(404, "camera not found");
+            case CameraOpResult::Conflict:
+                return errorResponse(409, std::string("camera is ") + manager_.getStatus(id));
+            case CameraOpResult::Accepted:
+                break;
             }
-            if (!manager_.startRecording(id)) {
-                return errorResponse(409, "already running");
-            }
-            return jsonResponse(200, json{{"id", id}, {"status", "running"}});
+            return jsonResponse(202, json{{"id", id}, {"status", "starting"}});
         } catch (const std::exception& e) {
             return errorResponse(500, e.what());
         }
@@ -262,19 +443,121 @@ void HttpServer::setupRoutes() {
     CROW_ROUTE(app, "/api/v1/cameras/<string>/stop")
     .methods("POST"_method)
     ([this](const std::string& id) {
+        try {
+            switch (manager_.stopRecordingAsync(id)) {
+            case CameraOpResult::NotFound:
+                return errorResponse(404, "camera not found");
+            case CameraOpResult::Conflict:
+                return errorResponse(409, std::string("camera is ") + manager_.getStatus(id));
+            case CameraOpResult::Accepted:
+                break;
+            }
+            return jsonResponse(202, json{{"id", id}, {"status", "stopping"}});
+        } catch (const std::exception& e) {
+            return errorResponse(500, e.what());
+        }
+    });
+
+    CROW_ROUTE(app, "/api/v1/cameras/<string>/status")
+    .methods("GET"_method)
+    ([this](const std::string& id) {
+        const auto status = manager_.getCameraStatus(id);
+        if (!status.has_value()) {
+            return errorResponse(404, "camera not found");
+        }
+        json body{{"id", id}, {"status", toString(status->state)}};
+        if (!status->error.empty()) {
+            body["error"] = status->error;
+        }
+        return jsonResponse(200, body);
+    });
+
+    CROW_ROUTE(app, "/api/v1/cameras/<string>/event")
+    .methods("POST"_method)
+    ([this](const crow::request& req, const std::string& id) {
         try {
             if (!manager_.cameraExists(id)) {
                 return errorResponse(404, "camera not found");
             }
-            if (!manager_.stopRecording(id)) {
-                return errorResponse(409, "already stopped");
+            std::optional<std::int64_t> alertId;
+            if (!req.body.empty()) {
+                const json payload = json::parse(req.body);
+                if (payload.contains("alert") && !payload.at("alert").is_null()) {
+                    alertId = payload.at("alert").get<std::int64_t>();
+                }
+            }
+            if (!manager_.triggerEvent(id, alertId)) {
+                return errorResponse(409, "camera is not running");
             }
-            return jsonResponse(200, json{{"id", id}, {"status", "stopped"}});
+            return jsonResponse(202, json{{"id", id}, {"event", "triggered"}});
+        } catch (const json::exception& e) {
+            return errorResponse(400, std::string("invalid json payload: ") + e.what());
         } catch (const std::exception& e) {
             return errorResponse(500, e.what());
         }
     });
 
+    CROW_ROUTE(app, "/api/v1/cameras/<string>/stats")
+    .methods("GET"_method)
+    ([this](const std::string& id) {
+        try {
+            if (!manager_.cameraExists(id)) {
+                return errorResponse(404, "camera not found");
+            }
+            const auto stats = manager_.getQueueStats(id);
+            if (!stats.has_value()) {
+                return jsonResponse(200, json{{"id", id}, {"status", "stopped"}});
+            }
+            json body{
+                {"id", id},
+                {"status", "running"},
+                {"queue_depth", stats->depth},
+                {"queue_capacity", stats->capacity},
+                {"queue_high_water_mark", stats->highWaterMark},
+                {"frames_queued", stats->pushed},
+                {"frames_dropped", stats->dropped},
+            };
+            if (const auto analytics = manager_.getAnalyticsStats(id)) {
+                body["analytics"] = json{
+                    {"frames_submitted", analytics->submitted},
+                    {"frames_analyzed", analytics->analyzed},
+                    {"frames_replaced", analytics->replaced},
+                    {"analyzed_fps", analytics->analyzedFps},
+                    {"lag_ms", analytics->lastLagMs},
+                    {"avg_lag_ms", analytics->avgLagMs},
+                };
+            }
+            return jsonResponse(200, body);
+        } catch (const std::exception& e) {
+            return errorResponse(500, e.what());
+        }
+    });
+
+    CROW_ROUTE(app, "/api/v1/cameras/<string>/live")
+    .methods("GET"_method)
+    ([this](crow::response& res, const std::string& id) {
+        try {
+            if (!manager_.cameraExists(id)) {
+                res = errorResponse(404, "camera not found");
+                res.end();
+                return;
+            }
+            auto viewer = manager_.subscribeLive(id);
+            if (!viewer) {
+                res = errorResponse(409, "live stream is not available");
+                res.end();
+                return;
+            }
+            res.code = 200;
+            res.set_header("Cache-Control", "no-store");
+            res.set_body_source(std::make_shared<LiveBodySource>(std::move(viewer)), "video/mp4");
+            res.end();
+        } catch (const std::exception& e) {
+            res = errorResponse(500, e.what());
+            res.end();
+        }
+    });
+
     CROW_ROUTE(app, "/api/v1/cameras/<string>")
     .methods("DELETE"_method)
     ([this](const std::string& id) {
@@ -340,6 +623,158 @@ void HttpServer::setupRoutes() {
         }
     });
 
+    // Registered before /recordings/<string>, which would take "thumbnails" as an id
+    CROW_ROUTE(app, "/recordings/thumbnails")
+    .methods("GET"_method)
+    ([this](const crow::request& req, crow::response& res) {
+        try {
+            if (!thumbnails_) {
+                res = errorResponse(503, "thumbnails are disabled");
+                res.end();
+                return;
+            }
+            const char* cameraIdRaw = req.url_params.get("camera_id");
+            const char* fromRaw = req.url_params.get("from");
+            const char* toRaw = req.url_params.get("to");
+            if (cameraIdRaw == nullptr || fromRaw == nullptr || toRaw == nullptr) {
+                res = errorResponse(400, "camera_id, from and to query params are required");
+                res.end();
+                return;
+            }
+            const int width = parseThumbnailWidth(req.url_params.get("width"));
+
+            RecordingQuery query;
+            query.cameraId = parseWholeInt64(cameraIdRaw);
+            query.fromUnix = parseWholeInt64(fromRaw);
+            query.toUnix = parseWholeInt64(toRaw);
+            if (query.fromUnix >= query.toUnix) {
+                res = errorResponse(400, "from must be less than to");
+                res.end();
+                return;
+            }
+
+            // The catalog query and the decoding run on the thumbnail workers, not on this io thread
+            const bool queued = thumbnails_->submit([this, thumbnails = thumbnails_, query, width,
+                                                     io = req.io_context, &res] {
+                crow::response answer;
+                try {
+                    std::vector<ThumbnailSource> sources;
+                    for (const auto& recording : recordingService_.findByCameraAndRange(query)) {
+                        sources.push_back(ThumbnailSource{recording.mediaFile, recording.unixTime});
+                    }
+                    const auto sheet = thumbnails->rangeSheet(sources, query.fromUnix, query.toUnix, width);
+                    if (!sheet.has_value()) {
+                        answer = errorResponse(404, "no recordings in range");
+                    } else {
+                        answer = crow::response(200);
+                        answer.set_header("Content-Type", "image/jpeg");
+                        answer.set_header("X-Thumbnail-Width", std::to_string(sheet->tile_width));
+                        answer.set_header("X-Thumbnail-Height", std::to_string(sheet->tile_height));
+                        answer.set_header("X-Thumbnail-Columns", std::to_string(sheet->columns));
+                        answer.set_header("X-Thumbnail-Count", std::to_string(sheet->count));
+                        answer.set_header("X-Thumbnail-Interval", std::to_string(sheet->interval_sec));
+                        answer.body = sheet->jpeg;
+                    }
+                } catch (const std::exception& e) {
+                    answer = errorResponse(500, e.what());
+                }
+                finishOnIoThread(io, res, std::move(answer));
+            });
+            if (!queued) {
+                res = errorResponse(503, "thumbnails are shutting down");
+                res.end();
+            }
+        } catch (const std::invalid_argument&) {
+            res = errorResponse(400, "camera_id, from, to and width must be numeric");
+            res.end();
+        } catch (const std::out_of_range&) {
+            res = errorResponse(400, "camera_id, from, to or width is out of range");
+            res.end();
+        } catch (const std::exception& e) {
+            res = errorResponse(500, e.what());
+            res.end();
+        }
+    });
+
+    // Registered before /recordings/<string>, which would take "export" as an id
+    CROW_ROUTE(app, "/recordings/export")
+    .methods("GET"_method)
+    ([this](const crow::request& req, crow::response& res) {
+        try {
+            const char* cameraIdRaw = req.url_params.get("camera_id");
+            const char* fromRaw = req.url_params.get("from");
+            const char* toRaw = req.url_params.get("to");
+            if (cameraIdRaw == nullptr || fromRaw == nullptr || toRaw == nullptr) {
+                res = errorResponse(400, "camera_id, from and to query params are required");
+                res.end();
+                return;
+            }
+            ClipFormat format = ClipFormat::Mp4;
+            const char* formatRaw = req.url_params.get("format");
+            if (formatRaw != nullptr && !parseClipFormat(formatRaw, format)) {
+                res = errorResponse(400, "format must be mp4 or mkv");
+                res.end();
+                return;
+            }
+
+            RecordingQuery query;
+            query.cameraId = parseWholeInt64(cameraIdRaw);
+            query.fromUnix = parseWholeInt64(fromRaw);
+            query.toUnix = parseWholeInt64(toRaw);
+            if (query.fromUnix >= query.toUnix) {
+                res = errorResponse(400, "from must be less than to");
+                res.end();
+                return;
+            }
+
+            std::vector<ClipSegment> segments;
+            for (const auto& recording : recordingService_.findByCameraAndRange(query)) {
+                if (std::filesystem::exists(recording.mediaFile)) {
+                    segments.push_back(ClipSegment{recording.mediaFile, recording.unixTime});
+                }
+            }
+            if (segments.empty()) {
+                res = errorResponse(404, "no recordings in range");
+                res.end();
+                return;
+            }
+
+            auto clip = std::make_unique<ClipExport>(std::move(segments), query.fromUnix, query.toUnix, format);
+            const std::string filename = std::to_string(query.cameraId) + "_" + std::to_string(query.fromUnix) + "_" +
+                                         std::to_string(query.toUnix) + "." + clipExtension(format);
+            // Opening and probing the segments is the clip's first pool task; the headers wait for it.
+            // The posted answer runs after this handler returns, so the stream is set by then.
+            auto stream = std::make_shared<std::shared_ptr<ClipStream>>();
+            *stream = impl_->exports->start(std::move(clip), [stream, io = req.io_context, &res, format,
+                                                              filename](bool opened) {
+                crow::asio::post(*io, [stream, &res, format, filename, opened] {
+                    if (!opened) {
+                        res = errorResponse(404, "no readable recordings in range");
+                        res.end();
+                        return;
+                    }
+                    res.code = 200;
+                    res.set_header("Content-Disposition", "attachment; filename=\"" + filename + "\"");
+                    res.set_body_source(std::make_shared<ClipBodySource>(*stream), clipContentType(format));
+                    res.end();
+                });
+            });
+            if (!*stream) {
+                res = errorResponse(503, "clip export is shutting down");
+                res.end();
+            }
+        } catch (const std::invalid_argument&) {
+            res = errorResponse(400, "camera_id, from and to must be numeric");
+            res.end();
+        } catch (const std::out_of_range&) {
+            res = errorResponse(400, "camera_id, from or to is out of range");
+            res.end();
+        } catch (const std::exception& e) {
+            res = errorResponse(500, e.what());
+            res.end();
+        }
+    });
+
     CROW_ROUTE(app, "/recordings/<string>")
     .methods("GET"_method)
     ([this](const std::string& idAsString) {
@@ -373,6 +808,12 @@ void HttpServer::setupRoutes() {
             if (payload.contains("mandatory_mark") && !payload.at("mandatory_mark").is_null()) {
                 command.mandatoryMark = payload.at("mandatory_mark").get<std::int64_t>();
             }
+            if (payload.contains("end_unixtime") && !payload.at("end_unixtime").is_null()) {
+                command.endUnixTime = payload.at("end_unixtime").get<std::int64_t>();
+            }
+            if (payload.contains("size_bytes") && !payload.at("size_bytes").is_null()) {
+                command.sizeBytes = payload.at("size_bytes").get<std::int64_t>();
+            }
 
             const auto result = recordingService_.registerSegment(command);
             if (result.persisted) {
@@ -391,6 +832,94 @@ void HttpServer::setupRoutes() {
         }
     });
 
+    CROW_ROUTE(app, "/recordings/<string>/thumbnails")
+    .methods("GET"_method)
+    ([this](const crow::request& req, crow::response& res, const std::string& idAsString) {
+        try {
+            if (!thumbnails_) {
+                res = errorResponse(503, "thumbnails are disabled");
+                res.end();
+                return;
+            }
+            const int width = parseThumbnailWidth(req.url_params.get("width"));
+            const std::int64_t recordId = parseWholeInt64(idAsString);
+
+            const bool queued = thumbnails_->submit([this, thumbnails = thumbnails_, recordId, width,
+                                                     io = req.io_context, &res] {
+                crow::response answer;
+                try {
+                    const auto recording = recordingService_.findById(recordId);
+                    const auto sprite = recording.has_value()
+                                            ? thumbnails->segmentSprite(recording->mediaFile, width)
+                                            : nullptr;
+                    if (!recording.has_value()) {
+                        answer = errorResponse(404, "recording not found");
+                    } else if (!sprite) {
+                        answer = errorResponse(404, "media file is missing or unreadable");
+                    } else {
+                        answer = crow::response(200);
+                        answer.set_header("Content-Type", "image/jpeg");
+                        // A closed segment never changes
+                        answer.set_header("Cache-Control", "max-age=86400");
+                        answer.set_header("X-Thumbnail-Width", std::to_string(sprite->tile_width));
+                        answer.set_header("X-Thumbnail-Height", std::to_string(sprite->tile_height));
+                        answer.set_header("X-Thumbnail-Columns", std::to_string(sprite->count));
+                        answer.set_header("X-Thumbnail-Count", std::to_string(sprite->count));
+                        answer.body = sprite->jpeg;
+                    }
+                } catch (const std::exception& e) {
+                    answer = errorResponse(500, e.what());
+                }
+                finishOnIoThread(io, res, std::move(answer));
+            });
+            if (!queued) {
+                res = errorResponse(503, "thumbnails are shutting down");
+                res.end();
+            }
+        } catch (const std::invalid_argument&) {
+            res = errorResponse(400, "id and width must be numeric");
+            res.end();
+        } catch (const std::out_of_range&) {
+            res = errorResponse(400, "id or width is out of range");
+            res.end();
+        } catch (const std::exception& e) {
+            res = errorResponse(500, e.what());
+            res.end();
+        }
+    });
+
+    CROW_ROUTE(app, "/recordings/<string>/seek")
+    .methods("GET"_method)
+    ([this](const crow::request& req, const std::string& idAsString) {
+        try {
+            const auto seek = parseSeekParams(req);
+            if (!seek.has_value()) {
+                return errorResponse(400, "t or at query param is required");
+            }
+            const std::int64_t recordId = std::stoll(idAsString);
+            const auto recording = recordingService_.findById(recordId);
+            if (!recording.has_value()) {
+                return errorResponse(404, "recording not found");
+            }
+            const auto keyframe = findSeekKeyframe(recording->mediaFile, *seek);
+            if (!keyframe.has_value()) {
+                return errorResponse(404, "recording has no keyframe index");
+            }
+            return jsonResponse(200, json{
+                {"record_id", recordId},
+                {"offset", keyframe->offset},
+                {"time", static_cast<double>(keyframe->pts_us) / 1e6},
+                {"unixtime", static_cast<double>(keyframe->unix_us) / 1e6},
+            });
+        } catch (const std::invalid_argument&) {
+            return errorResponse(400, "id, t and at must be numeric");
+        } catch (const std::out_of_range&) {
+            return errorResponse(400, "id, t or at is out of range");
+        } catch (const std::exception& e) {
+            return errorResponse(500, e.what());
+        }
+    });
+
     CROW_ROUTE(app, "/recordings/<string>/stream")
     .methods("GET"_method)
     ([this](const crow::request& req, crow::response& res, const std::string& idAsString) {
@@ -419,9 +948,28 @@ void HttpServer::setupRoutes() {
 
             std::uint64_t startOffset = 0;
             std::uint64_t endOffset = fileSize - 1;
+            std::string header;
 
             const std::string rangeHeader = req.get_header_value("Range");
-            if (!rangeHeader.empty()) {
+            const auto seek = rangeHeader.empty() ? parseSeekParams(req) : std::nullopt;
+            if (seek.has_value()) {
+                // A complete file of its own: the header up to the first cluster, then the keyframe's cluster onwards
+                const auto keyframe = findSeekKeyframe(path, *seek);
+                if (!keyframe.has_value() || keyframe->offset >= fileSize) {
+                    res = errorResponse(404, "recording has no keyframe index");
+                    res.end();
+                    return;
+                }
+                header = readMatroskaHeader(path);
+                if (header.empty() || keyframe->offset < header.size()) {
+                    res = errorResponse(404, "recording has no Matroska header");
+                    res.end();
+                    return;
+                }
+                startOffset = keyframe->offset;
+                res.code = 200;
+                res.set_header("X-Keyframe-Time", std::to_string(static_cast<double>(keyframe->pts_us) / 1e6));
+            } else if (!rangeHeader.empty()) {
                 const auto parsedRange = parseRangeHeader(rangeHeader, fileSize);
                 if (!parsedRange.has_value()) {
                     res.code = 416;
@@ -439,10 +987,14 @@ void HttpServer::setupRoutes() {
                 res.code = 200;
             }
 
-            res.set_header("Content-Type", "video/mp4");
             res.set_header("Accept-Ranges", "bytes");
-            res.set_header("Transfer-Encoding", "chunked");
-            streamFile(path, startOffset, endOffset, res);
+            streamFile(path, startOffset, endOffset, res, std::move(header));
+        } catch (const std::invalid_argument&) {
+            res = errorResponse(400, "id, t and at must be numeric");
+            res.end();
+        } catch (const std::out_of_range&) {
+            res = errorResponse(400, "id, t or at is out of range");
+            res.end();
         } catch (const std::exception& e) {
             res = errorResponse(500, e.what());
             res.end();
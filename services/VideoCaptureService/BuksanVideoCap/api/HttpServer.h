@@ -6,11 +6,14 @@
 #include "services/NodeService.h"
 #include "services/RecordingService.h"
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
 
 namespace buksan {
 
 struct HttpServerImpl;
+class ThumbnailCache;
 
 class HttpServer {
 public:
@@ -23,6 +26,10 @@ public:
 
     void run();
     void setupRoutes();
+    // Serves the thumbnail routes; without it they answer 503
+    void setThumbnailCache(std::shared_ptr<ThumbnailCache> thumbnails);
+    // Told the device id of each camera added through the API, so its segments can be catalogued
+    void setCameraRegisteredHandler(std::function<void(const std::string& cameraId, std::int64_t deviceId)> handler);
 
 private:
     CameraManager& manager_;
@@ -30,6 +37,8 @@ private:
     CameraService& cameraService_;
     NodeService& nodeService_;
     uint16_t port_;
+    std::shared_ptr<ThumbnailCache> thumbnails_;
+    std::function<void(const std::string&, std::int64_t)> cameraRegistered_;
     std::unique_ptr<HttpServerImpl> impl_;
 };
 
@@ -1,112 +1,386 @@
 #include "CameraManager.h"
 #include "../src/CameraSession.h"
-#include "../src/ConfigLoader.h"
+#include "utils/Logger.h"
 #include <algorithm>
+#include <thread>
 
 namespace buksan {
 
+const char* toString(CameraState state) {
+    switch (state) {
+    case CameraState::Stopped: return "stopped";
+    case CameraState::Starting: return "starting";
+    case CameraState::Running: return "running";
+    case CameraState::Stopping: return "stopping";
+    case CameraState::Failed: return "failed";
+    }
+    return "stopped";
+}
+
+CameraManager::CameraManager(unsigned analytics_workers, unsigned writer_workers)
+    : analytics_pool_(std::make_unique<AnalyticsPool>(analytics_workers))
+    , scheduler_(std::make_unique<CaptureScheduler>(writer_workers))
+{
+}
+
+CameraManager::~CameraManager() {
+    // Background starts and stops use the pools and the entries
+    waitForOperations();
+}
+
 bool CameraManager::addCamera(const std::string& id,
                              const std::string& rtsp_url,
                              const std::string& storage_path,
                              int segment_duration) {
-    if (id.empty() || rtsp_url.empty() || storage_path.empty()) {
-        return false;
+    CameraConfig config;
+    config.id = id;
+    config.rtsp_url = rtsp_url;
+    return addCamera(config, storage_path, segment_duration);
+}
+
+bool CameraManager::addCamera(const CameraConfig& config,
+                             const std::string& storage_path,
+                             int segment_duration) {
+    std::shared_ptr<StorageVolumes> volumes;
+    if (!storage_path.empty()) {
+        volumes = std::make_shared<StorageVolumes>(std::vector<std::string>{storage_path});
+    } else {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        volumes = volumes_;
     }
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (cameras_.find(id) != cameras_.end()) {
+    return addCamera(config, std::move(volumes), segment_duration);
+}
+
+bool CameraManager::addCamera(const CameraConfig& config,
+                             std::shared_ptr<StorageVolumes> volumes,
+                             int segment_duration) {
+    if (config.id.empty() || config.rtsp_url.empty() || !volumes) {
         return false;
     }
-    CameraEntry e;
-    e.id = id;
-    e.rtsp_url = rtsp_url;
-    e.storage_path = storage_path;
-    e.segment_duration = segment_duration <= 0 ? 300 : segment_duration;
-    cameras_[id] = std::move(e);
-    return true;
+    auto e = std::make_shared<CameraEntry>();
+    e->config = config;
+    e->volumes = std::move(volumes);
+    e->segment_duration = segment_duration <= 0 ? 300 : segment_duration;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    return cameras_.emplace(config.id, std::move(e)).second;
 }
 
 bool CameraManager::removeCamera(const std::string& id) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_lock<std::shared_mutex> lock(mutex_);
     auto it = cameras_.find(id);
     if (it == cameras_.end()) {
         return false;
     }
-    if (it->second.session && it->second.session->running()) {
-        return false;
+    {
+        std::lock_guard<std::mutex> entryLock(it->second->mutex);
+        if (it->second->state != CameraState::Stopped && it->second->state != CameraState::Failed) {
+            return false;
+        }
     }
     cameras_.erase(it);
     return true;
 }
 
-bool CameraManager::startRecording(const std::string& id) {
-    std::lock_guard<std::mutex> lock(mutex_);
+std::shared_ptr<CameraEntry> CameraManager::findEntry(const std::string& id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     auto it = cameras_.find(id);
-    if (it == cameras_.end()) {
+    return it == cameras_.end() ? nullptr : it->second;
+}
+
+CameraOpResult CameraManager::beginTransition(const std::string& id, bool start, std::shared_ptr<CameraEntry>& entry) {
+    entry = findEntry(id);
+    if (!entry) {
+        return CameraOpResult::NotFound;
+    }
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    if (start) {
+        if (entry->state != CameraState::Stopped && entry->state != CameraState::Failed) {
+            return CameraOpResult::Conflict;
+        }
+        entry->state = CameraState::Starting;
+        entry->error.clear();
+    } else {
+        if (entry->state != CameraState::Running) {
+            return CameraOpResult::Conflict;
+        }
+        entry->state = CameraState::Stopping;
+    }
+    return CameraOpResult::Accepted;
+}
+
+void CameraManager::runStart(const std::shared_ptr<CameraEntry>& entry) {
+    CameraSegmentHandler handler;
+    std::shared_ptr<EncoderPool> encoders;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        handler = segment_handler_;
+        encoders = encoders_;
+    }
+
+    std::shared_ptr<CameraSession> session;
+    std::string error;
+    try {
+        CameraConfig config = entry->config;
+        config.record = true;
+        session = std::make_shared<CameraSession>(config, entry->volumes, entry->segment_duration,
+                                                  analytics_pool_.get(), scheduler_.get(), std::move(encoders));
+        session->setSegmentHandler(std::move(handler));
+        session->start();
+    } catch (const std::exception& e) {
+        error = e.what();
+        session.reset();
+        logError(entry->config.id) << "start failed: " << error;
+    }
+
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    entry->session = std::move(session);
+    entry->state = entry->session ? CameraState::Running : CameraState::Failed;
+    entry->error = std::move(error);
+}
+
+void CameraManager::runStop(const std::shared_ptr<CameraEntry>& entry) {
+    std::shared_ptr<CameraSession> session;
+    {
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        session = entry->session;
+    }
+    if (session) {
+        session->stop();
+    }
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    entry->session.reset();
+    entry->state = CameraState::Stopped;
+}
+
+void CameraManager::launch(std::function<void()> operation) {
+    std::thread([this, operation = std::move(operation)] {
+        operation();
+        // Last touch of the manager: the destructor waits for this count
+        endOperation();
+    }).detach();
+}
+
+void CameraManager::beginOperation() {
+    std::lock_guard<std::mutex> lock(operations_mutex_);
+    ++operations_;
+}
+
+void CameraManager::endOperation() {
+    std::lock_guard<std::mutex> lock(operations_mutex_);
+    --operations_;
+    operations_done_.notify_all();
+}
+
+void CameraManager::waitForOperations() {
+    std::unique_lock<std::mutex> lock(operations_mutex_);
+    operations_done_.wait(lock, [this] { return operations_ == 0; });
+}
+
+bool CameraManager::startRecording(const std::string& id) {
+    std::shared_ptr<CameraEntry> entry;
+    beginOperation();
+    if (beginTransition(id, true, entry) != CameraOpResult::Accepted) {
+        endOperation();
         return false;
     }
-    CameraEntry& e = it->second;
-    if (e.session && e.session->running()) {
+    runStart(entry);
+    endOperation();
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    return entry->state == CameraState::Running;
+}
+
+bool CameraManager::stopRecording(const std::string& id) {
+    std::shared_ptr<CameraEntry> entry;
+    beginOperation();
+    if (beginTransition(id, false, entry) != CameraOpResult::Accepted) {
+        endOperation();
         return false;
     }
-    CameraConfig config;
-    config.id = e.id;
-    config.rtsp_url = e.rtsp_url;
-    config.record = true;
-    config.analytics = false;
-    e.session = std::make_shared<CameraSession>(config, e.storage_path, e.segment_duration);
-    e.session->start();
+    runStop(entry);
+    endOperation();
     return true;
 }
 
-bool CameraManager::stopRecording(const std::string& id) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = cameras_.find(id);
-    if (it == cameras_.end()) {
+CameraOpResult CameraManager::startRecordingAsync(const std::string& id) {
+    std::shared_ptr<CameraEntry> entry;
+    // Counted before the transition so stopAll never sees Starting without an operation to wait for
+    beginOperation();
+    const CameraOpResult result = beginTransition(id, true, entry);
+    if (result == CameraOpResult::Accepted) {
+        launch([this, entry] { runStart(entry); });
+    } else {
+        endOperation();
+    }
+    return result;
+}
+
+CameraOpResult CameraManager::stopRecordingAsync(const std::string& id) {
+    std::shared_ptr<CameraEntry> entry;
+    beginOperation();
+    const CameraOpResult result = beginTransition(id, false, entry);
+    if (result == CameraOpResult::Accepted) {
+        launch([this, entry] { runStop(entry); });
+    } else {
+        endOperation();
+    }
+    return result;
+}
+
+std::string CameraManager::getStatus(const std::string& id) const {
+    const auto status = getCameraStatus(id);
+    return status ? toString(status->state) : "";
+}
+
+std::optional<CameraStatus> CameraManager::getCameraStatus(const std::string& id) const {
+    const auto entry = findEntry(id);
+    if (!entry) {
+        return std::nullopt;
+    }
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    return CameraStatus{entry->state, entry->error};
+}
+
+bool CameraManager::cameraExists(const std::string& id) const {
+    return findEntry(id) != nullptr;
+}
+
+std::optional<CaptureQueueStats> CameraManager::getQueueStats(const std::string& id) const {
+    const auto entry = findEntry(id);
+    if (!entry) {
+        return std::nullopt;
+    }
+    std::shared_ptr<CameraSession> session;
+    {
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        session = entry->session;
+    }
+    if (!session) {
+        return std::nullopt;
+    }
+    return session->queueStats();
+}
+
+std::optional<AnalyticsStats> CameraManager::getAnalyticsStats(const std::string& id) const {
+    const auto entry = findEntry(id);
+    if (!entry) {
+        return std::nullopt;
+    }
+    std::shared_ptr<CameraSession> session;
+    {
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        session = entry->session;
+    }
+    if (!session) {
+        return std::nullopt;
+    }
+    return session->analyticsStats();
+}
+
+bool CameraManager::triggerEvent(const std::string& id, std::optional<std::int64_t> alertId) {
+    const auto entry = findEntry(id);
+    if (!entry) {
         return false;
     }
-    CameraEntry& e = it->second;
-    if (!e.session || !e.session->running()) {
+    std::shared_ptr<CameraSession> session;
+    {
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        if (entry->state == CameraState::Running) {
+            session = entry->session;
+        }
+    }
+    if (!session || !session->running()) {
         return false;
     }
-    e.session->stop();
-    e.session.reset();
+    session->triggerEvent(alertId);
     return true;
 }
 
-std::string CameraManager::getStatus(const std::string& id) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = cameras_.find(id);
-    if (it == cameras_.end()) {
-        return "";
+std::shared_ptr<LiveViewer> CameraManager::subscribeLive(const std::string& id) {
+    const auto entry = findEntry(id);
+    if (!entry) {
+        return nullptr;
     }
-    if (it->second.session && it->second.session->running()) {
-        return "running";
+    std::shared_ptr<CameraSession> session;
+    {
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        if (entry->state == CameraState::Running) {
+            session = entry->session;
+        }
     }
-    return "stopped";
+    if (!session || !session->running()) {
+        return nullptr;
+    }
+    return session->subscribeLive();
 }
 
-bool CameraManager::cameraExists(const std::string& id) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return cameras_.find(id) != cameras_.end();
+void CameraManager::setSegmentHandler(CameraSegmentHandler handler) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    segment_handler_ = std::move(handler);
 }
 
-void CameraManager::stopAll() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (auto& p : cameras_) {
-        if (p.second.session && p.second.session->running()) {
-            p.second.session->stop();
-            p.second.session.reset();
+void CameraManager::setStorageVolumes(std::shared_ptr<StorageVolumes> volumes) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    volumes_ = std::move(volumes);
+}
+
+void CameraManager::setEncoderPool(std::shared_ptr<EncoderPool> encoders) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    encoders_ = std::move(encoders);
+}
+
+std::vector<VolumeStats> CameraManager::getVolumeStats() const {
+    std::shared_ptr<StorageVolumes> volumes;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        volumes = volumes_;
+    }
+    return volumes ? volumes->stats() : std::vector<VolumeStats>{};
+}
+
+bool CameraManager::anyActive() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    for (const auto& p : cameras_) {
+        std::lock_guard<std::mutex> entryLock(p.second->mutex);
+        const CameraState state = p.second->state;
+        if (state == CameraState::Starting || state == CameraState::Running || state == CameraState::Stopping) {
+            return true;
         }
     }
+    return false;
+}
+
+void CameraManager::stopAll() {
+    // Each teardown joins its own threads; running them side by side keeps shutdown
+    // close to the slowest camera instead of the sum of all of them.
+    // A camera still starting refuses the stop; waiting lets its start finish so the next pass stops it.
+    do {
+        std::vector<std::string> ids;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            ids.reserve(cameras_.size());
+            for (const auto& p : cameras_) {
+                ids.push_back(p.first);
+            }
+        }
+        for (const auto& id : ids) {
+            stopRecordingAsync(id);
+        }
+        waitForOperations();
+    } while (anyActive());
 }
 
 std::vector<std::pair<std::string, std::string>> CameraManager::listCameras() const {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<std::string, std::shared_ptr<CameraEntry>>> entries;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        entries.assign(cameras_.begin(), cameras_.end());
+    }
     std::vector<std::pair<std::string, std::string>> out;
-    out.reserve(cameras_.size());
-    for (const auto& p : cameras_) {
-        std::string status = (p.second.session && p.second.session->running()) ? "running" : "stopped";
-        out.emplace_back(p.first, status);
+    out.reserve(entries.size());
+    for (const auto& [id, entry] : entries) {
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        out.emplace_back(id, toString(entry->state));
     }
     return out;
 }
@@ -1,44 +1,136 @@
 #ifndef CORE_CAMERAMANAGER_H
 #define CORE_CAMERAMANAGER_H
 
+#include "../src/AnalyticsPool.h"
+#include "../src/CaptureQueue.h"
+#include "../src/CaptureScheduler.h"
+#include "../src/ConfigLoader.h"
+#include "../src/EncoderPool.h"
+#include "../src/LiveStream.h"
+#include "../src/Recorder.h"
+#include "../src/StorageVolumes.h"
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
 
 namespace buksan {
 
 class CameraSession;
 
+enum class CameraState {
+    Stopped,
+    Starting,
+    Running,
+    Stopping,
+    Failed
+};
+
+const char* toString(CameraState state);
+
+enum class CameraOpResult {
+    Accepted,
+    NotFound,
+    // Another start or stop is in progress, or the camera is already in the requested state
+    Conflict
+};
+
+struct CameraStatus {
+    CameraState state{CameraState::Stopped};
+    // Why the last start failed
+    std::string error;
+};
+
 struct CameraEntry {
-    std::string id;
-    std::string rtsp_url;
-    std::string storage_path;
+    CameraConfig config;
+    std::shared_ptr<StorageVolumes> volumes;
     int segment_duration{300};
+
+    // Guards the fields below; never held while a session starts or stops
+    std::mutex mutex;
+    CameraState state{CameraState::Stopped};
+    std::string error;
     std::shared_ptr<CameraSession> session;
 };
 
 class CameraManager {
 public:
-    CameraManager() = default;
+    // analytics_workers == 0 uses one analytics thread per core,
+    // writer_workers == 0 half the cores for writing all cameras' segments
+    explicit CameraManager(unsigned analytics_workers = 0, unsigned writer_workers = 0);
+    ~CameraManager();
+
+    CameraManager(const CameraManager&) = delete;
+    CameraManager& operator=(const CameraManager&) = delete;
 
     bool addCamera(const std::string& id,
                   const std::string& rtsp_url,
                   const std::string& storage_path,
                   int segment_duration);
+    bool addCamera(const CameraConfig& config,
+                  const std::string& storage_path,
+                  int segment_duration);
+    bool addCamera(const CameraConfig& config,
+                  std::shared_ptr<StorageVolumes> volumes,
+                  int segment_duration);
+    // Volumes for cameras added without an explicit storage path
+    void setStorageVolumes(std::shared_ptr<StorageVolumes> volumes);
+    std::vector<VolumeStats> getVolumeStats() const;
+    // Shared by transcoding sessions started afterwards; without it each one uses cv::VideoWriter
+    void setEncoderPool(std::shared_ptr<EncoderPool> encoders);
     bool removeCamera(const std::string& id);
+    // Blocking versions: return once the session has started or stopped
     bool startRecording(const std::string& id);
     bool stopRecording(const std::string& id);
+    // Return at once; progress shows up in getCameraStatus
+    CameraOpResult startRecordingAsync(const std::string& id);
+    CameraOpResult stopRecordingAsync(const std::string& id);
     std::string getStatus(const std::string& id) const;
+    std::optional<CameraStatus> getCameraStatus(const std::string& id) const;
     bool cameraExists(const std::string& id) const;
+    std::optional<CaptureQueueStats> getQueueStats(const std::string& id) const;
+    std::optional<AnalyticsStats> getAnalyticsStats(const std::string& id) const;
+    bool triggerEvent(const std::string& id, std::optional<std::int64_t> alertId);
+    // nullptr when the camera is not running, has no stream to share or is at its viewer limit
+    std::shared_ptr<LiveViewer> subscribeLive(const std::string& id);
+    // Stops every session in parallel and waits for all of them
     void stopAll();
+    // Applied to sessions started afterwards; the handler runs on the writer threads and must not block.
+    void setSegmentHandler(CameraSegmentHandler handler);
 
     std::vector<std::pair<std::string, std::string>> listCameras() const;
 
 private:
-    mutable std::mutex mutex_;
-    std::unordered_map<std::string, CameraEntry> cameras_;
+    std::shared_ptr<CameraEntry> findEntry(const std::string& id) const;
+    CameraOpResult beginTransition(const std::string& id, bool start, std::shared_ptr<CameraEntry>& entry);
+    void runStart(const std::shared_ptr<CameraEntry>& entry);
+    void runStop(const std::shared_ptr<CameraEntry>& entry);
+    void launch(std::function<void()> operation);
+    // Every start or stop, blocking or not, is counted from its transition to its end
+    void beginOperation();
+    void endOperation();
+    void waitForOperations();
+    bool anyActive() const;
+
+    // Guards the camera map, the handler, the default volumes and the encoder pool; lookups share it
+    mutable std::shared_mutex mutex_;
+    // Declared before cameras_ so sessions detach before the pools shut down
+    std::unique_ptr<AnalyticsPool> analytics_pool_;
+    std::unique_ptr<CaptureScheduler> scheduler_;
+    std::shared_ptr<EncoderPool> encoders_;
+    std::unordered_map<std::string, std::shared_ptr<CameraEntry>> cameras_;
+    CameraSegmentHandler segment_handler_;
+    std::shared_ptr<StorageVolumes> volumes_;
+
+    std::mutex operations_mutex_;
+    std::condition_variable operations_done_;
+    std::size_t operations_{0};
 };
 
 } // namespace buksan
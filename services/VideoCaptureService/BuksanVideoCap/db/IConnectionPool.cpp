@@ -1,9 +1,14 @@
 #include "IConnectionPool.h"
+#include "utils/Metrics.h"
 #include <pqxx/pqxx>
 #include <utility>
 
 namespace buksan {
 
+Histogram& queryHistogram(const std::string& query) {
+    return metrics().histogram("buksan_db_query_seconds", "Database round-trip time per query", {{"query", query}});
+}
+
 PooledConnection::PooledConnection(std::shared_ptr<IConnectionPool> pool, std::shared_ptr<pqxx::connection> connection)
     : pool_(std::move(pool))
     , connection_(std::move(connection)) {
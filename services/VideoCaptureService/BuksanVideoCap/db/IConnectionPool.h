@@ -2,6 +2,7 @@
 #define DB_ICONNECTIONPOOL_H
 
 #include <memory>
+#include <string>
 
 namespace pqxx {
 class connection;
@@ -9,12 +10,20 @@ class connection;
 
 namespace buksan {
 
+class Histogram;
+
+// Round-trip time of one repository query; look it up once per call site and keep the reference
+Histogram& queryHistogram(const std::string& query);
+
 class IConnectionPool {
 public:
     virtual ~IConnectionPool() = default;
 
     virtual std::shared_ptr<pqxx::connection> acquire() = 0;
     virtual void release(std::shared_ptr<pqxx::connection> connection) = 0;
+    // Every connection handed out by acquire() has the statement prepared under this name,
+    // so call sites run it with exec_prepared. Repositories register theirs when constructed.
+    virtual void registerStatement(const std::string& name, const std::string& sql) = 0;
 };
 
 class PooledConnection {
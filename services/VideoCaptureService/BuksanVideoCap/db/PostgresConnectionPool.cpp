@@ -1,41 +1,83 @@
 #include "db/PostgresConnectionPool.h"
+#include "utils/Logger.h"
 #include <pqxx/pqxx>
+#include <algorithm>
 #include <stdexcept>
 #include <utility>
 
 namespace buksan {
 
 PostgresConnectionPool::PostgresConnectionPool(std::string connectionString, std::size_t poolSize)
+    : PostgresConnectionPool(std::move(connectionString), PostgresPoolSettings{poolSize}) {
+}
+
+PostgresConnectionPool::PostgresConnectionPool(std::string connectionString, PostgresPoolSettings settings)
     : connectionString_(std::move(connectionString))
-    , poolSize_(poolSize) {
-    if (poolSize_ == 0) {
+    , settings_(settings)
+    , waitSeconds_(metrics().histogram("buksan_db_pool_wait_seconds",
+                                       "Time to obtain a connection, including opening a new one"))
+    , openConnections_(metrics().gauge("buksan_db_pool_connections", "Open PostgreSQL connections, idle or in use"))
+    , recycled_(metrics().counter("buksan_db_pool_recycled_total",
+                                  "Connections closed by the pool for age or a failed health check")) {
+    if (settings_.poolSize == 0) {
         throw std::invalid_argument("Postgres connection pool size must be greater than zero");
     }
+    settings_.minIdle = std::min(settings_.minIdle, settings_.poolSize);
+    if (settings_.healthCheckInterval.count() <= 0) {
+        settings_.healthCheckInterval = std::chrono::seconds(30);
+    }
+}
+
+PostgresConnectionPool::~PostgresConnectionPool() {
+    stop();
+}
+
+void PostgresConnectionPool::start() {
+    if (running_.exchange(true)) {
+        return;
+    }
+    fillIdle();
+    maintenanceThread_ = std::thread(&PostgresConnectionPool::runMaintenance, this);
+}
+
+void PostgresConnectionPool::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(maintenanceMutex_);
+    }
+    maintenanceCv_.notify_all();
+    if (maintenanceThread_.joinable()) {
+        maintenanceThread_.join();
+    }
 }
 
 std::shared_ptr<pqxx::connection> PostgresConnectionPool::acquire() {
+    ScopedTimer timer(waitSeconds_);
     while (true) {
+        std::shared_ptr<pqxx::connection> connection;
         {
             std::unique_lock<std::mutex> lock(mutex_);
             if (!available_.empty()) {
-                auto connection = available_.front();
-                available_.pop();
-                return connection;
-            }
-            if (activeConnections_ < poolSize_) {
+                connection = std::move(available_.front());
+                available_.pop_front();
+            } else if (activeConnections_ < settings_.poolSize) {
                 ++activeConnections_;
                 lock.unlock();
-                auto connection = std::make_shared<pqxx::connection>(connectionString_);
-                if (!connection->is_open()) {
-                    std::lock_guard<std::mutex> rollbackLock(mutex_);
-                    --activeConnections_;
-                    cv_.notify_one();
-                    throw std::runtime_error("Cannot open PostgreSQL connection");
-                }
-                return connection;
+                connection = openConnection();
+            } else {
+                cv_.wait(lock, [this] { return !available_.empty() || activeConnections_ < settings_.poolSize; });
+                continue;
             }
-            cv_.wait(lock, [this] { return !available_.empty() || activeConnections_ < poolSize_; });
         }
+        try {
+            prepareStatements(*connection);
+        } catch (...) {
+            discard(connection.get());
+            throw;
+        }
+        return connection;
     }
 }
 
@@ -46,11 +88,169 @@ void PostgresConnectionPool::release(std::shared_ptr<pqxx::connection> connectio
             if (activeConnections_ > 0) {
                 --activeConnections_;
             }
+            states_.erase(connection.get());
+        } else if (expired(*connection)) {
+            --activeConnections_;
+            states_.erase(connection.get());
+            recycled_.inc();
         } else {
-            available_.push(std::move(connection));
+            available_.push_back(std::move(connection));
+        }
+        openConnections_.set(static_cast<double>(activeConnections_));
+    }
+    cv_.notify_one();
+}
+
+void PostgresConnectionPool::registerStatement(const std::string& name, const std::string& sql) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& statement : statements_) {
+        if (statement.first == name) {
+            if (statement.second != sql) {
+                throw std::invalid_argument("Prepared statement " + name + " is already registered with other SQL");
+            }
+            return;
+        }
+    }
+    statements_.emplace_back(name, sql);
+}
+
+// Called with a slot already counted in activeConnections_; gives it back if the connection fails
+std::shared_ptr<pqxx::connection> PostgresConnectionPool::openConnection() {
+    std::shared_ptr<pqxx::connection> connection;
+    try {
+        connection = std::make_shared<pqxx::connection>(connectionString_);
+    } catch (...) {
+        discard(nullptr);
+        throw;
+    }
+    if (!connection->is_open()) {
+        discard(nullptr);
+        throw std::runtime_error("Cannot open PostgreSQL connection");
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    states_[connection.get()] = ConnectionState{std::chrono::steady_clock::now(), 0};
+    openConnections_.set(static_cast<double>(activeConnections_));
+    return connection;
+}
+
+// Prepares the statements registered since this connection was last prepared; not under mutex_,
+// as each one is a round trip
+void PostgresConnectionPool::prepareStatements(pqxx::connection& connection) {
+    std::size_t from = 0;
+    std::vector<std::pair<std::string, std::string>> missing;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto it = states_.find(&connection);
+        from = it != states_.end() ? it->second.prepared : 0;
+        if (from >= statements_.size()) {
+            return;
+        }
+        missing.assign(statements_.begin() + static_cast<std::ptrdiff_t>(from), statements_.end());
+    }
+    for (const auto& statement : missing) {
+        connection.prepare(statement.first, statement.second);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = states_.find(&connection);
+    if (it != states_.end()) {
+        it->second.prepared = from + missing.size();
+    }
+}
+
+// Caller holds mutex_
+bool PostgresConnectionPool::expired(const pqxx::connection& connection) const {
+    if (settings_.maxLifetime.count() <= 0) {
+        return false;
+    }
+    const auto it = states_.find(&connection);
+    return it != states_.end() && std::chrono::steady_clock::now() - it->second.openedAt >= settings_.maxLifetime;
+}
+
+void PostgresConnectionPool::discard(const pqxx::connection* connection) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (activeConnections_ > 0) {
+            --activeConnections_;
         }
+        states_.erase(connection);
+        openConnections_.set(static_cast<double>(activeConnections_));
     }
     cv_.notify_one();
 }
 
+void PostgresConnectionPool::runMaintenance() {
+    while (running_.load()) {
+        {
+            std::unique_lock<std::mutex> lock(maintenanceMutex_);
+            maintenanceCv_.wait_for(lock, settings_.healthCheckInterval, [this] { return !running_.load(); });
+        }
+        if (!running_.load()) {
+            break;
+        }
+        checkIdle();
+        fillIdle();
+    }
+}
+
+// Takes idle connections out one at a time, so requests keep the rest while one is being checked
+void PostgresConnectionPool::checkIdle() {
+    std::size_t remaining = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        remaining = available_.size();
+    }
+    for (; remaining > 0 && running_.load(); --remaining) {
+        std::shared_ptr<pqxx::connection> connection;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (available_.empty()) {
+                return;
+            }
+            connection = std::move(available_.front());
+            available_.pop_front();
+            if (expired(*connection)) {
+                --activeConnections_;
+                states_.erase(connection.get());
+                openConnections_.set(static_cast<double>(activeConnections_));
+                recycled_.inc();
+                continue;
+            }
+        }
+        try {
+            pqxx::nontransaction tx(*connection);
+            tx.exec("SELECT 1");
+        } catch (const std::exception& e) {
+            logRepeated(LogLevel::Warn, "db", "health") << "Idle PostgreSQL connection dropped: " << e.what();
+            discard(connection.get());
+            recycled_.inc();
+            continue;
+        }
+        release(std::move(connection));
+    }
+}
+
+void PostgresConnectionPool::fillIdle() {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (available_.size() >= settings_.minIdle || activeConnections_ >= settings_.poolSize) {
+                return;
+            }
+            ++activeConnections_;
+        }
+        std::shared_ptr<pqxx::connection> connection;
+        try {
+            connection = openConnection();
+            prepareStatements(*connection);
+        } catch (const std::exception& e) {
+            if (connection) {
+                discard(connection.get());
+            }
+            logRepeated(LogLevel::Warn, "db", "warm-up") << "Cannot open idle PostgreSQL connection: " << e.what();
+            return;
+        }
+        release(std::move(connection));
+    }
+}
+
 } // namespace buksan
@@ -2,12 +2,19 @@
 #define DB_POSTGRESCONNECTIONPOOL_H
 
 #include "db/IConnectionPool.h"
+#include "utils/Metrics.h"
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
+#include <deque>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace pqxx {
 class connection;
@@ -15,20 +22,60 @@ class connection;
 
 namespace buksan {
 
+struct PostgresPoolSettings {
+    std::size_t poolSize{8};
+    // Connections kept open while idle; opened by start() and topped up in the background
+    std::size_t minIdle{2};
+    // Connections older than this are closed when returned or found idle; zero keeps them forever
+    std::chrono::seconds maxLifetime{1800};
+    std::chrono::seconds healthCheckInterval{30};
+};
+
 class PostgresConnectionPool final : public IConnectionPool {
 public:
     PostgresConnectionPool(std::string connectionString, std::size_t poolSize);
+    PostgresConnectionPool(std::string connectionString, PostgresPoolSettings settings);
+    ~PostgresConnectionPool() override;
+
+    // Opens minIdle connections and starts health checks; a database that is down is only logged
+    void start();
+    void stop();
 
     std::shared_ptr<pqxx::connection> acquire() override;
     void release(std::shared_ptr<pqxx::connection> connection) override;
+    void registerStatement(const std::string& name, const std::string& sql) override;
 
 private:
+    struct ConnectionState {
+        std::chrono::steady_clock::time_point openedAt;
+        // Statements are only ever appended, so a count says which ones this connection still lacks
+        std::size_t prepared{0};
+    };
+
+    std::shared_ptr<pqxx::connection> openConnection();
+    void prepareStatements(pqxx::connection& connection);
+    bool expired(const pqxx::connection& connection) const;
+    void discard(const pqxx::connection* connection);
+    void runMaintenance();
+    void checkIdle();
+    void fillIdle();
+
     std::string connectionString_;
-    std::size_t poolSize_{0};
-    std::queue<std::shared_ptr<pqxx::connection>> available_;
+    PostgresPoolSettings settings_;
+    Histogram& waitSeconds_;
+    Gauge& openConnections_;
+    Counter& recycled_;
+    std::deque<std::shared_ptr<pqxx::connection>> available_;
+    std::unordered_map<const pqxx::connection*, ConnectionState> states_;
+    std::vector<std::pair<std::string, std::string>> statements_;
     std::size_t activeConnections_{0};
     std::mutex mutex_;
     std::condition_variable cv_;
+
+    std::atomic<bool> running_{false};
+    std::mutex maintenanceMutex_;
+    std::condition_variable maintenanceCv_;
+    std::thread maintenanceThread_;
 };
 
 } // namespace buksan
@@ -17,9 +17,14 @@ CREATE TABLE IF NOT EXISTS recordings (
     device BIGINT NOT NULL REFERENCES devices(deviceId),
     "time" TIME WITHOUT TIME ZONE NOT NULL,
     "date" DATE NOT NULL,
-    mandatoryMark BIGINT NULL
+    mandatoryMark BIGINT NULL,
+    end_unixtime BIGINT NULL,
+    size_bytes BIGINT NULL
 );
 
+ALTER TABLE recordings ADD COLUMN IF NOT EXISTS end_unixtime BIGINT NULL;
+ALTER TABLE recordings ADD COLUMN IF NOT EXISTS size_bytes BIGINT NULL;
+
 CREATE TABLE IF NOT EXISTS nodes (
     node_id UUID PRIMARY KEY,
     caption TEXT NOT NULL,
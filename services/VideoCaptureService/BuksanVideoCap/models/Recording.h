@@ -1,6 +1,7 @@
 #ifndef MODELS_RECORDING_H
 #define MODELS_RECORDING_H
 
+#include <cstddef>
 #include <cstdint>
 #include <optional>
 #include <string>
@@ -18,6 +19,8 @@ struct Recording {
     std::string timeValue;
     std::string dateValue;
     std::optional<std::int64_t> mandatoryMark;
+    std::optional<std::int64_t> endUnixTime;
+    std::optional<std::int64_t> sizeBytes;
 };
 
 struct CreateRecordingCommand {
@@ -29,6 +32,24 @@ struct CreateRecordingCommand {
     std::string timeValue;
     std::string dateValue;
     std::optional<std::int64_t> mandatoryMark;
+    std::optional<std::int64_t> endUnixTime;
+    std::optional<std::int64_t> sizeBytes;
+    // Set, with deviceId 0, while the camera's device id is unknown; resolved when the queue is flushed
+    std::string cameraId;
+};
+
+struct BatchInsertResult {
+    std::size_t inserted{0};
+    // Positions in the submitted batch that the database refused (bad data or constraint violations)
+    std::vector<std::size_t> rejected;
+    // Database error for each entry of rejected, in the same order
+    std::vector<std::string> rejectionReasons;
+};
+
+// Catalog entry as seen by storage reconciliation
+struct MediaFileRef {
+    std::int64_t recordId{0};
+    std::string mediaFile;
 };
 
 struct RecordingQuery {
@@ -3,6 +3,7 @@
 
 #include "models/Recording.h"
 #include <cstddef>
+#include <vector>
 
 namespace buksan {
 
@@ -12,6 +13,10 @@ public:
 
     virtual void enqueue(CreateRecordingCommand command) = 0;
     virtual bool tryDequeue(CreateRecordingCommand& command) = 0;
+    // Copies up to maxCount commands from the head without removing them; single consumer only.
+    virtual std::size_t peekBatch(std::size_t maxCount, std::vector<CreateRecordingCommand>& batch) = 0;
+    // Removes count commands from the head once they have been handled.
+    virtual void acknowledge(std::size_t count) = 0;
     virtual std::size_t size() const = 0;
 };
 
@@ -2,8 +2,10 @@
 #define REPOSITORIES_INTERFACES_IRECORDINGREPOSITORY_H
 
 #include "models/Recording.h"
+#include <cstddef>
 #include <cstdint>
 #include <optional>
+#include <string>
 #include <vector>
 
 namespace buksan {
@@ -15,6 +17,14 @@ public:
     virtual std::vector<Recording> findByCameraAndRange(const RecordingQuery& query) = 0;
     virtual std::optional<Recording> findById(std::int64_t recordingId) = 0;
     virtual std::int64_t create(const CreateRecordingCommand& command) = 0;
+    // Inserts the rows in one transaction. Rows the database refuses are skipped and reported;
+    // any other failure throws with nothing committed.
+    virtual BatchInsertResult createBatch(const std::vector<CreateRecordingCommand>& commands) = 0;
+    // Media files among mediaFiles that carry a mandatory mark or an alert and must not be deleted.
+    virtual std::vector<std::string> findProtectedMediaFiles(const std::vector<std::string>& mediaFiles) = 0;
+    virtual std::size_t deleteByMediaFiles(const std::vector<std::string>& mediaFiles) = 0;
+    // Up to limit rows without a mandatory mark or alert and with recordid > afterRecordId, in id order.
+    virtual std::vector<MediaFileRef> listDeletableMediaFiles(std::int64_t afterRecordId, std::size_t limit) = 0;
 };
 
 } // namespace buksan
@@ -1,4 +1,5 @@
 #include "repositories/postgres/PostgresCameraRepository.h"
+#include "utils/Metrics.h"
 #include <pqxx/pqxx>
 #include <stdexcept>
 
@@ -27,17 +28,35 @@ PostgresCameraRepository::PostgresCameraRepository(std::shared_ptr<IConnectionPo
     if (!pool_) {
         throw std::invalid_argument("PostgresCameraRepository requires a connection pool");
     }
+    pool_->registerStatement(
+        "cameras.find_by_id",
+        "SELECT deviceid, type, adddate, caption, rtsp_url, assigned_node_id, status "
+        "FROM devices WHERE deviceid = $1");
+    pool_->registerStatement(
+        "cameras.find_by_rtsp_url",
+        "SELECT deviceid, type, adddate, caption, rtsp_url, assigned_node_id, status "
+        "FROM devices WHERE rtsp_url = $1 "
+        "ORDER BY deviceid ASC "
+        "LIMIT 1");
+    pool_->registerStatement(
+        "cameras.list_all",
+        "SELECT deviceid, type, adddate, caption, rtsp_url, assigned_node_id, status "
+        "FROM devices ORDER BY deviceid ASC");
+    pool_->registerStatement(
+        "cameras.create",
+        "INSERT INTO devices (type, adddate, caption, rtsp_url, assigned_node_id, status) "
+        "VALUES ($1, CURRENT_DATE, $2, $3, $4, $5) "
+        "RETURNING deviceid");
 }
 
 std::optional<Camera> PostgresCameraRepository::findById(std::int64_t cameraId) {
     auto connection = pool_->acquire();
     PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("cameras.find_by_id");
+    ScopedTimer timer(queryTime);
     pqxx::read_transaction tx(lease.get());
 
-    const pqxx::result result = tx.exec_params(
-        "SELECT deviceid, type, adddate, caption, rtsp_url, assigned_node_id, status "
-        "FROM devices WHERE deviceid = $1",
-        cameraId);
+    const pqxx::result result = tx.exec_prepared("cameras.find_by_id", cameraId);
 
     if (result.empty()) {
         return std::nullopt;
@@ -48,14 +67,11 @@ std::optional<Camera> PostgresCameraRepository::findById(std::int64_t cameraId)
 std::optional<Camera> PostgresCameraRepository::findByRtspUrl(const std::string& rtspUrl) {
     auto connection = pool_->acquire();
     PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("cameras.find_by_rtsp_url");
+    ScopedTimer timer(queryTime);
     pqxx::read_transaction tx(lease.get());
 
-    const pqxx::result result = tx.exec_params(
-        "SELECT deviceid, type, adddate, caption, rtsp_url, assigned_node_id, status "
-        "FROM devices WHERE rtsp_url = $1 "
-        "ORDER BY deviceid ASC "
-        "LIMIT 1",
-        rtspUrl);
+    const pqxx::result result = tx.exec_prepared("cameras.find_by_rtsp_url", rtspUrl);
 
     if (result.empty()) {
         return std::nullopt;
@@ -66,11 +82,11 @@ std::optional<Camera> PostgresCameraRepository::findByRtspUrl(const std::string&
 std::vector<Camera> PostgresCameraRepository::listAll() {
     auto connection = pool_->acquire();
     PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("cameras.list_all");
+    ScopedTimer timer(queryTime);
     pqxx::read_transaction tx(lease.get());
 
-    const pqxx::result result = tx.exec(
-        "SELECT deviceid, type, adddate, caption, rtsp_url, assigned_node_id, status "
-        "FROM devices ORDER BY deviceid ASC");
+    const pqxx::result result = tx.exec_prepared("cameras.list_all");
 
     std::vector<Camera> cameras;
     cameras.reserve(result.size());
@@ -83,12 +99,12 @@ std::vector<Camera> PostgresCameraRepository::listAll() {
 std::int64_t PostgresCameraRepository::create(const RegisterCameraCommand& command) {
     auto connection = pool_->acquire();
     PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("cameras.create");
+    ScopedTimer timer(queryTime);
     pqxx::work tx(lease.get());
 
-    const pqxx::result result = tx.exec_params(
-        "INSERT INTO devices (type, adddate, caption, rtsp_url, assigned_node_id, status) "
-        "VALUES ($1, CURRENT_DATE, $2, $3, $4, $5) "
-        "RETURNING deviceid",
+    const pqxx::result result = tx.exec_prepared(
+        "cameras.create",
         command.type,
         command.caption,
         command.rtspUrl,
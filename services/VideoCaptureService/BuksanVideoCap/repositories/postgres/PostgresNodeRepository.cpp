@@ -1,4 +1,5 @@
 #include "repositories/postgres/PostgresNodeRepository.h"
+#include "utils/Metrics.h"
 #include <pqxx/pqxx>
 #include <stdexcept>
 
@@ -21,16 +22,18 @@ PostgresNodeRepository::PostgresNodeRepository(std::shared_ptr<IConnectionPool>
     if (!pool_) {
         throw std::invalid_argument("PostgresNodeRepository requires a connection pool");
     }
+    pool_->registerStatement("nodes.find_by_id", "SELECT node_id, caption, status FROM nodes WHERE node_id = $1");
+    pool_->registerStatement("nodes.list_all", "SELECT node_id, caption, status FROM nodes ORDER BY node_id ASC");
 }
 
 std::optional<Node> PostgresNodeRepository::findById(const std::string& nodeId) {
     auto connection = pool_->acquire();
     PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("nodes.find_by_id");
+    ScopedTimer timer(queryTime);
     pqxx::read_transaction tx(lease.get());
 
-    const pqxx::result result = tx.exec_params(
-        "SELECT node_id, caption, status FROM nodes WHERE node_id = $1",
-        nodeId);
+    const pqxx::result result = tx.exec_prepared("nodes.find_by_id", nodeId);
 
     if (result.empty()) {
         return std::nullopt;
@@ -41,9 +44,11 @@ std::optional<Node> PostgresNodeRepository::findById(const std::string& nodeId)
 std::vector<Node> PostgresNodeRepository::listAll() {
     auto connection = pool_->acquire();
     PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("nodes.list_all");
+    ScopedTimer timer(queryTime);
     pqxx::read_transaction tx(lease.get());
 
-    const pqxx::result result = tx.exec("SELECT node_id, caption, status FROM nodes ORDER BY node_id ASC");
+    const pqxx::result result = tx.exec_prepared("nodes.list_all");
 
     std::vector<Node> nodes;
     nodes.reserve(result.size());
@@ -1,6 +1,9 @@
 #include "repositories/postgres/PostgresRecordingRepository.h"
+#include "utils/Metrics.h"
 #include <pqxx/pqxx>
+#include <algorithm>
 #include <stdexcept>
+#include <string>
 
 namespace buksan {
 
@@ -21,9 +24,56 @@ Recording mapRecording(const pqxx::row& row) {
     if (!row["mandatorymark"].is_null()) {
         recording.mandatoryMark = row["mandatorymark"].as<std::int64_t>();
     }
+    if (!row["end_unixtime"].is_null()) {
+        recording.endUnixTime = row["end_unixtime"].as<std::int64_t>();
+    }
+    if (!row["size_bytes"].is_null()) {
+        recording.sizeBytes = row["size_bytes"].as<std::int64_t>();
+    }
     return recording;
 }
 
+const std::size_t kRowsPerInsert = 500;
+
+template <typename T>
+std::string quoteOptional(pqxx::transaction_base& tx, const std::optional<T>& value) {
+    return value.has_value() ? tx.quote(*value) : std::string("NULL");
+}
+
+void appendValues(pqxx::transaction_base& tx, const CreateRecordingCommand& command, std::string& sql) {
+    sql += '(';
+    sql += tx.quote(command.userId);
+    sql += ',';
+    sql += tx.quote(command.unixTime);
+    sql += ',';
+    sql += tx.quote(command.mediaFile);
+    sql += ',';
+    sql += quoteOptional(tx, command.alertId);
+    sql += ',';
+    sql += tx.quote(command.deviceId);
+    sql += ',';
+    sql += tx.quote(command.timeValue);
+    sql += ',';
+    sql += tx.quote(command.dateValue);
+    sql += ',';
+    sql += quoteOptional(tx, command.mandatoryMark);
+    sql += ',';
+    sql += quoteOptional(tx, command.endUnixTime);
+    sql += ',';
+    sql += quoteOptional(tx, command.sizeBytes);
+    sql += ')';
+}
+
+const char* const kInsertRecordingColumns =
+    "INSERT INTO recordings (\"user\", unixtime, mediafile, alert, device, \"time\", \"date\", mandatorymark, "
+    "end_unixtime, size_bytes) VALUES ";
+
+// Errors caused by the row itself; anything else (connection, missing table) is worth retrying later
+bool isRowError(const pqxx::sql_error& e) {
+    return dynamic_cast<const pqxx::data_exception*>(&e) != nullptr ||
+           dynamic_cast<const pqxx::integrity_constraint_violation*>(&e) != nullptr;
+}
+
 } // namespace
 
 PostgresRecordingRepository::PostgresRecordingRepository(std::shared_ptr<IConnectionPool> pool)
@@ -31,19 +81,50 @@ PostgresRecordingRepository::PostgresRecordingRepository(std::shared_ptr<IConnec
     if (!pool_) {
         throw std::invalid_argument("PostgresRecordingRepository requires a connection pool");
     }
+    pool_->registerStatement(
+        "recordings.find_by_camera_and_range",
+        "SELECT recordid, \"user\" AS user_id, unixtime, mediafile, alert AS alert_id, "
+        "device, \"time\", \"date\", mandatorymark, end_unixtime, size_bytes "
+        "FROM recordings "
+        "WHERE device = $1 AND unixtime <= $3 AND COALESCE(end_unixtime, unixtime) >= $2 "
+        "ORDER BY unixtime ASC");
+    pool_->registerStatement(
+        "recordings.find_by_id",
+        "SELECT recordid, \"user\" AS user_id, unixtime, mediafile, alert AS alert_id, "
+        "device, \"time\", \"date\", mandatorymark, end_unixtime, size_bytes "
+        "FROM recordings WHERE recordid = $1");
+    pool_->registerStatement(
+        "recordings.create",
+        "INSERT INTO recordings (\"user\", unixtime, mediafile, alert, device, \"time\", \"date\", mandatorymark, "
+        "end_unixtime, size_bytes) "
+        "VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10) "
+        "RETURNING recordid");
+    pool_->registerStatement(
+        "recordings.list_deletable_media_files",
+        "SELECT recordid, mediafile FROM recordings "
+        "WHERE recordid > $1 AND mandatorymark IS NULL AND alert IS NULL "
+        "ORDER BY recordid ASC "
+        "LIMIT $2");
+    // The paths travel as one text[] parameter, so the statement text stays fixed whatever the batch size
+    pool_->registerStatement(
+        "recordings.find_protected_media_files",
+        "SELECT DISTINCT mediafile FROM recordings "
+        "WHERE mediafile = ANY($1::text[]) AND (mandatorymark IS NOT NULL OR alert IS NOT NULL)");
+    pool_->registerStatement(
+        "recordings.delete_by_media_files",
+        "DELETE FROM recordings "
+        "WHERE mediafile = ANY($1::text[]) AND mandatorymark IS NULL AND alert IS NULL");
 }
 
 std::vector<Recording> PostgresRecordingRepository::findByCameraAndRange(const RecordingQuery& query) {
     auto connection = pool_->acquire();
     PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("recordings.find_by_camera_and_range");
+    ScopedTimer timer(queryTime);
     pqxx::read_transaction tx(lease.get());
 
-    const pqxx::result result = tx.exec_params(
-        "SELECT recordid, \"user\" AS user_id, unixtime, mediafile, alert AS alert_id, "
-        "device, \"time\", \"date\", mandatorymark "
-        "FROM recordings "
-        "WHERE device = $1 AND unixtime BETWEEN $2 AND $3 "
-        "ORDER BY unixtime ASC",
+    const pqxx::result result = tx.exec_prepared(
+        "recordings.find_by_camera_and_range",
         query.cameraId,
         query.fromUnix,
         query.toUnix);
@@ -59,13 +140,11 @@ std::vector<Recording> PostgresRecordingRepository::findByCameraAndRange(const R
 std::optional<Recording> PostgresRecordingRepository::findById(std::int64_t recordingId) {
     auto connection = pool_->acquire();
     PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("recordings.find_by_id");
+    ScopedTimer timer(queryTime);
     pqxx::read_transaction tx(lease.get());
 
-    const pqxx::result result = tx.exec_params(
-        "SELECT recordid, \"user\" AS user_id, unixtime, mediafile, alert AS alert_id, "
-        "device, \"time\", \"date\", mandatorymark "
-        "FROM recordings WHERE recordid = $1",
-        recordingId);
+    const pqxx::result result = tx.exec_prepared("recordings.find_by_id", recordingId);
 
     if (result.empty()) {
         return std::nullopt;
@@ -76,12 +155,12 @@ std::optional<Recording> PostgresRecordingRepository::findById(std::int64_t reco
 std::int64_t PostgresRecordingRepository::create(const CreateRecordingCommand& command) {
     auto connection = pool_->acquire();
     PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("recordings.create");
+    ScopedTimer timer(queryTime);
     pqxx::work tx(lease.get());
 
-    const pqxx::result result = tx.exec_params(
-        "INSERT INTO recordings (\"user\", unixtime, mediafile, alert, device, \"time\", \"date\", mandatorymark) "
-        "VALUES ($1, $2, $3, $4, $5, $6, $7, $8) "
-        "RETURNING recordid",
+    const pqxx::result result = tx.exec_prepared(
+        "recordings.create",
         command.userId,
         command.unixTime,
         command.mediaFile,
@@ -89,10 +168,126 @@ std::int64_t PostgresRecordingRepository::create(const CreateRecordingCommand& c
         command.deviceId,
         command.timeValue,
         command.dateValue,
-        command.mandatoryMark);
+        command.mandatoryMark,
+        command.endUnixTime,
+        command.sizeBytes);
 
     tx.commit();
     return result.front()["recordid"].as<std::int64_t>();
 }
 
+BatchInsertResult PostgresRecordingRepository::createBatch(const std::vector<CreateRecordingCommand>& commands) {
+    BatchInsertResult outcome;
+    if (commands.empty()) {
+        return outcome;
+    }
+
+    auto connection = pool_->acquire();
+    PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("recordings.create_batch");
+    ScopedTimer timer(queryTime);
+
+    try {
+        pqxx::work tx(lease.get());
+        for (std::size_t begin = 0; begin < commands.size(); begin += kRowsPerInsert) {
+            const std::size_t end = std::min(commands.size(), begin + kRowsPerInsert);
+            std::string sql = kInsertRecordingColumns;
+            for (std::size_t i = begin; i < end; ++i) {
+                if (i != begin) {
+                    sql += ',';
+                }
+                appendValues(tx, commands[i], sql);
+            }
+            tx.exec0(sql);
+        }
+        tx.commit();
+        outcome.inserted = commands.size();
+        return outcome;
+    } catch (const pqxx::sql_error& e) {
+        if (!isRowError(e)) {
+            throw;
+        }
+    }
+
+    // Some row is bad: insert one by one, each in its own savepoint, so the rest still commit together
+    pqxx::work tx(lease.get());
+    for (std::size_t i = 0; i < commands.size(); ++i) {
+        try {
+            pqxx::subtransaction row(tx);
+            std::string sql = kInsertRecordingColumns;
+            appendValues(row, commands[i], sql);
+            row.exec0(sql);
+            row.commit();
+            ++outcome.inserted;
+        } catch (const pqxx::sql_error& e) {
+            if (!isRowError(e)) {
+                throw;
+            }
+            outcome.rejected.push_back(i);
+            outcome.rejectionReasons.push_back(e.what());
+        }
+    }
+    tx.commit();
+    return outcome;
+}
+
+std::vector<std::string> PostgresRecordingRepository::findProtectedMediaFiles(
+    const std::vector<std::string>& mediaFiles) {
+    std::vector<std::string> protectedFiles;
+    if (mediaFiles.empty()) {
+        return protectedFiles;
+    }
+
+    auto connection = pool_->acquire();
+    PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("recordings.find_protected_media_files");
+    ScopedTimer timer(queryTime);
+    pqxx::read_transaction tx(lease.get());
+
+    const pqxx::result result = tx.exec_prepared("recordings.find_protected_media_files", mediaFiles);
+
+    protectedFiles.reserve(result.size());
+    for (const auto& row : result) {
+        protectedFiles.push_back(row["mediafile"].c_str());
+    }
+    return protectedFiles;
+}
+
+std::size_t PostgresRecordingRepository::deleteByMediaFiles(const std::vector<std::string>& mediaFiles) {
+    if (mediaFiles.empty()) {
+        return 0;
+    }
+
+    auto connection = pool_->acquire();
+    PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("recordings.delete_by_media_files");
+    ScopedTimer timer(queryTime);
+    pqxx::work tx(lease.get());
+
+    const pqxx::result result = tx.exec_prepared("recordings.delete_by_media_files", mediaFiles);
+    tx.commit();
+    return static_cast<std::size_t>(result.affected_rows());
+}
+
+std::vector<MediaFileRef> PostgresRecordingRepository::listDeletableMediaFiles(std::int64_t afterRecordId,
+                                                                              std::size_t limit) {
+    auto connection = pool_->acquire();
+    PooledConnection lease(pool_, connection);
+    static Histogram& queryTime = queryHistogram("recordings.list_deletable_media_files");
+    ScopedTimer timer(queryTime);
+    pqxx::read_transaction tx(lease.get());
+
+    const pqxx::result result = tx.exec_prepared(
+        "recordings.list_deletable_media_files",
+        afterRecordId,
+        static_cast<std::int64_t>(limit));
+
+    std::vector<MediaFileRef> files;
+    files.reserve(result.size());
+    for (const auto& row : result) {
+        files.push_back(MediaFileRef{row["recordid"].as<std::int64_t>(), row["mediafile"].c_str()});
+    }
+    return files;
+}
+
 } // namespace buksan
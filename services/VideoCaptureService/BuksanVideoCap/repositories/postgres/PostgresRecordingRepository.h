@@ -14,6 +14,10 @@ public:
     std::vector<Recording> findByCameraAndRange(const RecordingQuery& query) override;
     std::optional<Recording> findById(std::int64_t recordingId) override;
     std::int64_t create(const CreateRecordingCommand& command) override;
+    BatchInsertResult createBatch(const std::vector<CreateRecordingCommand>& commands) override;
+    std::vector<std::string> findProtectedMediaFiles(const std::vector<std::string>& mediaFiles) override;
+    std::size_t deleteByMediaFiles(const std::vector<std::string>& mediaFiles) override;
+    std::vector<MediaFileRef> listDeletableMediaFiles(std::int64_t afterRecordId, std::size_t limit) override;
 
 private:
     std::shared_ptr<IConnectionPool> pool_;
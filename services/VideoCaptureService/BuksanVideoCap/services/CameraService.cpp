@@ -4,19 +4,27 @@
 
 namespace buksan {
 
-CameraService::CameraService(std::unique_ptr<ICameraRepository> cameraRepository)
-    : cameraRepository_(std::move(cameraRepository)) {
+CameraService::CameraService(std::unique_ptr<ICameraRepository> cameraRepository,
+                             MetadataCacheSettings cacheSettings)
+    : cameraRepository_(std::move(cameraRepository))
+    , cameras_("cameras", cacheSettings)
+    , cameraList_("camera_list", cacheSettings) {
     if (!cameraRepository_) {
         throw std::invalid_argument("CameraService requires repository");
     }
 }
 
 std::optional<Camera> CameraService::findById(std::int64_t cameraId) {
-    return cameraRepository_->findById(cameraId);
+    return cameras_.getOrLoad(cameraId, [&] { return cameraRepository_->findById(cameraId); });
 }
 
 std::vector<Camera> CameraService::listAll() {
-    return cameraRepository_->listAll();
+    if (auto cached = cameraList_.get(0)) {
+        return std::move(*cached);
+    }
+    std::vector<Camera> cameras = cameraRepository_->listAll();
+    cameraList_.put(0, cameras);
+    return cameras;
 }
 
 std::vector<std::int64_t> CameraService::registerFromConfig(const std::vector<RegisterCameraCommand>& cameras) {
@@ -28,16 +36,22 @@ std::vector<std::int64_t> CameraService::registerFromConfig(const std::vector<Re
             continue;
         }
 
-        auto existing = cameraRepository_->findByRtspUrl(camera.rtspUrl);
-        if (existing.has_value()) {
-            deviceIds.push_back(existing->deviceId);
-            continue;
-        }
-
-        deviceIds.push_back(cameraRepository_->create(camera));
+        deviceIds.push_back(registerCamera(camera));
     }
 
     return deviceIds;
 }
 
+std::int64_t CameraService::registerCamera(const RegisterCameraCommand& camera) {
+    auto existing = cameraRepository_->findByRtspUrl(camera.rtspUrl);
+    if (existing.has_value()) {
+        return existing->deviceId;
+    }
+
+    const std::int64_t deviceId = cameraRepository_->create(camera);
+    cameras_.erase(deviceId);
+    cameraList_.clear();
+    return deviceId;
+}
+
 } // namespace buksan
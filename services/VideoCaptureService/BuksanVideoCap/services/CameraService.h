@@ -2,6 +2,7 @@
 #define SERVICES_CAMERASERVICE_H
 
 #include "repositories/interfaces/ICameraRepository.h"
+#include "utils/TtlCache.h"
 #include <memory>
 #include <optional>
 #include <vector>
@@ -10,14 +11,20 @@ namespace buksan {
 
 class CameraService {
 public:
-    explicit CameraService(std::unique_ptr<ICameraRepository> cameraRepository);
+    explicit CameraService(std::unique_ptr<ICameraRepository> cameraRepository,
+                           MetadataCacheSettings cacheSettings = {});
 
     std::optional<Camera> findById(std::int64_t cameraId);
     std::vector<Camera> listAll();
     std::vector<std::int64_t> registerFromConfig(const std::vector<RegisterCameraCommand>& cameras);
+    // Device id of the camera with this RTSP URL, creating the row when there is none
+    std::int64_t registerCamera(const RegisterCameraCommand& camera);
 
 private:
     std::unique_ptr<ICameraRepository> cameraRepository_;
+    ShardedTtlCache<std::int64_t, Camera> cameras_;
+    // One entry under key 0
+    ShardedTtlCache<int, std::vector<Camera>> cameraList_;
 };
 
 } // namespace buksan
@@ -33,7 +33,11 @@ void MetadataSyncWorker::stop() {
 
 void MetadataSyncWorker::runLoop() {
     while (running_.load()) {
-        recordingService_.flushPendingMetadata(maxBatchSize_);
+        const std::size_t flushed = recordingService_.flushPendingMetadata(maxBatchSize_);
+        // Keep draining a backlog while the database accepts it; back off once empty or failing
+        if (flushed > 0 && recordingService_.pendingQueueSize() > 0) {
+            continue;
+        }
         std::this_thread::sleep_for(retryInterval_);
     }
 }
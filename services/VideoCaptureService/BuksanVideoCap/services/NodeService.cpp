@@ -4,19 +4,26 @@
 
 namespace buksan {
 
-NodeService::NodeService(std::unique_ptr<INodeRepository> nodeRepository)
-    : nodeRepository_(std::move(nodeRepository)) {
+NodeService::NodeService(std::unique_ptr<INodeRepository> nodeRepository, MetadataCacheSettings cacheSettings)
+    : nodeRepository_(std::move(nodeRepository))
+    , nodes_("nodes", cacheSettings)
+    , nodeList_("node_list", cacheSettings) {
     if (!nodeRepository_) {
         throw std::invalid_argument("NodeService requires repository");
     }
 }
 
 std::optional<Node> NodeService::findById(const std::string& nodeId) {
-    return nodeRepository_->findById(nodeId);
+    return nodes_.getOrLoad(nodeId, [&] { return nodeRepository_->findById(nodeId); });
 }
 
 std::vector<Node> NodeService::listAll() {
-    return nodeRepository_->listAll();
+    if (auto cached = nodeList_.get(0)) {
+        return std::move(*cached);
+    }
+    std::vector<Node> nodes = nodeRepository_->listAll();
+    nodeList_.put(0, nodes);
+    return nodes;
 }
 
 } // namespace buksan
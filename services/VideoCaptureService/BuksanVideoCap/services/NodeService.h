@@ -2,6 +2,7 @@
 #define SERVICES_NODESERVICE_H
 
 #include "repositories/interfaces/INodeRepository.h"
+#include "utils/TtlCache.h"
 #include <memory>
 #include <optional>
 #include <string>
@@ -11,13 +12,16 @@ namespace buksan {
 
 class NodeService {
 public:
-    explicit NodeService(std::unique_ptr<INodeRepository> nodeRepository);
+    explicit NodeService(std::unique_ptr<INodeRepository> nodeRepository, MetadataCacheSettings cacheSettings = {});
 
     std::optional<Node> findById(const std::string& nodeId);
     std::vector<Node> listAll();
 
 private:
     std::unique_ptr<INodeRepository> nodeRepository_;
+    ShardedTtlCache<std::string, Node> nodes_;
+    // One entry under key 0
+    ShardedTtlCache<int, std::vector<Node>> nodeList_;
 };
 
 } // namespace buksan
@@ -1,13 +1,39 @@
 #include "services/RecordingService.h"
+#include "utils/Logger.h"
+#include <algorithm>
 #include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 namespace buksan {
 
+namespace {
+
+// Rejected rows logged one by one per batch; the rest are summed up in one line
+const std::size_t kRejectedRowsLogged = 20;
+
+void logRejectedRows(const std::vector<CreateRecordingCommand>& batch, const BatchInsertResult& result) {
+    const std::size_t logged = std::min(result.rejected.size(), kRejectedRowsLogged);
+    for (std::size_t i = 0; i < logged; ++i) {
+        const CreateRecordingCommand& command = batch[result.rejected[i]];
+        const std::string reason = i < result.rejectionReasons.size() ? result.rejectionReasons[i] : "unknown";
+        logWarn("metadata") << "recording dropped, database refused it: " << command.mediaFile
+                            << " (device " << command.deviceId << ", unixtime " << command.unixTime << "): " << reason;
+    }
+    if (result.rejected.size() > logged) {
+        logWarn("metadata") << (result.rejected.size() - logged) << " more recordings of this batch dropped";
+    }
+}
+
+} // namespace
+
 RecordingService::RecordingService(std::unique_ptr<IRecordingRepository> recordingRepository,
-                                   std::shared_ptr<IMetadataSyncQueue> metadataQueue)
+                                   std::shared_ptr<IMetadataSyncQueue> metadataQueue,
+                                   MetadataCacheSettings cacheSettings)
     : recordingRepository_(std::move(recordingRepository))
-    , metadataQueue_(std::move(metadataQueue)) {
+    , metadataQueue_(std::move(metadataQueue))
+    , recordings_("recordings", cacheSettings) {
     if (!recordingRepository_ || !metadataQueue_) {
         throw std::invalid_argument("RecordingService requires repository and metadata queue");
     }
@@ -18,10 +44,19 @@ std::vector<Recording> RecordingService::findByCameraAndRange(const RecordingQue
 }
 
 std::optional<Recording> RecordingService::findById(std::int64_t recordingId) {
-    return recordingRepository_->findById(recordingId);
+    return recordings_.getOrLoad(recordingId, [&] { return recordingRepository_->findById(recordingId); });
+}
+
+void RecordingService::setDeviceIdResolver(DeviceIdResolver resolver) {
+    resolver_ = std::move(resolver);
 }
 
 RegisterRecordingResult RecordingService::registerSegment(const CreateRecordingCommand& command) {
+    // While a backlog is waiting the database is likely still down, and writing past it would break order
+    if (metadataQueue_->size() > 0 || (command.deviceId == 0 && !command.cameraId.empty())) {
+        metadataQueue_->enqueue(command);
+        return {.persisted = false, .recordId = std::nullopt};
+    }
     try {
         const std::int64_t recordId = recordingRepository_->create(command);
         return {.persisted = true, .recordId = recordId};
@@ -32,26 +67,75 @@ RegisterRecordingResult RecordingService::registerSegment(const CreateRecordingC
 }
 
 std::size_t RecordingService::flushPendingMetadata(std::size_t maxBatchSize) {
-    std::size_t flushedCount = 0;
-    for (std::size_t i = 0; i < maxBatchSize; ++i) {
-        CreateRecordingCommand command;
-        if (!metadataQueue_->tryDequeue(command)) {
-            break;
+    std::vector<CreateRecordingCommand> batch;
+    if (metadataQueue_->peekBatch(maxBatchSize, batch) == 0) {
+        return 0;
+    }
+
+    // Rows queued before their camera had a device id; an unavailable catalog keeps the batch queued
+    std::vector<CreateRecordingCommand> rows;
+    rows.reserve(batch.size());
+    std::unordered_map<std::string, std::optional<std::int64_t>> resolved;
+    for (auto& command : batch) {
+        if (command.deviceId == 0 && !command.cameraId.empty()) {
+            auto it = resolved.find(command.cameraId);
+            if (it == resolved.end()) {
+                std::optional<std::int64_t> deviceId;
+                try {
+                    deviceId = resolver_ ? resolver_(command.cameraId) : std::nullopt;
+                } catch (...) {
+                    return 0;
+                }
+                it = resolved.emplace(command.cameraId, deviceId).first;
+            }
+            if (!it->second) {
+                logWarn("metadata") << "recording dropped, camera " << command.cameraId
+                                    << " has no device id: " << command.mediaFile;
+                rejectedCount_.fetch_add(1);
+                continue;
+            }
+            command.deviceId = *it->second;
         }
+        rows.push_back(std::move(command));
+    }
 
-        try {
-            recordingRepository_->create(command);
-            ++flushedCount;
-        } catch (...) {
-            metadataQueue_->enqueue(std::move(command));
-            break;
+    BatchInsertResult result;
+    try {
+        if (!rows.empty()) {
+            result = recordingRepository_->createBatch(rows);
         }
+    } catch (...) {
+        // Nothing was committed and the batch is still at the head of the queue, in order
+        return 0;
     }
-    return flushedCount;
+
+    // Refused rows would fail on every retry, so they leave the queue with the rest of the batch
+    logRejectedRows(rows, result);
+    metadataQueue_->acknowledge(batch.size());
+    rejectedCount_.fetch_add(result.rejected.size());
+    return result.inserted;
 }
 
 std::size_t RecordingService::pendingQueueSize() const {
     return metadataQueue_->size();
 }
 
+std::vector<std::string> RecordingService::findProtectedMediaFiles(const std::vector<std::string>& mediaFiles) {
+    return recordingRepository_->findProtectedMediaFiles(mediaFiles);
+}
+
+void RecordingService::forgetMediaFiles(const std::vector<std::string>& mediaFiles) {
+    recordingRepository_->deleteByMediaFiles(mediaFiles);
+    if (recordings_.enabled()) {
+        const std::unordered_set<std::string> forgotten(mediaFiles.begin(), mediaFiles.end());
+        recordings_.eraseIf([&forgotten](std::int64_t, const Recording& recording) {
+            return forgotten.count(recording.mediaFile) > 0;
+        });
+    }
+}
+
+std::vector<MediaFileRef> RecordingService::listDeletableMediaFiles(std::int64_t afterRecordId, std::size_t limit) {
+    return recordingRepository_->listDeletableMediaFiles(afterRecordId, limit);
+}
+
 } // namespace buksan
@@ -3,13 +3,21 @@
 
 #include "repositories/interfaces/IMetadataSyncQueue.h"
 #include "repositories/interfaces/IRecordingRepository.h"
+#include "utils/TtlCache.h"
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
+#include <string>
 #include <vector>
 
 namespace buksan {
 
+// Device id of a camera; nullopt when the camera is unknown for good, throws while the catalog is unavailable.
+using DeviceIdResolver = std::function<std::optional<std::int64_t>(const std::string& cameraId)>;
+
 struct RegisterRecordingResult {
     bool persisted{false};
     std::optional<std::int64_t> recordId;
@@ -18,17 +26,29 @@ struct RegisterRecordingResult {
 class RecordingService {
 public:
     RecordingService(std::unique_ptr<IRecordingRepository> recordingRepository,
-                     std::shared_ptr<IMetadataSyncQueue> metadataQueue);
+                     std::shared_ptr<IMetadataSyncQueue> metadataQueue,
+                     MetadataCacheSettings cacheSettings = {});
 
     std::vector<Recording> findByCameraAndRange(const RecordingQuery& query);
     std::optional<Recording> findById(std::int64_t recordingId);
+    // A command with a cameraId and no device id goes to the queue and is resolved when flushed
     RegisterRecordingResult registerSegment(const CreateRecordingCommand& command);
+    void setDeviceIdResolver(DeviceIdResolver resolver);
     std::size_t flushPendingMetadata(std::size_t maxBatchSize);
     std::size_t pendingQueueSize() const;
+    std::vector<std::string> findProtectedMediaFiles(const std::vector<std::string>& mediaFiles);
+    void forgetMediaFiles(const std::vector<std::string>& mediaFiles);
+    std::vector<MediaFileRef> listDeletableMediaFiles(std::int64_t afterRecordId, std::size_t limit);
+    std::uint64_t rejectedMetadataCount() const { return rejectedCount_.load(); }
 
 private:
     std::unique_ptr<IRecordingRepository> recordingRepository_;
     std::shared_ptr<IMetadataSyncQueue> metadataQueue_;
+    // Players send many range requests per recording, each starting with findById
+    ShardedTtlCache<std::int64_t, Recording> recordings_;
+    std::atomic<std::uint64_t> rejectedCount_{0};
+    // Set before the sync worker starts; used by it only
+    DeviceIdResolver resolver_;
 };
 
 } // namespace buksan
@@ -0,0 +1,161 @@
+#include "services/SegmentRegistrar.h"
+#include "utils/Logger.h"
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+namespace buksan {
+
+namespace {
+
+std::string formatLocal(std::chrono::system_clock::time_point time, const char* format) {
+    const std::time_t t = std::chrono::system_clock::to_time_t(time);
+    std::tm local{};
+    localtime_r(&t, &local);
+    std::ostringstream out;
+    out << std::put_time(&local, format);
+    return out.str();
+}
+
+// Bounds the backlog queued while the catalog cannot resolve device ids
+const std::size_t kMaxUnresolvedSegments = 10000;
+
+std::int64_t toUnix(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
+
+} // namespace
+
+SegmentRegistrar::SegmentRegistrar(RecordingService& recordingService)
+    : recordingService_(recordingService) {
+}
+
+SegmentRegistrar::~SegmentRegistrar() {
+    stop();
+}
+
+void SegmentRegistrar::start() {
+    if (running_.exchange(true)) {
+        return;
+    }
+    workerThread_ = std::thread(&SegmentRegistrar::runLoop, this);
+}
+
+void SegmentRegistrar::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    cv_.notify_all();
+    if (workerThread_.joinable()) {
+        workerThread_.join();
+    }
+}
+
+void SegmentRegistrar::setDeviceId(const std::string& cameraId, std::int64_t deviceId) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deviceIds_[cameraId] = deviceId;
+    unknownCameras_.erase(cameraId);
+}
+
+void SegmentRegistrar::setDeviceIdResolver(DeviceIdResolver resolver) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    resolver_ = std::move(resolver);
+}
+
+void SegmentRegistrar::submit(FinishedSegment segment) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(std::move(segment));
+    }
+    cv_.notify_one();
+}
+
+std::size_t SegmentRegistrar::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+void SegmentRegistrar::runLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] { return !pending_.empty() || !running_.load(); });
+        if (pending_.empty()) {
+            break;
+        }
+        FinishedSegment segment = std::move(pending_.front());
+        pending_.pop_front();
+        lock.unlock();
+        registerOne(segment);
+        lock.lock();
+    }
+}
+
+std::optional<std::int64_t> SegmentRegistrar::resolveDeviceId(const std::string& cameraId) {
+    DeviceIdResolver resolver;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = deviceIds_.find(cameraId);
+        if (it != deviceIds_.end()) {
+            return it->second;
+        }
+        resolver = resolver_;
+    }
+    if (!resolver) {
+        return std::nullopt;
+    }
+    const auto deviceId = resolver(cameraId);
+    if (deviceId) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        deviceIds_[cameraId] = *deviceId;
+        unknownCameras_.erase(cameraId);
+        unresolvedQueued_ = 0;
+    }
+    return deviceId;
+}
+
+void SegmentRegistrar::registerOne(const FinishedSegment& segment) {
+    std::int64_t deviceId = 0;
+    try {
+        const auto resolved = resolveDeviceId(segment.cameraId);
+        if (!resolved) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (unknownCameras_.insert(segment.cameraId).second) {
+                logWarn(segment.cameraId) << "no device id, segments are not registered";
+            }
+            return;
+        }
+        deviceId = *resolved;
+    } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (unresolvedQueued_ >= kMaxUnresolvedSegments) {
+            logRepeated(LogLevel::Warn, segment.cameraId, "device-id")
+                << "segment not registered, " << unresolvedQueued_ << " already wait for a device id: " << e.what();
+            return;
+        }
+        ++unresolvedQueued_;
+        logRepeated(LogLevel::Warn, segment.cameraId, "device-id")
+            << "device id lookup failed, queueing segments under the camera id: " << e.what();
+    }
+
+    CreateRecordingCommand command;
+    command.unixTime = toUnix(segment.startTime);
+    command.endUnixTime = toUnix(segment.endTime);
+    command.mediaFile = segment.path;
+    command.alertId = segment.alertId;
+    command.deviceId = deviceId;
+    if (deviceId == 0) {
+        command.cameraId = segment.cameraId;
+    }
+    command.timeValue = formatLocal(segment.startTime, "%H:%M:%S");
+    command.dateValue = formatLocal(segment.startTime, "%Y-%m-%d");
+    command.sizeBytes = static_cast<std::int64_t>(segment.sizeBytes);
+
+    try {
+        recordingService_.registerSegment(command);
+    } catch (const std::exception& e) {
+        logError(segment.cameraId) << "segment registration failed: " << e.what();
+    }
+}
+
+} // namespace buksan
@@ -0,0 +1,68 @@
+#ifndef SERVICES_SEGMENTREGISTRAR_H
+#define SERVICES_SEGMENTREGISTRAR_H
+
+#include "services/RecordingService.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace buksan {
+
+struct FinishedSegment {
+    std::string cameraId;
+    std::string path;
+    std::chrono::system_clock::time_point startTime;
+    std::chrono::system_clock::time_point endTime;
+    std::uint64_t sizeBytes{0};
+    std::optional<std::int64_t> alertId;
+};
+
+// Registers segments closed by the recorders. submit() only queues the segment in memory;
+// a background thread calls RecordingService::registerSegment, whose metadata queue takes over
+// while the database is unavailable.
+class SegmentRegistrar {
+public:
+    explicit SegmentRegistrar(RecordingService& recordingService);
+    ~SegmentRegistrar();
+
+    void start();
+    // Registers whatever is still pending, then stops the thread.
+    void stop();
+
+    void setDeviceId(const std::string& cameraId, std::int64_t deviceId);
+    // Used for cameras without a device id. While it throws, their segments go to the metadata
+    // queue under the camera id and are resolved when it is flushed.
+    void setDeviceIdResolver(DeviceIdResolver resolver);
+    void submit(FinishedSegment segment);
+    std::size_t pending() const;
+
+private:
+    void runLoop();
+    void registerOne(const FinishedSegment& segment);
+    // nullopt when the camera is unknown for good; throws while the catalog is unavailable
+    std::optional<std::int64_t> resolveDeviceId(const std::string& cameraId);
+
+    RecordingService& recordingService_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<FinishedSegment> pending_;
+    std::unordered_map<std::string, std::int64_t> deviceIds_;
+    std::unordered_set<std::string> unknownCameras_;
+    DeviceIdResolver resolver_;
+    // Segments queued without a device id since one was last resolved
+    std::size_t unresolvedQueued_{0};
+    std::atomic<bool> running_{false};
+    std::thread workerThread_;
+};
+
+} // namespace buksan
+
+#endif // SERVICES_SEGMENTREGISTRAR_H
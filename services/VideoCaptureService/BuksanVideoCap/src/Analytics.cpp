@@ -1,12 +1,137 @@
 #include "Analytics.h"
-#include <iostream>
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
 
 namespace buksan {
 
+Analytics::Analytics(std::string cameraId, const MotionConfig& config)
+    : camera_id_(std::move(cameraId))
+    , config_(config)
+{
+    config_.frame_interval = std::max(1, config_.frame_interval);
+    config_.analysis_width = std::max(64, config_.analysis_width);
+    config_.block_size = std::max(2, config_.block_size);
+    config_.sensitivity = std::clamp(config_.sensitivity, 1, 100);
+    if (config_.learning_rate <= 0.0 || config_.learning_rate > 1.0) {
+        config_.learning_rate = 0.05;
+    }
+
+    // Higher sensitivity lowers both the per-pixel noise floor and the share of blocks that must change
+    const int insensitivity = 100 - config_.sensitivity;
+    pixel_threshold_ = 10 + insensitivity * 40 / 100;
+    area_fraction_ = 0.002 + insensitivity / 100.0 * 0.048;
+}
+
+bool Analytics::admitFrame() {
+    return (frame_counter_++ % static_cast<std::uint64_t>(config_.frame_interval)) == 0;
+}
+
+void Analytics::prepareGrayscale(const cv::Mat& frame, cv::Mat& gray) const {
+    cv::Mat small;
+    const int width = std::min(frame.cols, config_.analysis_width);
+    if (frame.cols != width) {
+        const int height = std::max(1, frame.rows * width / frame.cols);
+        cv::resize(frame, small, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+    } else {
+        small = frame;
+    }
+
+    cv::Mat luma;
+    if (small.channels() == 3) {
+        cv::cvtColor(small, luma, cv::COLOR_BGR2GRAY);
+    } else {
+        luma = small;
+    }
+    cv::GaussianBlur(luma, gray, cv::Size(5, 5), 0);
+}
+
+void Analytics::rebuildZoneMask(cv::Size grid) {
+    if (config_.zones.empty()) {
+        zone_mask_ = cv::Mat(grid.height, grid.width, CV_8UC1, cv::Scalar(1));
+        active_blocks_ = grid.area();
+        return;
+    }
+
+    zone_mask_ = cv::Mat::zeros(grid.height, grid.width, CV_8UC1);
+    for (const auto& zone : config_.zones) {
+        const int x0 = std::clamp(static_cast<int>(zone.x * grid.width), 0, grid.width);
+        const int y0 = std::clamp(static_cast<int>(zone.y * grid.height), 0, grid.height);
+        const int x1 = std::clamp(static_cast<int>((zone.x + zone.width) * grid.width + 0.5), 0, grid.width);
+        const int y1 = std::clamp(static_cast<int>((zone.y + zone.height) * grid.height + 0.5), 0, grid.height);
+        if (x1 <= x0 || y1 <= y0) continue;
+        zone_mask_(cv::Rect(x0, y0, x1 - x0, y1 - y0)).setTo(cv::Scalar(1));
+    }
+    active_blocks_ = cv::countNonZero(zone_mask_);
+}
+
+double Analytics::scoreBlocks(const cv::Mat& changed) {
+    if (active_blocks_ <= 0) return 0.0;
+
+    // Area averaging turns each block into its share of changed pixels (0..255)
+    cv::Mat blocks;
+    cv::resize(changed, blocks, zone_mask_.size(), 0, 0, cv::INTER_AREA);
+
+    const int min_level = static_cast<int>(block_fraction_ * 255.0);
+    int hot = 0;
+    for (int r = 0; r < blocks.rows; ++r) {
+        const unsigned char* level = blocks.ptr<unsigned char>(r);
+        const unsigned char* inside = zone_mask_.ptr<unsigned char>(r);
+        for (int c = 0; c < blocks.cols; ++c) {
+            if (inside[c] && level[c] >= min_level) ++hot;
+        }
+    }
+    return static_cast<double>(hot) / active_blocks_;
+}
+
+void Analytics::updateState(double score) {
+    const auto now = std::chrono::steady_clock::now();
+    const bool detected = score >= area_fraction_;
+    last_score_ = score;
+    if (detected) {
+        last_motion_ = now;
+    }
+
+    bool changed = false;
+    if (detected && !motion_active_) {
+        motion_active_ = true;
+        changed = true;
+    } else if (!detected && motion_active_ && now - last_motion_ >= std::chrono::milliseconds(config_.stop_delay_ms)) {
+        motion_active_ = false;
+        changed = true;
+    }
+
+    if (changed && on_motion_) {
+        MotionEvent event;
+        event.cameraId = camera_id_;
+        event.started = motion_active_;
+        event.score = score;
+        event.timestamp = std::chrono::system_clock::now();
+        on_motion_(event);
+    }
+}
+
 void Analytics::processFrame(const cv::Mat& frame) {
     if (frame.empty()) return;
-    (void)frame;
-    std::cout << "motion check" << std::endl;
+
+    cv::Mat gray;
+    prepareGrayscale(frame, gray);
+
+    if (background_.empty() || background_.size() != gray.size()) {
+        gray.convertTo(background_, CV_32F);
+        rebuildZoneMask(cv::Size(std::max(1, gray.cols / config_.block_size),
+                                 std::max(1, gray.rows / config_.block_size)));
+        return;
+    }
+
+    cv::Mat reference;
+    background_.convertTo(reference, CV_8U);
+    cv::Mat diff;
+    cv::absdiff(gray, reference, diff);
+    cv::Mat changed;
+    cv::threshold(diff, changed, pixel_threshold_, 255, cv::THRESH_BINARY);
+    cv::accumulateWeighted(gray, background_, config_.learning_rate);
+
+    updateState(scoreBlocks(changed));
 }
 
 } // namespace buksan
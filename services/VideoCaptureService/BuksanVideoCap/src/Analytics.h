@@ -1,15 +1,60 @@
 #ifndef ANALYTICS_H
 #define ANALYTICS_H
 
+#include "ConfigLoader.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
 #include <opencv2/core.hpp>
 
 namespace buksan {
 
+struct MotionEvent {
+    std::string cameraId;
+    bool started{false};
+    double score{0.0};
+    std::chrono::system_clock::time_point timestamp;
+};
+
+using MotionEventHandler = std::function<void(const MotionEvent&)>;
+
 class Analytics {
 public:
     Analytics() = default;
+    Analytics(std::string cameraId, const MotionConfig& config);
 
+    void setMotionHandler(MotionEventHandler handler) { on_motion_ = std::move(handler); }
+
+    // Counts an incoming frame and tells whether it is one of the every-Nth frames to analyze.
+    bool admitFrame();
     void processFrame(const cv::Mat& frame);
+
+    bool motionActive() const { return motion_active_; }
+    double lastScore() const { return last_score_; }
+    int analysisWidth() const { return config_.analysis_width; }
+
+private:
+    void prepareGrayscale(const cv::Mat& frame, cv::Mat& gray) const;
+    void rebuildZoneMask(cv::Size grid);
+    double scoreBlocks(const cv::Mat& changed);
+    void updateState(double score);
+
+    std::string camera_id_;
+    MotionConfig config_;
+    MotionEventHandler on_motion_;
+
+    std::uint64_t frame_counter_{0};
+    cv::Mat background_;
+    cv::Mat zone_mask_;
+    int active_blocks_{0};
+    int pixel_threshold_{25};
+    double block_fraction_{0.3};
+    double area_fraction_{0.01};
+
+    bool motion_active_{false};
+    double last_score_{0.0};
+    std::chrono::steady_clock::time_point last_motion_;
 };
 
 } // namespace buksan
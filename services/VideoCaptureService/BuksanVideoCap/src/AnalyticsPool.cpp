@@ -0,0 +1,152 @@
+#include "AnalyticsPool.h"
+#include "Analytics.h"
+#include "utils/Logger.h"
+#include "utils/Metrics.h"
+#include <algorithm>
+
+namespace buksan {
+
+namespace {
+const double fps_window_sec = 1.0;
+const double lag_smoothing = 0.1;
+}
+
+AnalyticsPool::AnalyticsPool(unsigned workers) {
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers_.reserve(workers);
+    for (unsigned i = 0; i < workers; ++i) {
+        workers_.emplace_back(&AnalyticsPool::workerLoop, this);
+    }
+}
+
+AnalyticsPool::~AnalyticsPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+AnalyticsPool::SlotHandle AnalyticsPool::attach(const std::string& cameraId, std::shared_ptr<Analytics> analytics) {
+    auto slot = std::make_shared<Slot>();
+    slot->cameraId = cameraId;
+    slot->analytics = std::move(analytics);
+    slot->window_start = std::chrono::steady_clock::now();
+    slot->lag_seconds = &metrics().histogram("buksan_analytics_lag_seconds",
+                                             "Time from frame capture to the end of its analysis",
+                                             {{"camera", cameraId}});
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots_.push_back(slot);
+    return slot;
+}
+
+void AnalyticsPool::detach(const SlotHandle& slot) {
+    if (!slot) return;
+    std::unique_lock<std::mutex> lock(mutex_);
+    slot->attached = false;
+    slot->pending = false;
+    slot->frame.release();
+    idle_.wait(lock, [&] { return !slot->busy; });
+
+    auto it = std::find(slots_.begin(), slots_.end(), slot);
+    if (it != slots_.end()) {
+        slots_.erase(it);
+    }
+    if (next_slot_ >= slots_.size()) {
+        next_slot_ = 0;
+    }
+}
+
+void AnalyticsPool::submit(const SlotHandle& slot, cv::Mat frame) {
+    if (!slot || frame.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!slot->attached) return;
+        if (slot->pending) {
+            ++slot->stats.replaced;
+        }
+        slot->frame = std::move(frame);
+        slot->captured = std::chrono::steady_clock::now();
+        slot->pending = true;
+        ++slot->stats.submitted;
+    }
+    ready_.notify_one();
+}
+
+AnalyticsStats AnalyticsPool::stats(const SlotHandle& slot) const {
+    if (!slot) return {};
+    std::lock_guard<std::mutex> lock(mutex_);
+    AnalyticsStats result = slot->stats;
+    // A camera that stopped producing frames should not keep reporting its last rate
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - slot->window_start).count();
+    if (elapsed >= 2 * fps_window_sec) {
+        result.analyzedFps = slot->window_analyzed / elapsed;
+    }
+    return result;
+}
+
+AnalyticsPool::SlotHandle AnalyticsPool::nextReadySlot() {
+    // Round-robin from where the previous pick stopped, so one busy camera cannot starve the rest
+    const std::size_t count = slots_.size();
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::size_t index = (next_slot_ + i) % count;
+        const SlotHandle& slot = slots_[index];
+        if (slot->pending && !slot->busy) {
+            next_slot_ = (index + 1) % count;
+            return slot;
+        }
+    }
+    return nullptr;
+}
+
+void AnalyticsPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        SlotHandle slot;
+        ready_.wait(lock, [&] { return stopping_ || (slot = nextReadySlot()) != nullptr; });
+        if (stopping_) break;
+
+        cv::Mat frame = std::move(slot->frame);
+        slot->frame = cv::Mat();
+        const auto captured = slot->captured;
+        slot->pending = false;
+        slot->busy = true;
+
+        lock.unlock();
+        try {
+            slot->analytics->processFrame(frame);
+        } catch (const std::exception& e) {
+            logError(slot->cameraId) << "analytics failed: " << e.what();
+        }
+        frame.release();
+        lock.lock();
+
+        const auto now = std::chrono::steady_clock::now();
+        AnalyticsStats& stats = slot->stats;
+        ++stats.analyzed;
+        stats.lastLagMs = std::chrono::duration<double, std::milli>(now - captured).count();
+        slot->lag_seconds->observe(now - captured);
+        stats.avgLagMs = stats.analyzed == 1
+            ? stats.lastLagMs
+            : stats.avgLagMs + lag_smoothing * (stats.lastLagMs - stats.avgLagMs);
+
+        ++slot->window_analyzed;
+        const double elapsed = std::chrono::duration<double>(now - slot->window_start).count();
+        if (elapsed >= fps_window_sec) {
+            stats.analyzedFps = slot->window_analyzed / elapsed;
+            slot->window_analyzed = 0;
+            slot->window_start = now;
+        }
+
+        slot->busy = false;
+        idle_.notify_all();
+    }
+}
+
+} // namespace buksan
@@ -0,0 +1,83 @@
+#ifndef ANALYTICSPOOL_H
+#define ANALYTICSPOOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace buksan {
+
+class Analytics;
+class Histogram;
+
+struct AnalyticsStats {
+    std::uint64_t submitted{0};
+    std::uint64_t analyzed{0};
+    std::uint64_t replaced{0};
+    double analyzedFps{0.0};
+    double lastLagMs{0.0};
+    double avgLagMs{0.0};
+};
+
+// Runs per-camera analytics on a fixed set of worker threads.
+// Each camera has a single latest-frame slot: a new frame replaces one that has not been picked up yet,
+// so slow analytics lose frames instead of holding up capture.
+class AnalyticsPool {
+public:
+    struct Slot;
+    using SlotHandle = std::shared_ptr<Slot>;
+
+    // workers == 0 sizes the pool to the number of cores
+    explicit AnalyticsPool(unsigned workers = 0);
+    ~AnalyticsPool();
+
+    AnalyticsPool(const AnalyticsPool&) = delete;
+    AnalyticsPool& operator=(const AnalyticsPool&) = delete;
+
+    SlotHandle attach(const std::string& cameraId, std::shared_ptr<Analytics> analytics);
+    // Drops the pending frame and waits for a frame that is being analyzed right now
+    void detach(const SlotHandle& slot);
+    void submit(const SlotHandle& slot, cv::Mat frame);
+
+    AnalyticsStats stats(const SlotHandle& slot) const;
+    unsigned workerCount() const { return static_cast<unsigned>(workers_.size()); }
+
+private:
+    void workerLoop();
+    SlotHandle nextReadySlot();
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable idle_;
+    std::vector<SlotHandle> slots_;
+    std::size_t next_slot_{0};
+    bool stopping_{false};
+    std::vector<std::thread> workers_;
+};
+
+struct AnalyticsPool::Slot {
+    std::string cameraId;
+    std::shared_ptr<Analytics> analytics;
+
+    cv::Mat frame;
+    std::chrono::steady_clock::time_point captured;
+    bool pending{false};
+    bool busy{false};
+    bool attached{true};
+
+    AnalyticsStats stats;
+    Histogram* lag_seconds{nullptr};
+    std::chrono::steady_clock::time_point window_start;
+    std::uint64_t window_analyzed{0};
+};
+
+} // namespace buksan
+
+#endif // ANALYTICSPOOL_H
@@ -1,12 +1,15 @@
 #include "CameraManager.h"
 #include "CameraSession.h"
+#include "StorageVolumes.h"
 
 namespace buksan {
 
 CameraManager::CameraManager(const AppConfig& config) : config_(config) {
+    auto volumes = std::make_shared<StorageVolumes>(config_.storage_volumes, config_.storage_placement,
+                                                    config_.storage_reserve_bytes);
     for (const auto& cam : config_.cameras) {
         if (cam.rtsp_url.empty()) continue;
-        sessions_.push_back(std::make_shared<CameraSession>(cam, config_.storage_path));
+        sessions_.push_back(std::make_shared<CameraSession>(cam, volumes));
     }
 }
 
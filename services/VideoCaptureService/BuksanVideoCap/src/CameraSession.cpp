@@ -1,24 +1,93 @@
 #include "CameraSession.h"
 #include "Recorder.h"
 #include "Analytics.h"
+#include "FrameDecoder.h"
+#include "LiveStream.h"
+#include "PreEventBuffer.h"
+#include "RtspDemuxer.h"
+#include "utils/Logger.h"
+#include "utils/Metrics.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <iostream>
+#include <random>
 #include <thread>
 
 namespace buksan {
 
 namespace {
-const int reconnect_delay_ms = 1000;
+const auto retry_initial_delay = std::chrono::milliseconds(1000);
+const auto retry_max_delay = std::chrono::milliseconds(60000);
+const int writer_idle_ms = 5;
+const std::size_t writer_batch = 64;
+const std::size_t passthrough_queue_depth = 256;
+const std::size_t transcode_queue_depth = 16;
+
+std::size_t queueDepthFor(const CameraConfig& config) {
+    if (config.queue_depth > 0) return static_cast<std::size_t>(config.queue_depth);
+    // Decoded frames are megabytes each, compressed packets only kilobytes
+    return config.record_mode == RecordMode::Passthrough ? passthrough_queue_depth : transcode_queue_depth;
+}
+
+// Exponential backoff with jitter: after a switch reboot the cameras come back spread over
+// the second half of each window instead of all reconnecting at the same moment
+std::chrono::milliseconds retryDelay(int attempt) {
+    thread_local std::mt19937 random{std::random_device{}()};
+    auto window = retry_initial_delay;
+    for (int i = 0; i < attempt && window < retry_max_delay; ++i) {
+        window *= 2;
+    }
+    window = std::min(window, retry_max_delay);
+    std::uniform_int_distribution<std::int64_t> jitter(window.count() / 2, window.count());
+    return std::chrono::milliseconds(jitter(random));
+}
+
+// RTSP reading is deliberately out of the scheduler's scope (see CameraSession.h), so the
+// readers are counted to keep their cost visible next to the scheduler's fixed pool
+std::atomic<int> reader_threads{0};
+
+void countReaders(int delta) {
+    static Gauge& gauge = metrics().gauge("buksan_capture_reader_threads",
+                                          "Blocking RTSP reader threads, one per camera connection");
+    gauge.set(reader_threads.fetch_add(delta) + delta);
+}
 }
 
 CameraSession::CameraSession(const CameraConfig& config,
-                             const std::string& storage_path,
-                             int segment_duration_sec)
+                             std::shared_ptr<StorageVolumes> volumes,
+                             int segment_duration_sec,
+                             AnalyticsPool* analytics_pool,
+                             CaptureScheduler* scheduler,
+                             std::shared_ptr<EncoderPool> encoders)
     : config_(config)
-    , storage_path_(storage_path)
+    , frames_captured_(metrics().counter("buksan_capture_frames_total",
+                                         "Frames or packets read from the camera", {{"camera", config.id}}))
+    , bytes_captured_(metrics().counter("buksan_capture_bytes_total",
+                                        "Compressed bytes read from the camera (passthrough only)", {{"camera", config.id}}))
+    , frames_dropped_(metrics().counter("buksan_dropped_frames_total",
+                                        "Frames dropped because the writer fell behind", {{"camera", config.id}}))
+    , reconnects_(metrics().counter("buksan_camera_reconnects_total",
+                                    "Stream losses followed by a reconnect", {{"camera", config.id}}))
+    , bytes_written_(metrics().counter("buksan_written_bytes_total",
+                                       "Bytes handed to segment files", {{"camera", config.id}}))
+    , decode_seconds_(metrics().histogram("buksan_decode_seconds",
+                                          "Time to decode one frame", {{"camera", config.id}}))
+    , write_seconds_(metrics().histogram("buksan_write_seconds",
+                                         "Time to write one frame or packet to the current segment",
+                                         {{"camera", config.id}}))
+    , volumes_(std::move(volumes))
     , segment_duration_sec_(segment_duration_sec <= 0 ? 300 : segment_duration_sec)
-    , analytics_(std::make_unique<Analytics>())
+    , analytics_(std::make_shared<Analytics>(config.id, config.motion))
+    , analytics_pool_(analytics_pool)
+    , scheduler_(scheduler)
+    , encoders_(std::move(encoders))
+    , demuxer_(std::make_unique<RtspDemuxer>(running_))
+    , queue_(std::make_unique<CaptureQueue>(queueDepthFor(config)))
+    , pre_event_(std::make_unique<PreEventBuffer>(std::chrono::seconds(config.pre_event_sec),
+                                                  static_cast<std::size_t>(config.pre_event_max_bytes)))
+    , live_(std::make_unique<LiveStream>(config.id, config.live))
 {
+    analytics_->setMotionHandler([this](const MotionEvent& event) { onMotion(event); });
 }
 
 CameraSession::~CameraSession() {
@@ -27,91 +96,519 @@ CameraSession::~CameraSession() {
 
 void CameraSession::start() {
     if (running_.exchange(true)) return;
+    if (config_.analytics && analytics_pool_) {
+        analytics_slot_ = analytics_pool_->attach(config_.id, analytics_);
+    }
+    writer_running_.store(true);
+    if (scheduler_) {
+        writer_slot_ = scheduler_->attach([this] { return serviceWriter(writer_batch); });
+    } else {
+        writer_thread_ = std::thread(&CameraSession::runWriter, this);
+    }
     thread_ = std::thread(&CameraSession::run, this);
+    countReaders(1);
+    if (!config_.sub_rtsp_url.empty()) {
+        sub_demuxer_ = std::make_unique<RtspDemuxer>(running_);
+        sub_thread_ = std::thread(&CameraSession::runSubStream, this);
+        countReaders(1);
+    }
 }
 
 void CameraSession::stop() {
     if (!running_.exchange(false)) return;
-    if (thread_.joinable()) thread_.join();
+    {
+        std::lock_guard<std::mutex> lock(retry_mutex_);
+    }
+    retry_wake_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+        countReaders(-1);
+    }
+    if (sub_thread_.joinable()) {
+        sub_thread_.join();
+        countReaders(-1);
+    }
+    if (analytics_slot_) {
+        // After this no worker touches analytics_ or fires the motion handler
+        analytics_pool_->detach(analytics_slot_);
+        analytics_slot_.reset();
+    }
     disconnect();
+    writer_running_.store(false);
+    if (writer_slot_) {
+        CaptureScheduler::SlotHandle slot;
+        {
+            std::lock_guard<std::mutex> lock(writer_slot_mutex_);
+            slot = std::move(writer_slot_);
+        }
+        // Whatever the workers did not get to is written here
+        scheduler_->detach(slot);
+        while (serviceWriter(writer_batch)) {
+        }
+    }
+    if (writer_thread_.joinable()) writer_thread_.join();
+    if (recorder_) {
+        recorder_->stop();
+    }
+    live_->finish();
+}
+
+CaptureQueueStats CameraSession::queueStats() const {
+    return queue_->stats();
+}
+
+std::shared_ptr<LiveViewer> CameraSession::subscribeLive() {
+    if (!liveFromMainStream() && config_.sub_rtsp_url.empty()) return nullptr;
+    return live_->subscribe();
+}
+
+std::optional<AnalyticsStats> CameraSession::analyticsStats() const {
+    if (!analytics_slot_) return std::nullopt;
+    return analytics_pool_->stats(analytics_slot_);
+}
+
+void CameraSession::triggerEvent(std::optional<std::int64_t> alertId) {
+    {
+        std::lock_guard<std::mutex> lock(event_mutex_);
+        if (alertId.has_value() || !eventActive()) {
+            event_alert_id_ = alertId;
+        }
+    }
+    const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(config_.post_event_sec);
+    event_until_ns_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(until.time_since_epoch()).count());
+}
+
+bool CameraSession::eventActive() const {
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return now < event_until_ns_.load();
 }
 
 bool CameraSession::connect() {
+    if (config_.record_mode == RecordMode::Passthrough) {
+        if (demuxer_->isOpen()) return true;
+        if (!demuxer_->open(config_.rtsp_url)) {
+            scheduleRetry("open failed");
+            return false;
+        }
+        stream_ = std::make_shared<const StreamInfo>(demuxer_->streamInfo());
+        ++epoch_;
+        connected_.store(true);
+        logInfo(config_.id) << "connected (passthrough)";
+        return true;
+    }
     if (capture_.isOpened()) return true;
     if (!capture_.open(config_.rtsp_url, cv::CAP_FFMPEG)) {
-        std::cout << "[" << config_.id << "] open failed, retry in " << (reconnect_delay_ms / 1000) << "s" << std::endl;
+        scheduleRetry("open failed");
         return false;
     }
     capture_.set(cv::CAP_PROP_BUFFERSIZE, 1);
-    std::cout << "[" << config_.id << "] connected" << std::endl;
+    stream_.reset();
+    ++epoch_;
+    connected_.store(true);
+    logInfo(config_.id) << "connected";
     return true;
 }
 
+void CameraSession::scheduleRetry(const char* what) {
+    retry_delay_ = retryDelay(retry_attempts_++);
+    logRepeated(LogLevel::Warn, config_.id, what) << what << ", retry in " << retry_delay_.count() / 1000.0 << "s";
+}
+
+void CameraSession::waitForRetry() {
+    std::unique_lock<std::mutex> lock(retry_mutex_);
+    retry_wake_.wait_for(lock, retry_delay_, [this] { return !running_.load(); });
+}
+
 void CameraSession::disconnect() {
-    if (recorder_) {
-        recorder_->stop();
-    }
+    connected_.store(false);
     if (capture_.isOpened()) {
         capture_.release();
         capture_ = cv::VideoCapture();
     }
+    demuxer_->close();
+    decoder_.reset();
+    stream_.reset();
+    if (liveFromMainStream()) live_->reset();
+    // Lets the writer finalize the open segment
+    if (writer_slot_) scheduler_->notify(writer_slot_);
+}
+
+void CameraSession::enqueue(CaptureItem&& item) {
+    item.epoch = epoch_;
+    item.stream = stream_;
+    if (!queue_->push(std::move(item))) {
+        frames_dropped_.inc();
+    } else if (writer_slot_) {
+        scheduler_->notify(writer_slot_);
+    }
+}
+
+void CameraSession::onSegmentClosed(const SegmentInfo& segment) {
+    if (config_.record_mode != RecordMode::Passthrough) {
+        // Encoded sizes are only known once the segment is on disk
+        bytes_written_.inc(segment.sizeBytes);
+    }
+    logInfo(config_.id) << "segment closed: " << segment.path
+                        << " pts " << segment.firstPtsUs() << ".." << segment.lastPtsUs() << " us"
+                        << (segment.startsWithKeyframe ? "" : " (no leading keyframe)");
+    if (segment_handler_) {
+        segment_handler_(config_.id, segment);
+    }
+}
+
+void CameraSession::onMotion(const MotionEvent& event) {
+    logInfo(config_.id) << "motion " << (event.started ? "started" : "stopped")
+                        << " (score " << event.score << ")";
+    // The stopped edge restarts the window too, so the post-event tail runs from the last motion
+    triggerEvent(std::nullopt);
+    motion_active_.store(event.started);
+}
+
+void CameraSession::analyze(const cv::Mat& frame) {
+    // Motion longer than post_event_sec must not close the event while it goes on
+    if (motion_active_.load()) {
+        triggerEvent(std::nullopt);
+    }
+    if (analytics_slot_) {
+        analytics_pool_->submit(analytics_slot_, frame);
+    } else {
+        analytics_->processFrame(frame);
+    }
 }
 
 void CameraSession::run() {
-    bool writer_started = false;
-    double fps = 25.0;
+    if (config_.record_mode == RecordMode::Passthrough) {
+        runPassthrough();
+        return;
+    }
 
     while (running_.load()) {
         if (!connect()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(reconnect_delay_ms));
+            waitForRetry();
             continue;
         }
 
+        // grab() waits on the network, retrieve() is the decode
         cv::Mat frame;
-        if (!capture_.read(frame)) {
-            std::cout << "[" << config_.id << "] read failed, reconnecting" << std::endl;
+        bool ok = capture_.grab();
+        if (ok) {
+            ScopedTimer timer(decode_seconds_);
+            ok = capture_.retrieve(frame);
+        }
+        if (!ok) {
+            scheduleRetry("read failed");
+            reconnects_.inc();
             disconnect();
-            writer_started = false;
-            std::this_thread::sleep_for(std::chrono::milliseconds(reconnect_delay_ms));
+            waitForRetry();
+            continue;
+        }
+        if (frame.empty() || frame.cols <= 0 || frame.rows <= 0) continue;
+        frames_captured_.inc();
+        retry_attempts_ = 0;
+
+        if (!stream_) {
+            auto info = std::make_shared<StreamInfo>();
+            info->fps = capture_.get(cv::CAP_PROP_FPS);
+            if (info->fps <= 0) info->fps = 25.0;
+            info->width = frame.cols;
+            info->height = frame.rows;
+            stream_ = info;
+        }
+
+        if (config_.record) {
+            CaptureItem item;
+            item.frame = frame;
+            // Decoded frames do not depend on each other, so any of them may start a segment
+            item.keyframe = true;
+            enqueue(std::move(item));
+        }
+        if (analyzesMainStream() && analytics_->admitFrame()) {
+            analyze(frame);
+        }
+    }
+
+    disconnect();
+}
+
+void CameraSession::runPassthrough() {
+    bool decoder_failed = false;
+
+    while (running_.load()) {
+        if (!connect()) {
+            waitForRetry();
+            continue;
+        }
+
+        MediaPacket packet;
+        if (!demuxer_->read(packet)) {
+            scheduleRetry("read failed");
+            reconnects_.inc();
+            disconnect();
+            decoder_failed = false;
+            waitForRetry();
             continue;
         }
+        frames_captured_.inc();
+        retry_attempts_ = 0;
+        bytes_captured_.inc(packet.size());
+
+        if (config_.record) {
+            CaptureItem item;
+            item.packet = packet;
+            item.keyframe = packet.keyframe;
+            enqueue(std::move(item));
+        }
+
+        if (liveFromMainStream()) {
+            live_->push(*stream_, packet);
+        }
+        if (analyzesMainStream() && !decoder_failed) {
+            analyzePacket(decoder_, demuxer_->streamInfo(), packet, decoder_failed);
+        }
+    }
+
+    disconnect();
+}
+
+bool CameraSession::analyzesMainStream() const {
+    return config_.analytics && config_.sub_rtsp_url.empty();
+}
+
+bool CameraSession::liveFromMainStream() const {
+    // Decoded frames have nothing to share; viewers get the sub-stream when there is one
+    return config_.record_mode == RecordMode::Passthrough && config_.sub_rtsp_url.empty();
+}
+
+void CameraSession::analyzePacket(std::unique_ptr<FrameDecoder>& decoder, const StreamInfo& stream,
+                                  const MediaPacket& packet, bool& failed) {
+    try {
+        if (!decoder) {
+            decoder = std::make_unique<FrameDecoder>(stream, analytics_->analysisWidth(), true);
+        }
+        // Every packet goes through the decoder to keep references intact,
+        // but only admitted frames pay for scaling and analysis
+        const bool admitted = analytics_->admitFrame();
+        cv::Mat frame;
+        bool decoded = false;
+        {
+            ScopedTimer timer(decode_seconds_);
+            decoded = decoder->decode(packet, admitted ? &frame : nullptr);
+        }
+        if (decoded && admitted) {
+            analyze(frame);
+        }
+    } catch (const std::exception& e) {
+        logError(config_.id) << "decoder failed: " << e.what();
+        failed = true;
+    }
+}
+
+// The main stream is recorded untouched; motion detection and live viewers read the camera's
+// low-resolution stream on its own connection, so a 4K camera is never decoded at full size for analytics
+void CameraSession::runSubStream() {
+    int attempts = 0;
+    bool decoder_failed = false;
 
-        if (!writer_started && config_.record && !frame.empty() && frame.cols > 0 && frame.rows > 0) {
-            fps = capture_.get(cv::CAP_PROP_FPS);
-            if (fps <= 0) fps = 25.0;
-            if (recorder_) {
-                try {
-                    recorder_->startNewSegment();
-                    writer_started = true;
-                    std::cout << "[" << config_.id << "] recording resumed (new segment)" << std::endl;
-                } catch (const std::exception& e) {
-                    std::cout << "[" << config_.id << "] startNewSegment failed: " << e.what() << std::endl;
-                }
-            } else {
-                try {
-                    recorder_ = std::make_unique<Recorder>(config_.id, storage_path_, segment_duration_sec_, fps, frame.size());
-                    writer_started = true;
-                    std::cout << "[" << config_.id << "] recording started" << std::endl;
-                } catch (const std::exception& e) {
-                    std::cout << "[" << config_.id << "] recorder failed: " << e.what() << std::endl;
-                }
+    while (running_.load()) {
+        if (!sub_demuxer_->isOpen()) {
+            if (!sub_demuxer_->open(config_.sub_rtsp_url)) {
+                retrySubStream(attempts, "sub-stream open failed");
+                continue;
             }
+            logInfo(config_.id) << "connected (sub-stream)";
+        }
+
+        MediaPacket packet;
+        if (!sub_demuxer_->read(packet)) {
+            sub_demuxer_->close();
+            sub_decoder_.reset();
+            live_->reset();
+            decoder_failed = false;
+            retrySubStream(attempts, "sub-stream read failed");
+            continue;
+        }
+        attempts = 0;
+        live_->push(sub_demuxer_->streamInfo(), packet);
+        if (config_.analytics && !decoder_failed) {
+            analyzePacket(sub_decoder_, sub_demuxer_->streamInfo(), packet, decoder_failed);
+        }
+    }
+
+    sub_demuxer_->close();
+    sub_decoder_.reset();
+    live_->reset();
+}
+
+void CameraSession::retrySubStream(int& attempts, const char* what) {
+    const auto delay = retryDelay(attempts++);
+    logRepeated(LogLevel::Warn, config_.id, what) << what << ", retry in " << delay.count() / 1000.0 << "s";
+    std::unique_lock<std::mutex> lock(retry_mutex_);
+    retry_wake_.wait_for(lock, delay, [this] { return !running_.load(); });
+}
+
+bool CameraSession::startRecorder(const StreamInfo& stream) {
+    if (config_.record_mode == RecordMode::Passthrough) {
+        // Stream parameters may change between connections, so the muxer is rebuilt from the fresh ones
+        try {
+            recorder_.reset();
+            recorder_ = std::make_unique<Recorder>(config_.id, volumes_, segment_duration_sec_,
+                                                   stream, config_.segment_max_overshoot_sec, config_.segment_io);
+            recorder_->setSegmentClosedHandler([this](const SegmentInfo& segment) { onSegmentClosed(segment); });
+            logInfo(config_.id) << "recording started (passthrough)";
+            return true;
+        } catch (const std::exception& e) {
+            logError(config_.id) << "recorder failed: " << e.what();
+            return false;
+        }
+    }
+
+    if (recorder_) {
+        try {
+            recorder_->startNewSegment();
+            logInfo(config_.id) << "recording resumed (new segment)";
+            return true;
+        } catch (const std::exception& e) {
+            logError(config_.id) << "startNewSegment failed: " << e.what();
+            return false;
         }
+    }
+    try {
+        recorder_ = std::make_unique<Recorder>(config_.id, volumes_, segment_duration_sec_,
+                                               stream.fps, cv::Size(stream.width, stream.height),
+                                               encoders_, config_.transcode_width);
+        recorder_->setSegmentClosedHandler([this](const SegmentInfo& segment) { onSegmentClosed(segment); });
+        recorder_->setEncodedHandler([this] { notifyWriter(); });
+        logInfo(config_.id) << "recording started";
+        return true;
+    } catch (const std::exception& e) {
+        logError(config_.id) << "recorder failed: " << e.what();
+        return false;
+    }
+}
+
+void CameraSession::runWriter() {
+    while (true) {
+        if (serviceWriter(writer_batch)) continue;
+        if (!writer_running_.load() && queue_->empty()) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(writer_idle_ms));
+    }
+}
 
-        if (config_.record && recorder_ && recorder_->isRecording()) {
-            try {
-                recorder_->writeFrame(frame);
-            } catch (const std::exception& e) {
-                std::cout << "Camera " << config_.id << ": writeFrame failed: " << e.what() << std::endl;
-                writer_started = false;
+bool CameraSession::serviceWriter(std::size_t max_items) {
+    // What the encoder pool produced for this camera is written here, off the encoder threads
+    const bool more_encoded = recorder_ && recorder_->drainEncoded(max_items);
+    CaptureItem item;
+    for (std::size_t served = 0; served < max_items; ++served) {
+        if (!queue_->pop(item)) {
+            if (!connected_.load() && writer_started_) {
+                // Camera is gone and everything it sent is on disk: finalize the open segment
+                if (recorder_) recorder_->stop();
+                writer_started_ = false;
             }
+            return more_encoded;
         }
-        if (config_.analytics && analytics_) {
-            analytics_->processFrame(frame);
+        writeQueued(item);
+    }
+    return more_encoded || !queue_->empty();
+}
+
+void CameraSession::notifyWriter() {
+    // Encoder threads call this too, so it must not race with stop() detaching the slot
+    std::lock_guard<std::mutex> lock(writer_slot_mutex_);
+    if (writer_slot_) scheduler_->notify(writer_slot_);
+}
+
+void CameraSession::writeQueued(const CaptureItem& item) {
+    if (item.epoch != writer_epoch_) {
+        writer_epoch_ = item.epoch;
+        writer_started_ = false;
+        pre_event_->clear();
+    }
+    if (!item.stream) return;
+
+    if (config_.record_trigger == RecordTrigger::Event) {
+        writeEventItem(item, writer_started_);
+        return;
+    }
+
+    if (!writer_started_) {
+        writer_started_ = startRecorder(*item.stream);
+    }
+    if (!writer_started_ || !recorder_ || !recorder_->isRecording()) return;
+
+    const bool active = eventActive();
+    if (active != event_recording_) {
+        // Continuous footage is already on disk; the event only tags the segments it spans
+        std::optional<std::int64_t> alert;
+        if (active) {
+            std::lock_guard<std::mutex> lock(event_mutex_);
+            alert = event_alert_id_;
         }
+        recorder_->setAlertId(alert);
+        event_recording_ = active;
     }
 
-    disconnect();
+    try {
+        writeItem(item);
+    } catch (const std::exception& e) {
+        logError(config_.id) << "write failed: " << e.what();
+        writer_started_ = false;
+    }
+}
+
+void CameraSession::writeItem(const CaptureItem& item) {
+    ScopedTimer timer(write_seconds_);
+    if (config_.record_mode == RecordMode::Passthrough) {
+        recorder_->writePacket(item.packet);
+        bytes_written_.inc(item.packet.size());
+    } else {
+        recorder_->writeFrame(item.frame);
+    }
+}
+
+void CameraSession::writeEventItem(const CaptureItem& item, bool& writer_started) {
+    const bool passthrough = config_.record_mode == RecordMode::Passthrough;
+
+    if (!eventActive()) {
+        if (writer_started) {
+            if (recorder_) recorder_->stop();
+            writer_started = false;
+            logInfo(config_.id) << "event recording finished";
+        }
+        if (passthrough) {
+            pre_event_->push(item.packet);
+        }
+        return;
+    }
+
+    try {
+        if (!writer_started) {
+            writer_started = startRecorder(*item.stream);
+            if (!writer_started || !recorder_) return;
+
+            std::optional<std::int64_t> alert;
+            {
+                std::lock_guard<std::mutex> lock(event_mutex_);
+                alert = event_alert_id_;
+            }
+            recorder_->setAlertId(alert);
+
+            const auto preroll = pre_event_->drain();
+            for (const auto& packet : preroll) {
+                recorder_->writePacket(packet);
+                bytes_written_.inc(packet.size());
+            }
+            logInfo(config_.id) << "event recording started with " << preroll.size()
+                                << " pre-event packets";
+        }
+        if (recorder_ && recorder_->isRecording()) {
+            writeItem(item);
+        }
+    } catch (const std::exception& e) {
+        logError(config_.id) << "write failed: " << e.what();
+        writer_started = false;
+    }
 }
 
 } // namespace buksan
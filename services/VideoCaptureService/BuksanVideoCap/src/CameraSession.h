@@ -1,43 +1,142 @@
 #ifndef CAMERASESSION_H
 #define CAMERASESSION_H
 
+#include "AnalyticsPool.h"
+#include "CaptureQueue.h"
+#include "CaptureScheduler.h"
 #include "ConfigLoader.h"
+#include "EncoderPool.h"
+#include "LiveStream.h"
+#include "Recorder.h"
+#include "utils/Metrics.h"
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <thread>
 #include <opencv2/core.hpp>
 #include <opencv2/videoio.hpp>
 
 namespace buksan {
 
-class Recorder;
 class Analytics;
+struct MotionEvent;
+class RtspDemuxer;
+class FrameDecoder;
+class PreEventBuffer;
+class StorageVolumes;
 
 class CameraSession {
 public:
     explicit CameraSession(const CameraConfig& config,
-                          const std::string& storage_path,
-                          int segment_duration_sec = 300);
+                          std::shared_ptr<StorageVolumes> volumes,
+                          int segment_duration_sec = 300,
+                          AnalyticsPool* analytics_pool = nullptr,
+                          CaptureScheduler* scheduler = nullptr,
+                          std::shared_ptr<EncoderPool> encoders = nullptr);
 
     ~CameraSession();
 
     void start();
     void stop();
     bool running() const { return running_.load(); }
+    CaptureQueueStats queueStats() const;
+    std::optional<AnalyticsStats> analyticsStats() const;
+
+    // nullptr when the camera has no compressed stream to share (transcode without sub_rtsp_url)
+    // or already has all the live viewers it allows
+    std::shared_ptr<LiveViewer> subscribeLive();
+
+    // Starts (or extends) an event recording window; safe to call from any thread.
+    void triggerEvent(std::optional<std::int64_t> alertId = std::nullopt);
+
+    // Receives every finished segment on the writer thread; set before start().
+    void setSegmentHandler(CameraSegmentHandler handler) { segment_handler_ = std::move(handler); }
 
 private:
     void run();
+    void runPassthrough();
+    void runSubStream();
+    void retrySubStream(int& attempts, const char* what);
+    bool analyzesMainStream() const;
+    bool liveFromMainStream() const;
+    void analyzePacket(std::unique_ptr<FrameDecoder>& decoder, const StreamInfo& stream,
+                       const MediaPacket& packet, bool& failed);
+    void runWriter();
+    bool serviceWriter(std::size_t max_items);
+    void notifyWriter();
+    void writeQueued(const CaptureItem& item);
+    bool startRecorder(const StreamInfo& stream);
+    void enqueue(CaptureItem&& item);
+    bool eventActive() const;
+    void writeItem(const CaptureItem& item);
+    void writeEventItem(const CaptureItem& item, bool& writer_started);
     bool connect();
     void disconnect();
+    void scheduleRetry(const char* what);
+    void waitForRetry();
+    void onSegmentClosed(const SegmentInfo& segment);
+    void onMotion(const MotionEvent& event);
+    void analyze(const cv::Mat& frame);
 
     CameraConfig config_;
-    std::string storage_path_;
+    Counter& frames_captured_;
+    Counter& bytes_captured_;
+    Counter& frames_dropped_;
+    Counter& reconnects_;
+    Counter& bytes_written_;
+    Histogram& decode_seconds_;
+    Histogram& write_seconds_;
+    std::shared_ptr<StorageVolumes> volumes_;
     int segment_duration_sec_{300};
     std::unique_ptr<Recorder> recorder_;
-    std::unique_ptr<Analytics> analytics_;
+    CameraSegmentHandler segment_handler_;
+    std::shared_ptr<Analytics> analytics_;
+    AnalyticsPool* analytics_pool_{nullptr};
+    AnalyticsPool::SlotHandle analytics_slot_;
+    CaptureScheduler* scheduler_{nullptr};
+    CaptureScheduler::SlotHandle writer_slot_;
+    // Guards writer_slot_ against stop() for notifications from encoder threads
+    std::mutex writer_slot_mutex_;
+    std::shared_ptr<EncoderPool> encoders_;
     cv::VideoCapture capture_;
+    std::unique_ptr<RtspDemuxer> demuxer_;
+    std::unique_ptr<FrameDecoder> decoder_;
+    // Sub-stream for analytics and live view; the thread owns the demuxer and decoder
+    std::unique_ptr<RtspDemuxer> sub_demuxer_;
+    std::unique_ptr<FrameDecoder> sub_decoder_;
+    std::unique_ptr<CaptureQueue> queue_;
+    std::unique_ptr<PreEventBuffer> pre_event_;
+    std::unique_ptr<LiveStream> live_;
+    std::atomic<std::int64_t> event_until_ns_{0};
+    // Between the motion started and stopped edges; every analyzed frame then extends the event
+    std::atomic<bool> motion_active_{false};
+    mutable std::mutex event_mutex_;
+    std::optional<std::int64_t> event_alert_id_;
+    bool event_recording_{false};
+    std::shared_ptr<const StreamInfo> stream_;
+    std::uint64_t epoch_{0};
+    int retry_attempts_{0};
+    std::chrono::milliseconds retry_delay_{0};
+    std::mutex retry_mutex_;
+    std::condition_variable retry_wake_;
+    // Writer state; owned by whichever thread serves the writer
+    std::uint64_t writer_epoch_{0};
+    bool writer_started_{false};
+    std::atomic<bool> connected_{false};
     std::atomic<bool> running_{false};
+    std::atomic<bool> writer_running_{false};
+    // Reading RTSP is out of CaptureScheduler's scope by design: one blocking reader per connection
+    // (two with a sub-stream). The libavformat RTSP demuxer opens its own sockets, so neither a custom
+    // AVIOContext nor epoll can reach them, and it ignores AVFMT_FLAG_NONBLOCK on interleaved TCP;
+    // multiplexing reads needs an RTSP client of our own. The readers are exported as
+    // buksan_capture_reader_threads.
     std::thread thread_;
+    std::thread sub_thread_;
+    std::thread writer_thread_;
 };
 
 } // namespace buksan
@@ -0,0 +1,55 @@
+#include "CaptureQueue.h"
+
+namespace buksan {
+
+CaptureQueue::CaptureQueue(std::size_t depth)
+    : ring_(depth)
+    , soft_limit_(ring_.capacity() * 3 / 4)
+{
+}
+
+bool CaptureQueue::push(CaptureItem&& item) {
+    // Once a frame is lost the rest of its GOP cannot be decoded, so skip to the next keyframe.
+    // Past the soft limit only keyframes are admitted, leaving the remaining slots for them.
+    const std::size_t depth = ring_.size();
+    bool drop = false;
+    if (dropping_until_keyframe_ && !item.keyframe) {
+        drop = true;
+    } else if (!item.keyframe && depth >= soft_limit_) {
+        drop = true;
+    }
+
+    if (!drop && !ring_.tryPush(std::move(item))) {
+        drop = true;
+    }
+
+    if (drop) {
+        dropping_until_keyframe_ = true;
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    dropping_until_keyframe_ = false;
+    pushed_.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t occupied = depth + 1;
+    if (occupied > high_water_mark_.load(std::memory_order_relaxed)) {
+        high_water_mark_.store(occupied, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+bool CaptureQueue::pop(CaptureItem& item) {
+    return ring_.tryPop(item);
+}
+
+CaptureQueueStats CaptureQueue::stats() const {
+    CaptureQueueStats s;
+    s.pushed = pushed_.load(std::memory_order_relaxed);
+    s.dropped = dropped_.load(std::memory_order_relaxed);
+    s.depth = ring_.size();
+    s.highWaterMark = high_water_mark_.load(std::memory_order_relaxed);
+    s.capacity = ring_.capacity();
+    return s;
+}
+
+} // namespace buksan
@@ -0,0 +1,51 @@
+#ifndef CAPTUREQUEUE_H
+#define CAPTUREQUEUE_H
+
+#include "MediaPacket.h"
+#include "utils/SpscRing.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <opencv2/core.hpp>
+
+namespace buksan {
+
+struct CaptureItem {
+    MediaPacket packet;
+    cv::Mat frame;
+    bool keyframe{false};
+    std::uint64_t epoch{0};
+    std::shared_ptr<const StreamInfo> stream;
+};
+
+struct CaptureQueueStats {
+    std::uint64_t pushed{0};
+    std::uint64_t dropped{0};
+    std::size_t depth{0};
+    std::size_t highWaterMark{0};
+    std::size_t capacity{0};
+};
+
+class CaptureQueue {
+public:
+    explicit CaptureQueue(std::size_t depth);
+
+    bool push(CaptureItem&& item);
+    bool pop(CaptureItem& item);
+    bool empty() const { return ring_.size() == 0; }
+
+    CaptureQueueStats stats() const;
+
+private:
+    SpscRing<CaptureItem> ring_;
+    std::size_t soft_limit_;
+    bool dropping_until_keyframe_{false};
+    std::atomic<std::uint64_t> pushed_{0};
+    std::atomic<std::uint64_t> dropped_{0};
+    std::atomic<std::size_t> high_water_mark_{0};
+};
+
+} // namespace buksan
+
+#endif // CAPTUREQUEUE_H
@@ -0,0 +1,165 @@
+#include "CaptureScheduler.h"
+#include "utils/Logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace buksan {
+
+namespace {
+// Slot ids start at 1; the stop eventfd is registered under 0
+const std::uint64_t stop_id = 0;
+
+std::runtime_error systemError(const std::string& what) {
+    return std::runtime_error("CaptureScheduler: " + what + ": " + std::strerror(errno));
+}
+}
+
+CaptureScheduler::CaptureScheduler(unsigned workers) {
+    if (workers == 0) {
+        workers = std::max(2u, std::thread::hardware_concurrency() / 2);
+    }
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        throw systemError("epoll_create1 failed");
+    }
+    stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd_ < 0) {
+        ::close(epoll_fd_);
+        throw systemError("eventfd failed");
+    }
+    // Level-triggered and never read, so once written it wakes every worker
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = stop_id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &event) != 0) {
+        ::close(stop_fd_);
+        ::close(epoll_fd_);
+        throw systemError("epoll_ctl failed");
+    }
+
+    workers_.reserve(workers);
+    for (unsigned i = 0; i < workers; ++i) {
+        workers_.emplace_back(&CaptureScheduler::workerLoop, this);
+    }
+}
+
+CaptureScheduler::~CaptureScheduler() {
+    const std::uint64_t one = 1;
+    if (::write(stop_fd_, &one, sizeof(one)) < 0) {
+        logError("capture") << "cannot stop scheduler workers: " << std::strerror(errno);
+    }
+    for (auto& worker : workers_) {
+        if (worker.joinable()) worker.join();
+    }
+    for (auto& [id, slot] : slots_) {
+        ::close(slot->event_fd);
+    }
+    ::close(stop_fd_);
+    ::close(epoll_fd_);
+}
+
+CaptureScheduler::SlotHandle CaptureScheduler::attach(Service service) {
+    auto slot = std::make_shared<Slot>();
+    slot->service = std::move(service);
+    slot->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (slot->event_fd < 0) {
+        throw systemError("eventfd failed");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    slot->id = next_id_++;
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.u64 = slot->id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, slot->event_fd, &event) != 0) {
+        ::close(slot->event_fd);
+        throw systemError("epoll_ctl failed");
+    }
+    slots_.emplace(slot->id, slot);
+    return slot;
+}
+
+void CaptureScheduler::detach(const SlotHandle& slot) {
+    if (!slot) return;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!slot->attached) return;
+        slot->attached = false;
+        idle_.wait(lock, [&] { return !slot->busy; });
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, slot->event_fd, nullptr);
+        slots_.erase(slot->id);
+    }
+    ::close(slot->event_fd);
+    slot->event_fd = -1;
+}
+
+void CaptureScheduler::notify(const SlotHandle& slot) {
+    if (slot && !slot->signalled.exchange(true, std::memory_order_acq_rel)) {
+        signal(*slot);
+    }
+}
+
+void CaptureScheduler::signal(Slot& slot) {
+    const std::uint64_t one = 1;
+    while (::write(slot.event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+void CaptureScheduler::workerLoop() {
+    while (true) {
+        epoll_event event{};
+        const int n = epoll_wait(epoll_fd_, &event, 1, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            logError("capture") << "epoll_wait failed: " << std::strerror(errno);
+            return;
+        }
+        if (n == 0) continue;
+        if (event.data.u64 == stop_id) return;
+
+        SlotHandle slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = slots_.find(event.data.u64);
+            if (it == slots_.end() || !it->second->attached) continue;
+            slot = it->second;
+            slot->busy = true;
+        }
+
+        std::uint64_t counter = 0;
+        while (::read(slot->event_fd, &counter, sizeof(counter)) < 0 && errno == EINTR) {
+        }
+        // Whatever is queued after this point raises the signal again
+        slot->signalled.exchange(false, std::memory_order_acq_rel);
+
+        bool more = false;
+        try {
+            more = slot->service();
+        } catch (const std::exception& e) {
+            logError("capture") << "writer batch failed: " << e.what();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot->busy = false;
+        if (slot->attached) {
+            if (more) {
+                // Requeued behind the sessions already waiting instead of served again right away
+                slot->signalled.store(true, std::memory_order_release);
+                signal(*slot);
+            }
+            epoll_event rearm{};
+            rearm.events = EPOLLIN | EPOLLONESHOT;
+            rearm.data.u64 = slot->id;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, slot->event_fd, &rearm);
+        }
+        idle_.notify_all();
+    }
+}
+
+} // namespace buksan
@@ -0,0 +1,68 @@
+#ifndef CAPTURESCHEDULER_H
+#define CAPTURESCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace buksan {
+
+// Runs the write side of all camera sessions on a few threads instead of one per camera.
+// A session signals its eventfd when it queues work; the workers wait on every session at once
+// through a single epoll set and serve a signalled session in bounded batches, so an idle camera
+// costs neither a thread nor periodic wakeups. RTSP reads are not scheduled here: each connection
+// keeps its own blocking reader thread (see CameraSession).
+class CaptureScheduler {
+public:
+    struct Slot;
+    using SlotHandle = std::shared_ptr<Slot>;
+    // Serves one batch; returns true when more work is already waiting
+    using Service = std::function<bool()>;
+
+    // workers == 0 uses half the cores, at least two
+    explicit CaptureScheduler(unsigned workers = 0);
+    ~CaptureScheduler();
+
+    CaptureScheduler(const CaptureScheduler&) = delete;
+    CaptureScheduler& operator=(const CaptureScheduler&) = delete;
+
+    SlotHandle attach(Service service);
+    // Waits for a batch that is running right now; the service is not called afterwards
+    void detach(const SlotHandle& slot);
+    // Cheap while the slot is already signalled; must not race with detach
+    void notify(const SlotHandle& slot);
+
+    unsigned workerCount() const { return static_cast<unsigned>(workers_.size()); }
+
+private:
+    void workerLoop();
+    void signal(Slot& slot);
+
+    int epoll_fd_{-1};
+    int stop_fd_{-1};
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::unordered_map<std::uint64_t, SlotHandle> slots_;
+    std::uint64_t next_id_{1};
+    std::vector<std::thread> workers_;
+};
+
+struct CaptureScheduler::Slot {
+    std::uint64_t id{0};
+    int event_fd{-1};
+    Service service;
+    // Set by the producer before it writes the eventfd, cleared by the worker before it serves
+    std::atomic<bool> signalled{false};
+    bool busy{false};
+    bool attached{true};
+};
+
+} // namespace buksan
+
+#endif // CAPTURESCHEDULER_H
@@ -0,0 +1,468 @@
+#include "ClipExport.h"
+#include "utils/Logger.h"
+#include <algorithm>
+#include <stdexcept>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+namespace buksan {
+
+namespace {
+const int avio_buffer_size = 64 * 1024;
+// Output handed out at a time; the reader asks for the next piece once this one is sent
+const std::size_t piece_bytes = 256 * 1024;
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int collectOutput(void* opaque, const uint8_t* data, int size) {
+#else
+int collectOutput(void* opaque, uint8_t* data, int size) {
+#endif
+    static_cast<std::string*>(opaque)->append(reinterpret_cast<const char*>(data), static_cast<std::size_t>(size));
+    return size;
+}
+}
+
+bool parseClipFormat(const std::string& value, ClipFormat& format) {
+    if (value == "mp4") {
+        format = ClipFormat::Mp4;
+        return true;
+    }
+    if (value == "mkv" || value == "matroska") {
+        format = ClipFormat::Matroska;
+        return true;
+    }
+    return false;
+}
+
+const char* clipContentType(ClipFormat format) {
+    return format == ClipFormat::Mp4 ? "video/mp4" : "video/x-matroska";
+}
+
+const char* clipExtension(ClipFormat format) {
+    return format == ClipFormat::Mp4 ? "mp4" : "mkv";
+}
+
+ClipExport::ClipExport(std::vector<ClipSegment> segments, std::int64_t from_unix, std::int64_t to_unix,
+                       ClipFormat format)
+    : segments_(std::move(segments))
+    , from_unix_(from_unix)
+    , to_unix_(to_unix)
+    , format_(format)
+{
+}
+
+bool ClipExport::open() {
+    try {
+        packet_ = av_packet_alloc();
+        if (!packet_) {
+            throw std::runtime_error("cannot allocate packet");
+        }
+        if (!openNextSegment()) {
+            throw std::runtime_error("no readable segments in range");
+        }
+        return true;
+    } catch (const std::exception& e) {
+        logWarn("export") << "clip export not started: " << e.what();
+    }
+    closeInput();
+    releaseOutput();
+    finished_ = true;
+    return false;
+}
+
+ClipExport::~ClipExport() {
+    closeInput();
+    releaseOutput();
+    av_packet_free(&packet_);
+}
+
+std::shared_ptr<const std::string> ClipExport::next() {
+    if (finished_ || !output_) return nullptr;
+    try {
+        while (!done_ && out_.size() < piece_bytes) {
+            done_ = !copyPacket();
+        }
+        if (done_) {
+            closeInput();
+            if (av_write_trailer(output_) < 0) {
+                throw std::runtime_error("cannot finish the clip");
+            }
+        }
+        avio_flush(output_->pb);
+    } catch (const std::exception& e) {
+        logError("export") << "clip export stopped: " << e.what();
+        done_ = true;
+    }
+    if (done_) {
+        finished_ = true;
+        closeInput();
+        releaseOutput();
+    }
+    if (out_.empty()) return nullptr;
+    auto piece = std::make_shared<const std::string>(std::move(out_));
+    out_.clear();
+    return piece;
+}
+
+bool ClipExport::openNextSegment() {
+    while (next_segment_ < segments_.size()) {
+        const ClipSegment& segment = segments_[next_segment_++];
+        // Only the segment the clip starts in is seeked into
+        if (openSegment(segment, !started_)) return true;
+    }
+    return false;
+}
+
+bool ClipExport::openSegment(const ClipSegment& segment, bool seek) {
+    if (avformat_open_input(&input_, segment.path.c_str(), nullptr, nullptr) < 0) {
+        input_ = nullptr;
+        logWarn("export") << "segment " << segment.path << " skipped: cannot open";
+        return false;
+    }
+    if (avformat_find_stream_info(input_, nullptr) < 0 ||
+        (input_stream_ = av_find_best_stream(input_, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0)) < 0) {
+        closeInput();
+        logWarn("export") << "segment " << segment.path << " skipped: no video stream";
+        return false;
+    }
+
+    const AVStream* stream = input_->streams[input_stream_];
+    if (!output_) {
+        createOutput(stream);
+    } else {
+        const AVCodecParameters* expected = output_stream_->codecpar;
+        const AVCodecParameters* actual = stream->codecpar;
+        if (actual->codec_id != expected->codec_id || actual->width != expected->width ||
+            actual->height != expected->height) {
+            // A stream cannot change codec or size mid-file without re-encoding
+            closeInput();
+            logWarn("export") << "segment " << segment.path << " skipped: stream parameters differ";
+            return false;
+        }
+    }
+
+    segment_start_unix_ = segment.start_unix;
+    segment_origin_ = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    segment_base_ = AV_NOPTS_VALUE;
+    skip_until_ = AV_NOPTS_VALUE;
+    if (seek && from_unix_ > segment.start_unix) {
+        const std::int64_t target = segment_origin_ + av_rescale_q(from_unix_ - segment.start_unix,
+                                                                    AVRational{1, 1}, stream->time_base);
+        // Backward lands on the keyframe at or before the start; without an index the
+        // first keyframe after it has to do
+        if (av_seek_frame(input_, input_stream_, target, AVSEEK_FLAG_BACKWARD) < 0) {
+            skip_until_ = target;
+        }
+    }
+    return true;
+}
+
+void ClipExport::createOutput(const AVStream* input) {
+    const char* muxer = format_ == ClipFormat::Mp4 ? "mp4" : "matroska";
+    if (avformat_alloc_output_context2(&output_, nullptr, muxer, nullptr) < 0 || !output_) {
+        output_ = nullptr;
+        throw std::runtime_error(std::string("cannot allocate ") + muxer + " muxer");
+    }
+    output_stream_ = avformat_new_stream(output_, nullptr);
+    if (!output_stream_ || avcodec_parameters_copy(output_stream_->codecpar, input->codecpar) < 0) {
+        throw std::runtime_error("cannot create output stream");
+    }
+    output_stream_->codecpar->codec_tag = 0;
+    output_stream_->time_base = input->time_base;
+
+    unsigned char* buffer = static_cast<unsigned char*>(av_malloc(avio_buffer_size));
+    if (buffer) {
+        output_->pb = avio_alloc_context(buffer, avio_buffer_size, 1, &out_, nullptr, &collectOutput, nullptr);
+    }
+    if (!output_->pb) {
+        av_freep(&buffer);
+        throw std::runtime_error("cannot create output I/O context");
+    }
+    output_->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    // The output is never seeked back into: MP4 goes out as fragments, one per keyframe
+    AVDictionary* options = nullptr;
+    if (format_ == ClipFormat::Mp4) {
+        av_dict_set(&options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    }
+    const int rc = avformat_write_header(output_, &options);
+    av_dict_free(&options);
+    if (rc < 0) {
+        throw std::runtime_error(std::string("codec cannot be carried in ") + muxer);
+    }
+}
+
+bool ClipExport::copyPacket() {
+    if (!input_) {
+        if (!openNextSegment()) return false;
+    }
+    if (av_read_frame(input_, packet_) < 0) {
+        // The next segment continues right after the last frame of this one
+        closeInput();
+        offset_ = end_;
+        return true;
+    }
+    if (packet_->stream_index != input_stream_) {
+        av_packet_unref(packet_);
+        return true;
+    }
+
+    const AVRational input_time_base = input_->streams[input_stream_]->time_base;
+    const bool keyframe = (packet_->flags & AV_PKT_FLAG_KEY) != 0;
+    const std::int64_t dts = packet_->dts != AV_NOPTS_VALUE ? packet_->dts : packet_->pts;
+    if (dts == AV_NOPTS_VALUE) {
+        av_packet_unref(packet_);
+        return true;
+    }
+    const std::int64_t pts = packet_->pts != AV_NOPTS_VALUE ? packet_->pts : dts;
+
+    if (!started_) {
+        if (!keyframe || (skip_until_ != AV_NOPTS_VALUE && pts < skip_until_)) {
+            av_packet_unref(packet_);
+            return true;
+        }
+        started_ = true;
+    }
+    if (keyframe && last_dts_ != AV_NOPTS_VALUE) {
+        const double at = static_cast<double>(segment_start_unix_) + (pts - segment_origin_) * av_q2d(input_time_base);
+        if (at >= static_cast<double>(to_unix_)) {
+            av_packet_unref(packet_);
+            return false;
+        }
+    }
+
+    if (segment_base_ == AV_NOPTS_VALUE) segment_base_ = dts;
+    const AVRational output_time_base = output_stream_->time_base;
+    std::int64_t out_dts = offset_ + av_rescale_q(dts - segment_base_, input_time_base, output_time_base);
+    std::int64_t out_pts = offset_ + av_rescale_q(pts - segment_base_, input_time_base, output_time_base);
+    if (last_dts_ != AV_NOPTS_VALUE && out_dts <= last_dts_) {
+        out_dts = last_dts_ + 1;
+    }
+    if (out_pts < out_dts) out_pts = out_dts;
+    std::int64_t duration = packet_->duration > 0
+        ? av_rescale_q(packet_->duration, input_time_base, output_time_base)
+        : (last_dts_ != AV_NOPTS_VALUE ? out_dts - last_dts_ : 1);
+    last_dts_ = out_dts;
+    end_ = std::max(end_, out_dts + std::max<std::int64_t>(duration, 1));
+
+    packet_->dts = out_dts;
+    packet_->pts = out_pts;
+    packet_->duration = duration;
+    packet_->stream_index = output_stream_->index;
+    packet_->pos = -1;
+    const int rc = av_write_frame(output_, packet_);
+    av_packet_unref(packet_);
+    if (rc < 0) {
+        throw std::runtime_error("packet write failed");
+    }
+    return true;
+}
+
+void ClipExport::closeInput() {
+    if (input_) {
+        avformat_close_input(&input_);
+    }
+    input_stream_ = -1;
+}
+
+void ClipExport::releaseOutput() {
+    if (!output_) return;
+    if (output_->pb) {
+        av_freep(&output_->pb->buffer);
+        avio_context_free(&output_->pb);
+    }
+    avformat_free_context(output_);
+    output_ = nullptr;
+    output_stream_ = nullptr;
+}
+
+ClipStream::ClipStream(std::unique_ptr<ClipExport> clip, std::weak_ptr<ClipExportPool> pool, std::size_t ahead,
+                       OpenHandler on_open)
+    : pool_(std::move(pool))
+    , ahead_(std::max<std::size_t>(ahead, 1))
+    , clip_(std::move(clip))
+    , on_open_(std::move(on_open))
+{
+}
+
+std::shared_ptr<const std::string> ClipStream::next(bool& finished) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished = false;
+    if (!pieces_.empty()) {
+        auto piece = std::move(pieces_.front());
+        pieces_.pop_front();
+        idle_ = false;
+        scheduleLocked();
+        return piece;
+    }
+    if (done_ || closed_) {
+        finished = true;
+        return nullptr;
+    }
+    idle_ = true;
+    scheduleLocked();
+    return nullptr;
+}
+
+void ClipStream::setNotifier(std::function<void()> notify) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    notify_ = std::move(notify);
+}
+
+void ClipStream::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    pieces_.clear();
+    // Drops the connection the notifier refers to
+    notify_ = nullptr;
+    if (!scheduled_) clip_.reset();
+}
+
+void ClipStream::scheduleLocked() {
+    if (scheduled_ || done_ || closed_ || pieces_.size() >= ahead_) return;
+    // A pool that is gone or stopping ends the body rather than leave the reader waiting
+    auto pool = pool_.lock();
+    if (!pool) {
+        done_ = true;
+        clip_.reset();
+        return;
+    }
+    if (!pool->submit(shared_from_this())) {
+        done_ = true;
+        clip_.reset();
+        return;
+    }
+    scheduled_ = true;
+}
+
+void ClipStream::produce() {
+    OpenHandler on_open;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_) {
+            scheduled_ = false;
+            clip_.reset();
+            on_open = std::move(on_open_);
+        }
+    }
+    if (!clip_) {
+        if (on_open) on_open(false);
+        return;
+    }
+
+    // The first task opens and probes the segments, so the io thread never touches the disk
+    if (!opened_) {
+        opened_ = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            on_open = std::move(on_open_);
+        }
+        const bool opened = clip_->open();
+        if (on_open) on_open(opened);
+    }
+    auto piece = clip_->next();
+
+    std::function<void()> notify;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        scheduled_ = false;
+        if (closed_) {
+            clip_.reset();
+            return;
+        }
+        if (piece) {
+            pieces_.push_back(std::move(piece));
+        } else {
+            done_ = true;
+            clip_.reset();
+        }
+        if (idle_) {
+            idle_ = false;
+            notify = notify_;
+        }
+        scheduleLocked();
+    }
+    if (notify) notify();
+}
+
+std::shared_ptr<ClipExportPool> ClipExportPool::create(unsigned workers, std::size_t ahead) {
+    std::shared_ptr<ClipExportPool> pool(new ClipExportPool(ahead));
+    for (unsigned i = 0; i < std::max(1u, workers); ++i) {
+        pool->workers_.emplace_back(&ClipExportPool::run, pool.get());
+    }
+    return pool;
+}
+
+ClipExportPool::ClipExportPool(std::size_t ahead)
+    : ahead_(ahead)
+{
+}
+
+ClipExportPool::~ClipExportPool() {
+    stop();
+}
+
+std::shared_ptr<ClipStream> ClipExportPool::start(std::unique_ptr<ClipExport> clip, ClipStream::OpenHandler on_open) {
+    auto stream = std::make_shared<ClipStream>(std::move(clip), weak_from_this(), ahead_, std::move(on_open));
+    std::lock_guard<std::mutex> lock(stream->mutex_);
+    stream->scheduleLocked();
+    return stream->done_ ? nullptr : stream;
+}
+
+void ClipExportPool::stop() {
+    std::deque<std::shared_ptr<ClipStream>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) return;
+        stopping_ = true;
+        dropped.swap(jobs_);
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker.joinable()) worker.join();
+    }
+    // Readers still waiting on these get the end of the body
+    for (auto& stream : dropped) {
+        std::function<void()> notify;
+        ClipStream::OpenHandler on_open;
+        {
+            std::lock_guard<std::mutex> lock(stream->mutex_);
+            stream->scheduled_ = false;
+            stream->done_ = true;
+            stream->idle_ = false;
+            stream->clip_.reset();
+            notify = stream->notify_;
+            on_open = std::move(stream->on_open_);
+        }
+        if (on_open) on_open(false);
+        if (notify) notify();
+    }
+}
+
+bool ClipExportPool::submit(std::shared_ptr<ClipStream> stream) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) return false;
+        jobs_.push_back(std::move(stream));
+    }
+    wake_.notify_one();
+    return true;
+}
+
+void ClipExportPool::run() {
+    while (true) {
+        std::shared_ptr<ClipStream> stream;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) return;
+            stream = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        stream->produce();
+    }
+}
+
+} // namespace buksan
@@ -0,0 +1,177 @@
+#ifndef CLIPEXPORT_H
+#define CLIPEXPORT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+struct AVFormatContext;
+struct AVPacket;
+struct AVStream;
+
+namespace buksan {
+
+enum class ClipFormat {
+    Mp4,
+    Matroska
+};
+
+bool parseClipFormat(const std::string& value, ClipFormat& format);
+const char* clipContentType(ClipFormat format);
+const char* clipExtension(ClipFormat format);
+
+struct ClipSegment {
+    std::string path;
+    // Wall-clock time of the segment's first packet
+    std::int64_t start_unix{0};
+};
+
+// One continuous clip cut from recorded segments without decoding: packets are copied into a
+// single streamable MP4 (fragmented) or Matroska file in memory, a piece at a time, so the
+// caller sends the file while it is produced and the reader's pace limits how much is read.
+// The clip starts at the last keyframe at or before from_unix and ends before the first
+// keyframe at or after to_unix; gaps between segments are closed up.
+class ClipExport {
+public:
+    // Segments in time order. Nothing is read until open().
+    ClipExport(std::vector<ClipSegment> segments, std::int64_t from_unix, std::int64_t to_unix,
+               ClipFormat format);
+    ~ClipExport();
+
+    ClipExport(const ClipExport&) = delete;
+    ClipExport& operator=(const ClipExport&) = delete;
+
+    // Opens and probes segments up to the first readable one; false when none can be read
+    bool open();
+    // Next piece of the file, nullptr once it is complete. A read or write error ends the file early.
+    std::shared_ptr<const std::string> next();
+
+private:
+    // Opens segments from next_segment_ on until one can be added to the clip
+    bool openNextSegment();
+    bool openSegment(const ClipSegment& segment, bool seek);
+    void createOutput(const AVStream* input);
+    // False when the clip is complete
+    bool copyPacket();
+    void closeInput();
+    void releaseOutput();
+
+    std::vector<ClipSegment> segments_;
+    std::int64_t from_unix_;
+    std::int64_t to_unix_;
+    ClipFormat format_;
+    std::size_t next_segment_{0};
+
+    AVFormatContext* input_{nullptr};
+    int input_stream_{-1};
+    std::int64_t segment_start_unix_{0};
+    std::int64_t segment_origin_{0};
+    // First timestamp copied from the current segment; it lands on offset_
+    std::int64_t segment_base_{AV_NOPTS_VALUE};
+    // Set when seeking failed: packets before it are skipped (input time base)
+    std::int64_t skip_until_{AV_NOPTS_VALUE};
+    AVPacket* packet_{nullptr};
+
+    AVFormatContext* output_{nullptr};
+    AVStream* output_stream_{nullptr};
+    // Output time base
+    std::int64_t offset_{0};
+    std::int64_t end_{0};
+    std::int64_t last_dts_{AV_NOPTS_VALUE};
+    bool started_{false};
+    bool done_{false};
+    bool finished_{false};
+    std::string out_;
+};
+
+class ClipExportPool;
+
+// A clip being produced by a ClipExportPool. The reader only takes finished pieces, so reading
+// never waits for the disk or the remux.
+class ClipStream : public std::enable_shared_from_this<ClipStream> {
+public:
+    // Called once on a pool worker after the first task opened the clip, with false when it could
+    // not be (or the clip ended before that); the response headers depend on it
+    using OpenHandler = std::function<void(bool opened)>;
+
+    ClipStream(std::unique_ptr<ClipExport> clip, std::weak_ptr<ClipExportPool> pool, std::size_t ahead,
+               OpenHandler on_open = nullptr);
+
+    // Next finished piece. nullptr with finished unset means none is ready yet: the notifier
+    // is called once there is one (or the clip has ended).
+    std::shared_ptr<const std::string> next(bool& finished);
+    void setNotifier(std::function<void()> notify);
+    // The reader is gone; production stops after the piece in progress
+    void close();
+
+private:
+    friend class ClipExportPool;
+
+    // Caller holds mutex_
+    void scheduleLocked();
+    // Runs on a pool worker: produces one piece
+    void produce();
+
+    std::weak_ptr<ClipExportPool> pool_;
+    const std::size_t ahead_;
+    std::mutex mutex_;
+    // Only touched by the worker while scheduled_ is set
+    std::unique_ptr<ClipExport> clip_;
+    std::deque<std::shared_ptr<const std::string>> pieces_;
+    std::function<void()> notify_;
+    OpenHandler on_open_;
+    // Worker only, like clip_
+    bool opened_{false};
+    bool scheduled_{false};
+    bool done_{false};
+    bool closed_{false};
+    // The reader found nothing and waits for the notifier
+    bool idle_{false};
+};
+
+// Remuxes clips on a few worker threads instead of the HTTP io threads. Clips take turns a
+// piece at a time, and each keeps at most `ahead` pieces waiting, so a slow reader still
+// holds back its clip without stalling the others.
+class ClipExportPool : public std::enable_shared_from_this<ClipExportPool> {
+public:
+    static std::shared_ptr<ClipExportPool> create(unsigned workers = 2, std::size_t ahead = 4);
+    ~ClipExportPool();
+
+    ClipExportPool(const ClipExportPool&) = delete;
+    ClipExportPool& operator=(const ClipExportPool&) = delete;
+
+    // Queues the clip's first task right away; nullptr once stopping
+    std::shared_ptr<ClipStream> start(std::unique_ptr<ClipExport> clip, ClipStream::OpenHandler on_open = nullptr);
+    // Joins the workers and ends the clips still queued. Call it before the last reference goes:
+    // a clip may otherwise release the pool on one of its own workers.
+    void stop();
+
+private:
+    friend class ClipStream;
+
+    explicit ClipExportPool(std::size_t ahead);
+    // False once stopping
+    bool submit(std::shared_ptr<ClipStream> stream);
+    void run();
+
+    const std::size_t ahead_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::shared_ptr<ClipStream>> jobs_;
+    bool stopping_{false};
+    std::vector<std::thread> workers_;
+};
+
+} // namespace buksan
+
+#endif // CLIPEXPORT_H
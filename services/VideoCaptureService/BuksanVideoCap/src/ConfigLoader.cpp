@@ -1,9 +1,128 @@
 #include "ConfigLoader.h"
 #include <yaml-cpp/yaml.h>
 #include <fstream>
+#include <stdexcept>
 
 namespace buksan {
 
+bool parseRecordMode(const std::string& value, RecordMode& mode) {
+    if (value == "transcode") {
+        mode = RecordMode::Transcode;
+        return true;
+    }
+    if (value == "passthrough") {
+        mode = RecordMode::Passthrough;
+        return true;
+    }
+    return false;
+}
+
+bool parseRecordTrigger(const std::string& value, RecordTrigger& trigger) {
+    if (value == "continuous") {
+        trigger = RecordTrigger::Continuous;
+        return true;
+    }
+    if (value == "event") {
+        trigger = RecordTrigger::Event;
+        return true;
+    }
+    return false;
+}
+
+bool parseStoragePlacement(const std::string& value, StoragePlacement& placement) {
+    if (value == "per_camera") {
+        placement = StoragePlacement::PerCamera;
+        return true;
+    }
+    if (value == "per_segment") {
+        placement = StoragePlacement::PerSegment;
+        return true;
+    }
+    return false;
+}
+
+namespace {
+
+void loadMotionConfig(const YAML::Node& node, MotionConfig& motion) {
+    if (auto v = node["frame_interval"]) motion.frame_interval = v.as<int>(5);
+    if (auto v = node["analysis_width"]) motion.analysis_width = v.as<int>(320);
+    if (auto v = node["block_size"]) motion.block_size = v.as<int>(8);
+    if (auto v = node["sensitivity"]) motion.sensitivity = v.as<int>(50);
+    if (auto v = node["learning_rate"]) motion.learning_rate = v.as<double>(0.05);
+    if (auto v = node["stop_delay_ms"]) motion.stop_delay_ms = v.as<int>(2000);
+    if (auto zones = node["zones"]) {
+        for (const auto& z : zones) {
+            if (!z.IsSequence() || z.size() != 4) {
+                throw std::runtime_error("motion zone must be [x, y, width, height]");
+            }
+            MotionZoneConfig zone;
+            zone.x = z[0].as<double>();
+            zone.y = z[1].as<double>();
+            zone.width = z[2].as<double>();
+            zone.height = z[3].as<double>();
+            motion.zones.push_back(zone);
+        }
+    }
+}
+
+void loadSegmentIoConfig(const YAML::Node& node, SegmentIoConfig& io) {
+    if (auto v = node["preallocate"]) io.preallocate = v.as<bool>(false);
+    if (auto v = node["buffer_kb"]) io.buffer_kb = v.as<int>(0);
+    if (auto v = node["direct_io"]) io.direct_io = v.as<bool>(false);
+    if (auto v = node["sync_interval_ms"]) io.sync_interval_ms = v.as<int>(0);
+}
+
+void loadEncoderConfig(const YAML::Node& node, EncoderConfig& encoder) {
+    if (auto v = node["workers"]) encoder.workers = v.as<int>(0);
+    if (auto v = node["codec"]) encoder.codec = v.as<std::string>();
+    if (auto v = node["preset"]) encoder.preset = v.as<std::string>();
+    if (auto v = node["tune"]) encoder.tune = v.as<std::string>();
+    if (auto v = node["crf"]) encoder.crf = v.as<int>(23);
+    if (auto v = node["bitrate_kbps"]) encoder.bitrate_kbps = v.as<int>(0);
+    if (auto v = node["threads"]) encoder.threads = v.as<int>(1);
+    if (auto v = node["gop_sec"]) encoder.gop_sec = v.as<int>(2);
+    if (auto v = node["queue_frames"]) encoder.queue_frames = v.as<int>(8);
+}
+
+void loadThumbnailConfig(const YAML::Node& node, ThumbnailConfig& thumbnails) {
+    if (auto v = node["cache_dir"]) thumbnails.cache_dir = v.as<std::string>();
+    if (auto widths = node["widths"]) {
+        thumbnails.widths.clear();
+        for (const auto& w : widths) {
+            const int width = w.as<int>(0);
+            if (width > 0) thumbnails.widths.push_back(width);
+        }
+        if (thumbnails.widths.empty()) thumbnails.widths.push_back(160);
+    }
+    if (auto v = node["interval_sec"]) thumbnails.interval_sec = v.as<int>(10);
+    if (auto v = node["columns"]) thumbnails.columns = v.as<int>(20);
+    if (auto v = node["max_tiles"]) thumbnails.max_tiles = v.as<int>(720);
+    if (auto v = node["jpeg_quality"]) thumbnails.jpeg_quality = v.as<int>(75);
+    if (auto v = node["memory_mb"]) thumbnails.memory_mb = v.as<int>(64);
+    if (auto v = node["disk_mb"]) thumbnails.disk_mb = v.as<int>(1024);
+    if (auto v = node["workers"]) thumbnails.workers = v.as<int>(2);
+}
+
+void loadLiveConfig(const YAML::Node& node, LiveConfig& live) {
+    if (auto v = node["max_viewers"]) live.max_viewers = v.as<int>(16);
+    if (auto v = node["viewer_buffer_kb"]) live.viewer_buffer_kb = v.as<int>(4096);
+}
+
+void loadRetentionQuota(const YAML::Node& node, RetentionQuota& quota) {
+    if (auto v = node["max_bytes"]) quota.max_bytes = v.as<std::uint64_t>(0);
+    if (auto v = node["max_age_days"]) quota.max_age_days = v.as<int>(0);
+}
+
+void loadRetentionConfig(const YAML::Node& node, RetentionConfig& retention) {
+    loadRetentionQuota(node, retention.quota);
+    if (auto v = node["min_free_bytes"]) retention.min_free_bytes = v.as<std::uint64_t>(0);
+    if (auto v = node["check_interval_sec"]) retention.check_interval_sec = v.as<int>(30);
+    if (auto v = node["max_deletes_per_sec"]) retention.max_deletes_per_sec = v.as<int>(20);
+    if (auto v = node["delete_batch"]) retention.delete_batch = v.as<int>(16);
+}
+
+} // namespace
+
 ConfigLoader::ConfigLoader(const std::string& path) {
     try {
         YAML::Node root = YAML::LoadFile(path);
@@ -12,15 +131,80 @@ ConfigLoader::ConfigLoader(const std::string& path) {
             return;
         }
         if (auto sp = root["storage_path"]) {
-            config_.storage_path = sp.as<std::string>();
+            if (sp.IsSequence()) {
+                for (const auto& volume : sp) config_.storage_volumes.push_back(volume.as<std::string>());
+            } else {
+                config_.storage_volumes.push_back(sp.as<std::string>());
+            }
+            if (!config_.storage_volumes.empty()) config_.storage_path = config_.storage_volumes.front();
+        }
+        if (auto placement = root["storage_placement"]) {
+            if (!parseStoragePlacement(placement.as<std::string>(), config_.storage_placement)) {
+                error_ = "Unknown storage_placement '" + placement.as<std::string>() + "'";
+                return;
+            }
+        }
+        if (auto reserve = root["storage_reserve_bytes"]) {
+            config_.storage_reserve_bytes = reserve.as<std::uint64_t>(0);
+        }
+        if (auto retention = root["retention"]) loadRetentionConfig(retention, config_.retention);
+        if (auto log = root["log"]) {
+            if (auto level = log["level"]) {
+                if (!parseLogLevel(level.as<std::string>(), config_.log.level)) {
+                    error_ = "Unknown log level '" + level.as<std::string>() + "'";
+                    return;
+                }
+            }
+            if (auto format = log["format"]) {
+                if (!parseLogFormat(format.as<std::string>(), config_.log.format)) {
+                    error_ = "Unknown log format '" + format.as<std::string>() + "'";
+                    return;
+                }
+            }
+            if (auto repeat = log["repeat_interval_sec"]) {
+                config_.log.repeatInterval = std::chrono::seconds(repeat.as<int>(30));
+            }
         }
+        if (auto encoder = root["encoder"]) loadEncoderConfig(encoder, config_.encoder);
+        if (auto thumbnails = root["thumbnails"]) loadThumbnailConfig(thumbnails, config_.thumbnails);
         if (auto cam = root["cameras"]) {
             for (const auto& c : cam) {
                 CameraConfig cc;
                 if (auto id = c["id"]) cc.id = id.as<std::string>();
                 if (auto url = c["rtsp_url"]) cc.rtsp_url = url.as<std::string>();
+                if (auto sub = c["sub_rtsp_url"]) cc.sub_rtsp_url = sub.as<std::string>();
                 if (auto rec = c["record"]) cc.record = rec.as<bool>(true);
                 if (auto an = c["analytics"]) cc.analytics = an.as<bool>(false);
+                if (auto mode = c["record_mode"]) {
+                    if (!parseRecordMode(mode.as<std::string>(), cc.record_mode)) {
+                        error_ = "Unknown record_mode '" + mode.as<std::string>() + "' for camera " + cc.id;
+                        return;
+                    }
+                }
+                if (auto overshoot = c["segment_max_overshoot_sec"]) {
+                    cc.segment_max_overshoot_sec = overshoot.as<int>(10);
+                }
+                if (auto width = c["transcode_width"]) cc.transcode_width = width.as<int>(0);
+                if (auto depth = c["queue_depth"]) cc.queue_depth = depth.as<int>(0);
+                if (auto trigger = c["record_trigger"]) {
+                    if (!parseRecordTrigger(trigger.as<std::string>(), cc.record_trigger)) {
+                        error_ = "Unknown record_trigger '" + trigger.as<std::string>() + "' for camera " + cc.id;
+                        return;
+                    }
+                }
+                if (auto pre = c["pre_event_sec"]) cc.pre_event_sec = pre.as<int>(10);
+                if (auto preBytes = c["pre_event_max_bytes"]) cc.pre_event_max_bytes = preBytes.as<int>(32 * 1024 * 1024);
+                if (auto post = c["post_event_sec"]) cc.post_event_sec = post.as<int>(30);
+                if (auto motion = c["motion"]) loadMotionConfig(motion, cc.motion);
+                if (auto retention = c["retention"]) loadRetentionQuota(retention, cc.retention);
+                if (auto io = c["segment_io"]) loadSegmentIoConfig(io, cc.segment_io);
+                if (auto live = c["live"]) loadLiveConfig(live, cc.live);
+                if (cc.record_trigger == RecordTrigger::Event && cc.record_mode == RecordMode::Transcode &&
+                    cc.pre_event_sec > 0) {
+                    // Only compressed packets are buffered; decoded frames would cost far more memory
+                    warnings_.push_back("camera " + cc.id + ": pre_event_sec is ignored in transcode mode, "
+                                        "event recordings start at the event");
+                }
                 config_.cameras.push_back(std::move(cc));
             }
         }
@@ -1,20 +1,149 @@
 #ifndef CONFIGLOADER_H
 #define CONFIGLOADER_H
 
+#include "utils/Logger.h"
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace buksan {
 
+enum class RecordMode {
+    Transcode,
+    Passthrough
+};
+
+bool parseRecordMode(const std::string& value, RecordMode& mode);
+
+enum class RecordTrigger {
+    Continuous,
+    Event
+};
+
+bool parseRecordTrigger(const std::string& value, RecordTrigger& trigger);
+
+enum class StoragePlacement {
+    PerCamera,
+    PerSegment
+};
+
+bool parseStoragePlacement(const std::string& value, StoragePlacement& placement);
+
+struct MotionZoneConfig {
+    double x{0.0};
+    double y{0.0};
+    double width{1.0};
+    double height{1.0};
+};
+
+struct MotionConfig {
+    int frame_interval{5};
+    int analysis_width{320};
+    int block_size{8};
+    int sensitivity{50};
+    double learning_rate{0.05};
+    int stop_delay_ms{2000};
+    std::vector<MotionZoneConfig> zones;
+};
+
+// 0 disables the corresponding limit
+struct RetentionQuota {
+    std::uint64_t max_bytes{0};
+    int max_age_days{0};
+};
+
+struct RetentionConfig {
+    RetentionQuota quota;
+    std::uint64_t min_free_bytes{0};
+    int check_interval_sec{30};
+    int max_deletes_per_sec{20};
+    int delete_batch{16};
+};
+
+// Passthrough segment writing; with everything off libavformat writes the file itself
+struct SegmentIoConfig {
+    bool preallocate{false};
+    int buffer_kb{0};
+    bool direct_io{false};
+    int sync_interval_ms{0};
+
+    bool enabled() const { return preallocate || buffer_kb > 0 || direct_io || sync_interval_ms > 0; }
+};
+
+// Software encoding for record_mode: transcode, shared by all cameras
+struct EncoderConfig {
+    // 0 uses half the cores
+    int workers{0};
+    std::string codec{"libx264"};
+    std::string preset{"veryfast"};
+    // Empty leaves the encoder default
+    std::string tune;
+    int crf{23};
+    // > 0 switches from constant quality (crf) to this bitrate
+    int bitrate_kbps{0};
+    // Threads inside one encoder
+    int threads{1};
+    int gop_sec{2};
+    // Frames waiting per camera before new ones are dropped
+    int queue_frames{8};
+};
+
+// Timeline thumbnails of recordings, built on first request
+struct ThumbnailConfig {
+    // Empty puts the disk cache under <storage_path>/.thumbnails
+    std::string cache_dir;
+    // Tile widths a client may ask for; the nearest one is used
+    std::vector<int> widths{160, 320};
+    int interval_sec{10};
+    // Tiles per row of a range sheet; a longer range spaces its tiles out to stay under max_tiles
+    int columns{20};
+    int max_tiles{720};
+    int jpeg_quality{75};
+    int memory_mb{64};
+    int disk_mb{1024};
+    // Threads that build sprites and sheets, off the HTTP io threads
+    int workers{2};
+};
+
+struct LiveConfig {
+    // 0 removes the limit
+    int max_viewers{16};
+    // A viewer further behind than this is disconnected
+    int viewer_buffer_kb{4096};
+};
+
 struct CameraConfig {
     std::string id;
     std::string rtsp_url;
+    // Low-resolution stream for analytics; empty analyzes the main stream
+    std::string sub_rtsp_url;
     bool record{true};
     bool analytics{false};
+    RecordMode record_mode{RecordMode::Transcode};
+    int segment_max_overshoot_sec{10};
+    // Transcode only: scale recordings down to this width (0 keeps the camera's)
+    int transcode_width{0};
+    int queue_depth{0};
+    RecordTrigger record_trigger{RecordTrigger::Continuous};
+    int pre_event_sec{10};
+    int pre_event_max_bytes{32 * 1024 * 1024};
+    int post_event_sec{30};
+    MotionConfig motion;
+    RetentionQuota retention;
+    SegmentIoConfig segment_io;
+    LiveConfig live;
 };
 
 struct AppConfig {
+    // First of storage_volumes; holds the metadata queue
     std::string storage_path;
+    std::vector<std::string> storage_volumes;
+    StoragePlacement storage_placement{StoragePlacement::PerCamera};
+    std::uint64_t storage_reserve_bytes{0};
+    RetentionConfig retention;
+    LogOptions log;
+    EncoderConfig encoder;
+    ThumbnailConfig thumbnails;
     std::vector<CameraConfig> cameras;
 };
 
@@ -25,11 +154,14 @@ public:
     const AppConfig& config() const { return config_; }
     bool loaded() const { return loaded_; }
     std::string error() const { return error_; }
+    // Settings that load but will not act as written; logged once the logger is configured
+    const std::vector<std::string>& warnings() const { return warnings_; }
 
 private:
     AppConfig config_;
     bool loaded_{false};
     std::string error_;
+    std::vector<std::string> warnings_;
 };
 
 } // namespace buksan
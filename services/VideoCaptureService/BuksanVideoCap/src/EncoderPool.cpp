@@ -0,0 +1,292 @@
+#include "EncoderPool.h"
+#include "utils/Logger.h"
+#include "utils/Metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+namespace buksan {
+
+namespace {
+// Frames one worker encodes for a camera before moving on to the next one
+const std::size_t encode_batch = 4;
+
+std::runtime_error encoderError(const std::string& what) {
+    return std::runtime_error("EncoderPool: " + what);
+}
+}
+
+struct EncoderPool::Stream {
+    explicit Stream(const std::string& cameraId)
+        : camera_id(cameraId)
+        , encode_seconds(metrics().histogram("buksan_encode_seconds",
+                                             "Time to encode one frame", {{"camera", cameraId}}))
+        , dropped(metrics().counter("buksan_encoder_dropped_frames_total",
+                                    "Frames dropped because the encoder pool fell behind", {{"camera", cameraId}}))
+    {
+    }
+
+    ~Stream() {
+        sws_freeContext(sws);
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        avcodec_free_context(&codec);
+    }
+
+    std::string camera_id;
+    Histogram& encode_seconds;
+    Counter& dropped;
+    AVCodecContext* codec{nullptr};
+    AVFrame* frame{nullptr};
+    AVPacket* packet{nullptr};
+    SwsContext* sws{nullptr};
+    std::int64_t next_pts{0};
+    StreamInfo info;
+    PacketSink sink;
+
+    // Guarded by the pool mutex
+    std::deque<cv::Mat> frames;
+    bool queued{false};
+    bool busy{false};
+    bool closing{false};
+};
+
+EncoderPool::EncoderPool(const EncoderConfig& config)
+    : config_(config)
+{
+    unsigned workers = config_.workers > 0 ? static_cast<unsigned>(config_.workers) : 0;
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency() / 2);
+    }
+    workers_.reserve(workers);
+    for (unsigned i = 0; i < workers; ++i) {
+        workers_.emplace_back(&EncoderPool::workerLoop, this);
+    }
+}
+
+EncoderPool::~EncoderPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_cv_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+EncoderPool::StreamHandle EncoderPool::open(const std::string& cameraId, double fps, cv::Size frameSize,
+                                            int targetWidth, PacketSink sink) {
+    if (fps <= 0.0 || frameSize.width <= 0 || frameSize.height <= 0) {
+        throw encoderError("invalid fps or frame size");
+    }
+    const AVCodec* encoder = avcodec_find_encoder_by_name(config_.codec.c_str());
+    if (!encoder) {
+        throw encoderError("encoder '" + config_.codec + "' is not available");
+    }
+
+    int width = frameSize.width;
+    int height = frameSize.height;
+    if (targetWidth > 0 && targetWidth < width) {
+        height = std::max(2, height * targetWidth / width);
+        width = targetWidth;
+    }
+    // 4:2:0 needs even dimensions
+    width &= ~1;
+    height &= ~1;
+
+    auto stream = std::make_shared<Stream>(cameraId);
+    stream->sink = std::move(sink);
+    stream->codec = avcodec_alloc_context3(encoder);
+    stream->frame = av_frame_alloc();
+    stream->packet = av_packet_alloc();
+    if (!stream->codec || !stream->frame || !stream->packet) {
+        throw encoderError("cannot allocate encoder");
+    }
+
+    AVCodecContext* codec = stream->codec;
+    const AVRational frameRate = av_d2q(fps, 1000);
+    codec->width = width;
+    codec->height = height;
+    codec->pix_fmt = AV_PIX_FMT_YUV420P;
+    codec->framerate = frameRate;
+    codec->time_base = av_inv_q(frameRate);
+    codec->gop_size = std::max(1, static_cast<int>(std::lround(fps * std::max(1, config_.gop_sec))));
+    codec->thread_count = std::max(1, config_.threads);
+    // Matroska keeps SPS/PPS in the header rather than in every keyframe
+    codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    AVDictionary* options = nullptr;
+    if (!config_.preset.empty()) av_dict_set(&options, "preset", config_.preset.c_str(), 0);
+    if (!config_.tune.empty()) av_dict_set(&options, "tune", config_.tune.c_str(), 0);
+    if (config_.bitrate_kbps > 0) {
+        codec->bit_rate = static_cast<std::int64_t>(config_.bitrate_kbps) * 1000;
+        codec->rc_max_rate = codec->bit_rate;
+        codec->rc_buffer_size = static_cast<int>(codec->bit_rate);
+    } else {
+        av_dict_set(&options, "crf", std::to_string(config_.crf).c_str(), 0);
+    }
+    const int opened = avcodec_open2(codec, encoder, &options);
+    av_dict_free(&options);
+    if (opened < 0) {
+        throw encoderError("cannot open encoder '" + config_.codec + "'");
+    }
+
+    stream->frame->format = codec->pix_fmt;
+    stream->frame->width = codec->width;
+    stream->frame->height = codec->height;
+    if (av_frame_get_buffer(stream->frame, 0) < 0) {
+        throw encoderError("cannot allocate frame");
+    }
+
+    AVCodecParameters* params = avcodec_parameters_alloc();
+    if (!params || avcodec_parameters_from_context(params, codec) < 0) {
+        avcodec_parameters_free(&params);
+        throw encoderError("cannot read encoder parameters");
+    }
+    stream->info.codecParameters = std::shared_ptr<AVCodecParameters>(params, [](AVCodecParameters* p) {
+        avcodec_parameters_free(&p);
+    });
+    stream->info.timeBase = codec->time_base;
+    stream->info.fps = fps;
+    stream->info.width = codec->width;
+    stream->info.height = codec->height;
+    return stream;
+}
+
+StreamInfo EncoderPool::streamInfo(const StreamHandle& stream) const {
+    return stream ? stream->info : StreamInfo{};
+}
+
+bool EncoderPool::submit(const StreamHandle& stream, const cv::Mat& frame) {
+    if (!stream || frame.empty()) return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stream->closing) return false;
+        if (stream->frames.size() >= static_cast<std::size_t>(std::max(1, config_.queue_frames))) {
+            stream->dropped.inc();
+            return false;
+        }
+        stream->frames.push_back(frame);
+        if (stream->queued || stream->busy) return true;
+        stream->queued = true;
+        ready_.push_back(stream);
+    }
+    ready_cv_.notify_one();
+    return true;
+}
+
+void EncoderPool::close(const StreamHandle& stream) {
+    if (!stream) return;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stream->closing) return;
+        stream->closing = true;
+        // The workers finish the queue; after that nobody else touches the encoder
+        idle_.wait(lock, [&] { return stream->frames.empty() && !stream->busy && !stream->queued; });
+    }
+
+    // Delayed frames (lookahead, B-frames) come out only once the encoder is told the input ended
+    if (avcodec_send_frame(stream->codec, nullptr) == 0) {
+        drainPackets(*stream);
+    }
+    avcodec_free_context(&stream->codec);
+}
+
+void EncoderPool::encode(Stream& stream, const cv::Mat& frame) {
+    ScopedTimer timer(stream.encode_seconds);
+    AVCodecContext* codec = stream.codec;
+    stream.sws = sws_getCachedContext(stream.sws,
+                                      frame.cols, frame.rows, AV_PIX_FMT_BGR24,
+                                      codec->width, codec->height, codec->pix_fmt,
+                                      SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!stream.sws || frame.type() != CV_8UC3 || av_frame_make_writable(stream.frame) < 0) {
+        stream.dropped.inc();
+        return;
+    }
+    const uint8_t* src[1] = {frame.data};
+    const int srcStride[1] = {static_cast<int>(frame.step[0])};
+    sws_scale(stream.sws, src, srcStride, 0, frame.rows, stream.frame->data, stream.frame->linesize);
+
+    stream.frame->pts = stream.next_pts++;
+    if (avcodec_send_frame(codec, stream.frame) < 0) {
+        stream.dropped.inc();
+        return;
+    }
+    drainPackets(stream);
+}
+
+void EncoderPool::drainPackets(Stream& stream) {
+    while (avcodec_receive_packet(stream.codec, stream.packet) == 0) {
+        AVPacket* pkt = av_packet_alloc();
+        if (!pkt) {
+            av_packet_unref(stream.packet);
+            continue;
+        }
+        av_packet_move_ref(pkt, stream.packet);
+
+        MediaPacket packet;
+        packet.keyframe = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+        packet.pts = pkt->pts;
+        packet.dts = pkt->dts;
+        packet.timeBase = stream.codec->time_base;
+        packet.received = std::chrono::steady_clock::now();
+        packet.data = std::shared_ptr<const AVPacket>(pkt, [](const AVPacket* p) {
+            AVPacket* owned = const_cast<AVPacket*>(p);
+            av_packet_free(&owned);
+        });
+        if (stream.sink) {
+            try {
+                stream.sink(packet);
+            } catch (const std::exception& e) {
+                logError(stream.camera_id) << "encoded packet not written: " << e.what();
+            }
+        }
+    }
+}
+
+void EncoderPool::workerLoop() {
+    std::vector<cv::Mat> batch;
+    batch.reserve(encode_batch);
+    while (true) {
+        StreamHandle stream;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_cv_.wait(lock, [this] { return stopping_ || !ready_.empty(); });
+            if (stopping_) return;
+            stream = std::move(ready_.front());
+            ready_.pop_front();
+            stream->queued = false;
+            stream->busy = true;
+            while (!stream->frames.empty() && batch.size() < encode_batch) {
+                batch.push_back(std::move(stream->frames.front()));
+                stream->frames.pop_front();
+            }
+        }
+
+        for (const auto& frame : batch) {
+            encode(*stream, frame);
+        }
+        batch.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stream->busy = false;
+            if (!stream->frames.empty()) {
+                // Back of the line, behind the cameras that have been waiting
+                stream->queued = true;
+                ready_.push_back(stream);
+                ready_cv_.notify_one();
+            }
+        }
+        idle_.notify_all();
+    }
+}
+
+} // namespace buksan
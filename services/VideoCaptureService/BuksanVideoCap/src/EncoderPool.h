@@ -0,0 +1,67 @@
+#ifndef ENCODERPOOL_H
+#define ENCODERPOOL_H
+
+#include "ConfigLoader.h"
+#include "MediaPacket.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace buksan {
+
+// Encodes the frames of every transcoding camera on a fixed set of threads.
+// Each camera gets its own software encoder (x264/x265 with the configured preset, tune and rate
+// control) and a short frame queue; workers take cameras round robin and encode a few frames at
+// a time, so the transcoding load stays within workers * threads cores however many cameras
+// need it. Frames arriving while a camera's queue is full are dropped.
+class EncoderPool {
+public:
+    struct Stream;
+    using StreamHandle = std::shared_ptr<Stream>;
+    // Called on a worker thread (and on the closing thread for the final packets), in encode order.
+    // Workers are shared by every camera, so the sink only hands the packet off and must not block.
+    using PacketSink = std::function<void(const MediaPacket&)>;
+
+    explicit EncoderPool(const EncoderConfig& config);
+    ~EncoderPool();
+
+    EncoderPool(const EncoderPool&) = delete;
+    EncoderPool& operator=(const EncoderPool&) = delete;
+
+    // Opens an encoder for frames of about frameSize; targetWidth > 0 scales down keeping aspect.
+    // Throws when the codec is unavailable or rejects the settings.
+    StreamHandle open(const std::string& cameraId, double fps, cv::Size frameSize, int targetWidth,
+                      PacketSink sink);
+    // What the encoder produces, for the muxer
+    StreamInfo streamInfo(const StreamHandle& stream) const;
+    // False when the frame was dropped
+    bool submit(const StreamHandle& stream, const cv::Mat& frame);
+    // Encodes what is still queued, flushes the encoder into the sink and frees it
+    void close(const StreamHandle& stream);
+
+    unsigned workerCount() const { return static_cast<unsigned>(workers_.size()); }
+
+private:
+    void workerLoop();
+    void encode(Stream& stream, const cv::Mat& frame);
+    void drainPackets(Stream& stream);
+
+    EncoderConfig config_;
+    std::mutex mutex_;
+    std::condition_variable ready_cv_;
+    std::condition_variable idle_;
+    // Streams with queued frames that no worker is serving
+    std::deque<StreamHandle> ready_;
+    bool stopping_{false};
+    std::vector<std::thread> workers_;
+};
+
+} // namespace buksan
+
+#endif // ENCODERPOOL_H
@@ -0,0 +1,101 @@
+#include "FrameDecoder.h"
+#include <algorithm>
+#include <stdexcept>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+namespace buksan {
+
+FrameDecoder::FrameDecoder(const StreamInfo& stream, int targetWidth, bool grayscale)
+    : target_width_(targetWidth)
+    , grayscale_(grayscale)
+{
+    if (!stream.codecParameters) {
+        throw std::runtime_error("FrameDecoder: missing codec parameters");
+    }
+    const AVCodec* decoder = avcodec_find_decoder(stream.codecParameters->codec_id);
+    if (!decoder) {
+        throw std::runtime_error("FrameDecoder: no decoder for stream codec");
+    }
+    codec_ = avcodec_alloc_context3(decoder);
+    frame_ = av_frame_alloc();
+    if (!codec_ || !frame_ || avcodec_parameters_to_context(codec_, stream.codecParameters.get()) < 0) {
+        av_frame_free(&frame_);
+        avcodec_free_context(&codec_);
+        throw std::runtime_error("FrameDecoder: cannot allocate decoder");
+    }
+    codec_->pkt_timebase = stream.timeBase;
+    codec_->thread_count = 1;
+    if (avcodec_open2(codec_, decoder, nullptr) < 0) {
+        av_frame_free(&frame_);
+        avcodec_free_context(&codec_);
+        throw std::runtime_error("FrameDecoder: cannot open decoder");
+    }
+}
+
+FrameDecoder::~FrameDecoder() {
+    sws_freeContext(sws_);
+    av_frame_free(&frame_);
+    avcodec_free_context(&codec_);
+}
+
+bool FrameDecoder::decode(const MediaPacket& packet, cv::Mat* out) {
+    if (!packet.data) return false;
+    if (avcodec_send_packet(codec_, packet.data.get()) < 0) return false;
+    return receiveFrames(out);
+}
+
+bool FrameDecoder::decodeKeyframe(const MediaPacket& packet, cv::Mat* out) {
+    if (!packet.data) return false;
+    codec_->skip_frame = AVDISCARD_NONKEY;
+    codec_->skip_loop_filter = AVDISCARD_ALL;
+    bool produced = false;
+    if (avcodec_send_packet(codec_, packet.data.get()) == 0) {
+        produced = receiveFrames(out);
+        // A decoder with reordering delay holds the picture back until told nothing more comes
+        if (!produced && avcodec_send_packet(codec_, nullptr) == 0) {
+            produced = receiveFrames(out);
+        }
+    }
+    avcodec_flush_buffers(codec_);
+    return produced;
+}
+
+bool FrameDecoder::receiveFrames(cv::Mat* out) {
+    bool produced = false;
+    while (avcodec_receive_frame(codec_, frame_) == 0) {
+        produced = true;
+        if (!out) {
+            av_frame_unref(frame_);
+            continue;
+        }
+
+        int width = frame_->width;
+        int height = frame_->height;
+        if (target_width_ > 0 && target_width_ < width) {
+            height = std::max(1, height * target_width_ / width);
+            width = target_width_;
+        }
+        const AVPixelFormat dstFormat = grayscale_ ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_BGR24;
+        sws_ = sws_getCachedContext(sws_,
+                                    frame_->width, frame_->height, static_cast<AVPixelFormat>(frame_->format),
+                                    width, height, dstFormat,
+                                    SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+        if (sws_) {
+            out->create(height, width, grayscale_ ? CV_8UC1 : CV_8UC3);
+            uint8_t* dst[1] = {out->data};
+            int dstStride[1] = {static_cast<int>(out->step[0])};
+            sws_scale(sws_, frame_->data, frame_->linesize, 0, frame_->height, dst, dstStride);
+        } else {
+            produced = false;
+        }
+        av_frame_unref(frame_);
+    }
+    return produced;
+}
+
+} // namespace buksan
@@ -0,0 +1,40 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include "MediaPacket.h"
+#include <opencv2/core.hpp>
+
+struct AVCodecContext;
+struct AVFrame;
+struct SwsContext;
+
+namespace buksan {
+
+class FrameDecoder {
+public:
+    // targetWidth > 0 scales output down (keeping aspect); grayscale keeps only the luma plane.
+    explicit FrameDecoder(const StreamInfo& stream, int targetWidth = 0, bool grayscale = false);
+    ~FrameDecoder();
+
+    FrameDecoder(const FrameDecoder&) = delete;
+    FrameDecoder& operator=(const FrameDecoder&) = delete;
+
+    // Feeds the packet to the decoder; converts the produced picture only when out is given.
+    bool decode(const MediaPacket& packet, cv::Mat* out);
+    // Decodes a keyframe on its own and resets the decoder, so keyframes far apart can be fed
+    // without the packets between them. Deblocking is skipped: the picture is only shown scaled down.
+    bool decodeKeyframe(const MediaPacket& packet, cv::Mat* out);
+
+private:
+    bool receiveFrames(cv::Mat* out);
+
+    AVCodecContext* codec_{nullptr};
+    AVFrame* frame_{nullptr};
+    SwsContext* sws_{nullptr};
+    int target_width_{0};
+    bool grayscale_{false};
+};
+
+} // namespace buksan
+
+#endif // FRAMEDECODER_H
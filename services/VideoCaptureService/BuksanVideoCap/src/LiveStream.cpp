@@ -0,0 +1,348 @@
+#include "LiveStream.h"
+#include "utils/Logger.h"
+#include <algorithm>
+#include <stdexcept>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+namespace buksan {
+
+namespace {
+const int avio_buffer_size = 64 * 1024;
+}
+
+LiveViewer::LiveViewer(std::size_t max_queued_bytes)
+    : max_queued_bytes_(max_queued_bytes)
+{
+}
+
+LiveBuffer LiveViewer::next(bool& finished) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (queue_.empty()) {
+        finished = finished_;
+        idle_ = !finished_;
+        return nullptr;
+    }
+    LiveBuffer buffer = std::move(queue_.front());
+    queue_.pop_front();
+    queued_bytes_ -= buffer->size();
+    finished = false;
+    return buffer;
+}
+
+void LiveViewer::setNotifier(std::function<void()> notify) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    notify_ = std::move(notify);
+}
+
+void LiveViewer::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    finished_ = true;
+    queue_.clear();
+    queued_bytes_ = 0;
+    // Drops the connection the notifier refers to
+    notify_ = nullptr;
+}
+
+bool LiveViewer::dropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
+
+bool LiveViewer::offer(const LiveBuffer& init, const LiveBuffer& fragment, bool keyframe, bool& dropped_now) {
+    std::function<void()> notify;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finished_) return false;
+        if (!started_) {
+            if (!keyframe) return true;
+            started_ = true;
+            queue_.push_back(init);
+            queued_bytes_ += init->size();
+        }
+        if (queued_bytes_ + fragment->size() > max_queued_bytes_) {
+            // A slow client is cut off rather than allowed to hold buffers or stall the camera
+            dropped_ = true;
+            dropped_now = true;
+            finished_ = true;
+            queue_.clear();
+            queued_bytes_ = 0;
+        } else {
+            queue_.push_back(fragment);
+            queued_bytes_ += fragment->size();
+        }
+        if (idle_) {
+            idle_ = false;
+            notify = notify_;
+        }
+    }
+    if (notify) notify();
+    return !dropped_now;
+}
+
+void LiveViewer::finish() {
+    std::function<void()> notify;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finished_) return;
+        // What is queued is still sent before the end
+        finished_ = true;
+        if (idle_) {
+            idle_ = false;
+            notify = notify_;
+        }
+    }
+    if (notify) notify();
+}
+
+bool LiveViewer::active() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !finished_;
+}
+
+// Fragmented MP4 written into memory, one fragment per packet
+class LiveStream::FragmentWriter {
+public:
+    explicit FragmentWriter(const StreamInfo& stream);
+    ~FragmentWriter();
+
+    FragmentWriter(const FragmentWriter&) = delete;
+    FragmentWriter& operator=(const FragmentWriter&) = delete;
+
+    const LiveBuffer& init() const { return init_; }
+    // nullptr when the muxer produced nothing for the packet
+    LiveBuffer write(const MediaPacket& packet);
+
+private:
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+    static int collect(void* opaque, const uint8_t* data, int size);
+#else
+    static int collect(void* opaque, uint8_t* data, int size);
+#endif
+    void release();
+
+    AVFormatContext* format_{nullptr};
+    AVStream* stream_{nullptr};
+    AVRational input_time_base_{1, 90000};
+    std::int64_t first_dts_{AV_NOPTS_VALUE};
+    std::int64_t last_dts_{AV_NOPTS_VALUE};
+    std::string out_;
+    LiveBuffer init_;
+};
+
+LiveStream::FragmentWriter::FragmentWriter(const StreamInfo& stream) {
+    if (!stream.codecParameters) {
+        throw std::runtime_error("no codec parameters");
+    }
+    if (avformat_alloc_output_context2(&format_, nullptr, "mp4", nullptr) < 0 || !format_) {
+        format_ = nullptr;
+        throw std::runtime_error("cannot allocate mp4 muxer");
+    }
+    stream_ = avformat_new_stream(format_, nullptr);
+    if (!stream_ || avcodec_parameters_copy(stream_->codecpar, stream.codecParameters.get()) < 0) {
+        release();
+        throw std::runtime_error("cannot create mp4 stream");
+    }
+    stream_->codecpar->codec_tag = 0;
+    stream_->time_base = stream.timeBase;
+    input_time_base_ = stream.timeBase;
+
+    unsigned char* buffer = static_cast<unsigned char*>(av_malloc(avio_buffer_size));
+    if (buffer) {
+        format_->pb = avio_alloc_context(buffer, avio_buffer_size, 1, this, nullptr, &FragmentWriter::collect, nullptr);
+    }
+    if (!format_->pb) {
+        av_freep(&buffer);
+        release();
+        throw std::runtime_error("cannot create mp4 I/O context");
+    }
+    format_->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    // Empty moov up front; fragments are cut only when asked, which is after every packet
+    AVDictionary* options = nullptr;
+    av_dict_set(&options, "movflags", "empty_moov+default_base_moof+frag_custom", 0);
+    const int rc = avformat_write_header(format_, &options);
+    av_dict_free(&options);
+    if (rc < 0) {
+        release();
+        throw std::runtime_error("codec cannot be carried in fragmented mp4");
+    }
+    avio_flush(format_->pb);
+    init_ = std::make_shared<const std::string>(std::move(out_));
+    out_.clear();
+}
+
+LiveStream::FragmentWriter::~FragmentWriter() {
+    release();
+}
+
+void LiveStream::FragmentWriter::release() {
+    if (!format_) return;
+    if (format_->pb) {
+        av_freep(&format_->pb->buffer);
+        avio_context_free(&format_->pb);
+    }
+    avformat_free_context(format_);
+    format_ = nullptr;
+    stream_ = nullptr;
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int LiveStream::FragmentWriter::collect(void* opaque, const uint8_t* data, int size) {
+#else
+int LiveStream::FragmentWriter::collect(void* opaque, uint8_t* data, int size) {
+#endif
+    auto* writer = static_cast<FragmentWriter*>(opaque);
+    writer->out_.append(reinterpret_cast<const char*>(data), static_cast<std::size_t>(size));
+    return size;
+}
+
+LiveBuffer LiveStream::FragmentWriter::write(const MediaPacket& packet) {
+    AVPacket* out = av_packet_clone(packet.data.get());
+    if (!out) {
+        throw std::runtime_error("packet clone failed");
+    }
+
+    std::int64_t dts = packet.dts != AV_NOPTS_VALUE ? packet.dts : packet.pts;
+    std::int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : dts;
+    if (first_dts_ == AV_NOPTS_VALUE) first_dts_ = dts;
+    dts -= first_dts_;
+    pts -= first_dts_;
+    if (last_dts_ != AV_NOPTS_VALUE && dts <= last_dts_) {
+        dts = last_dts_ + 1;
+    }
+    if (pts < dts) pts = dts;
+    last_dts_ = dts;
+
+    out->dts = dts;
+    out->pts = pts;
+    out->stream_index = stream_->index;
+    out->pos = -1;
+    av_packet_rescale_ts(out, input_time_base_, stream_->time_base);
+
+    out_.reserve(static_cast<std::size_t>(out->size) + 256);
+    int rc = av_write_frame(format_, out);
+    av_packet_free(&out);
+    if (rc >= 0) {
+        // A null packet closes the fragment right away instead of at the next packet
+        rc = av_write_frame(format_, nullptr);
+    }
+    if (rc < 0) {
+        throw std::runtime_error("mp4 fragment write failed");
+    }
+    avio_flush(format_->pb);
+    if (out_.empty()) return nullptr;
+    auto fragment = std::make_shared<const std::string>(std::move(out_));
+    out_.clear();
+    return fragment;
+}
+
+LiveStream::LiveStream(const std::string& camera_id, const LiveConfig& config)
+    : camera_id_(camera_id)
+    , config_(config)
+    , dropped_viewers_(metrics().counter("buksan_live_dropped_viewers_total",
+                                         "Live viewers cut off because they could not keep up", {{"camera", camera_id}}))
+    , viewers_gauge_(metrics().gauge("buksan_live_viewers", "Connected live viewers", {{"camera", camera_id}}))
+{
+}
+
+LiveStream::~LiveStream() {
+    finish();
+}
+
+bool LiveStream::prune() {
+    viewers_.erase(std::remove_if(viewers_.begin(), viewers_.end(),
+                                  [](const std::shared_ptr<LiveViewer>& viewer) { return !viewer->active(); }),
+                   viewers_.end());
+    viewers_gauge_.set(static_cast<double>(viewers_.size()));
+    return !viewers_.empty();
+}
+
+void LiveStream::push(const StreamInfo& stream, const MediaPacket& packet) {
+    if (!packet.data) return;
+
+    std::vector<std::shared_ptr<LiveViewer>> viewers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!finished_ && prune()) viewers = viewers_;
+    }
+    if (viewers.empty()) {
+        // Nobody watches: no muxing at all
+        writer_.reset();
+        writer_params_.reset();
+        return;
+    }
+
+    if (!writer_ || writer_params_ != stream.codecParameters) {
+        if (!packet.keyframe) return;
+        writer_.reset();
+        try {
+            writer_ = std::make_unique<FragmentWriter>(stream);
+            writer_params_ = stream.codecParameters;
+        } catch (const std::exception& e) {
+            logRepeated(LogLevel::Warn, camera_id_, "live") << "live stream unavailable: " << e.what();
+            return;
+        }
+    }
+
+    LiveBuffer fragment;
+    try {
+        fragment = writer_->write(packet);
+    } catch (const std::exception& e) {
+        logRepeated(LogLevel::Warn, camera_id_, "live") << "live stream failed: " << e.what();
+        writer_.reset();
+        writer_params_.reset();
+        return;
+    }
+    if (!fragment) return;
+
+    for (const auto& viewer : viewers) {
+        bool dropped = false;
+        viewer->offer(writer_->init(), fragment, packet.keyframe, dropped);
+        if (dropped) {
+            dropped_viewers_.inc();
+            logRepeated(LogLevel::Warn, camera_id_, "live-slow") << "live viewer dropped: too slow";
+        }
+    }
+}
+
+void LiveStream::reset() {
+    writer_.reset();
+    writer_params_.reset();
+}
+
+std::shared_ptr<LiveViewer> LiveStream::subscribe() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_) return nullptr;
+    prune();
+    if (config_.max_viewers > 0 && viewers_.size() >= static_cast<std::size_t>(config_.max_viewers)) {
+        return nullptr;
+    }
+    auto viewer = std::make_shared<LiveViewer>(static_cast<std::size_t>(std::max(64, config_.viewer_buffer_kb)) * 1024);
+    viewers_.push_back(viewer);
+    viewers_gauge_.set(static_cast<double>(viewers_.size()));
+    return viewer;
+}
+
+void LiveStream::finish() {
+    std::vector<std::shared_ptr<LiveViewer>> viewers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished_ = true;
+        viewers.swap(viewers_);
+        viewers_gauge_.set(0.0);
+    }
+    for (const auto& viewer : viewers) {
+        viewer->finish();
+    }
+}
+
+std::size_t LiveStream::viewerCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return viewers_.size();
+}
+
+} // namespace buksan
@@ -0,0 +1,105 @@
+#ifndef LIVESTREAM_H
+#define LIVESTREAM_H
+
+#include "ConfigLoader.h"
+#include "MediaPacket.h"
+#include "utils/Metrics.h"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace buksan {
+
+using LiveBuffer = std::shared_ptr<const std::string>;
+
+// One client of a camera's live stream. Buffers are shared with every other viewer;
+// the queue only holds references, and a viewer that lets it grow past its limit is dropped.
+class LiveViewer {
+public:
+    explicit LiveViewer(std::size_t max_queued_bytes);
+
+    LiveViewer(const LiveViewer&) = delete;
+    LiveViewer& operator=(const LiveViewer&) = delete;
+
+    // Next buffer to send, or nullptr when none is queued; finished is set once nothing more will come.
+    // After a nullptr the notifier fires when there is something again.
+    LiveBuffer next(bool& finished);
+    // Called from the capture thread; must only schedule the next call to next()
+    void setNotifier(std::function<void()> notify);
+    // The client went away
+    void close();
+
+    bool dropped() const;
+
+private:
+    friend class LiveStream;
+
+    // dropped_now is set when this fragment overflowed the queue and cut the viewer off
+    bool offer(const LiveBuffer& init, const LiveBuffer& fragment, bool keyframe, bool& dropped_now);
+    void finish();
+    // False once the viewer is closed or finished and can be forgotten
+    bool active() const;
+
+    const std::size_t max_queued_bytes_;
+    mutable std::mutex mutex_;
+    std::deque<LiveBuffer> queue_;
+    std::size_t queued_bytes_{0};
+    // A new viewer starts at a keyframe, right after the init segment
+    bool started_{false};
+    bool idle_{false};
+    bool finished_{false};
+    bool dropped_{false};
+    bool closed_{false};
+    std::function<void()> notify_;
+};
+
+// Live fragmented MP4 of one camera, built from the packets the session already reads.
+// Packets are muxed only while someone watches: each one becomes its own fragment (moof+mdat),
+// so a viewer is one frame behind the camera. New viewers get the init segment (ftyp+moov)
+// and then fragments from the next keyframe.
+class LiveStream {
+public:
+    LiveStream(const std::string& camera_id, const LiveConfig& config);
+    ~LiveStream();
+
+    LiveStream(const LiveStream&) = delete;
+    LiveStream& operator=(const LiveStream&) = delete;
+
+    // Capture thread only
+    void push(const StreamInfo& stream, const MediaPacket& packet);
+    // The connection dropped; the next packets may come with different stream parameters
+    void reset();
+
+    // nullptr when the viewer limit is reached or the stream has ended
+    std::shared_ptr<LiveViewer> subscribe();
+    // Ends every viewer's stream; later subscriptions are refused
+    void finish();
+
+    std::size_t viewerCount() const;
+
+private:
+    class FragmentWriter;
+
+    // Forgets finished viewers; true while some are left. Called under mutex_
+    bool prune();
+
+    std::string camera_id_;
+    LiveConfig config_;
+    Counter& dropped_viewers_;
+    Gauge& viewers_gauge_;
+    // Capture thread only
+    std::unique_ptr<FragmentWriter> writer_;
+    std::shared_ptr<AVCodecParameters> writer_params_;
+
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<LiveViewer>> viewers_;
+    bool finished_{false};
+};
+
+} // namespace buksan
+
+#endif // LIVESTREAM_H
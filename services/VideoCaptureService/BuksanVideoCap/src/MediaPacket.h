@@ -0,0 +1,35 @@
+#ifndef MEDIAPACKET_H
+#define MEDIAPACKET_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace buksan {
+
+struct StreamInfo {
+    std::shared_ptr<AVCodecParameters> codecParameters;
+    AVRational timeBase{1, 90000};
+    double fps{25.0};
+    int width{0};
+    int height{0};
+};
+
+struct MediaPacket {
+    std::shared_ptr<const AVPacket> data;
+    bool keyframe{false};
+    std::int64_t pts{AV_NOPTS_VALUE};
+    std::int64_t dts{AV_NOPTS_VALUE};
+    AVRational timeBase{1, 90000};
+    std::chrono::steady_clock::time_point received;
+
+    std::size_t size() const { return data ? static_cast<std::size_t>(data->size) : 0; }
+};
+
+} // namespace buksan
+
+#endif // MEDIAPACKET_H
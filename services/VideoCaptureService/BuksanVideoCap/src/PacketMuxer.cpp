@@ -0,0 +1,177 @@
+#include "PacketMuxer.h"
+#include <cerrno>
+#include <stdexcept>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+namespace buksan {
+
+namespace {
+const int avio_buffer_size = 64 * 1024;
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int writeSegmentFile(void* opaque, const uint8_t* data, int size) {
+#else
+int writeSegmentFile(void* opaque, uint8_t* data, int size) {
+#endif
+    try {
+        static_cast<SegmentFile*>(opaque)->write(data, static_cast<std::size_t>(size));
+        return size;
+    } catch (const std::exception&) {
+        return AVERROR(EIO);
+    }
+}
+
+int64_t seekSegmentFile(void* opaque, int64_t offset, int whence) {
+    auto* file = static_cast<SegmentFile*>(opaque);
+    if (whence & AVSEEK_SIZE) {
+        return static_cast<int64_t>(file->size());
+    }
+    return file->seek(offset, whence & ~AVSEEK_FORCE);
+}
+}
+
+PacketMuxer::~PacketMuxer() {
+    try {
+        close();
+    } catch (...) {
+    }
+}
+
+void PacketMuxer::open(const std::string& path, const StreamInfo& stream,
+                       const std::optional<SegmentFileOptions>& file_options) {
+    close();
+    if (!stream.codecParameters) {
+        throw std::runtime_error("PacketMuxer: missing codec parameters");
+    }
+
+    if (avformat_alloc_output_context2(&format_, nullptr, "matroska", path.c_str()) < 0 || !format_) {
+        format_ = nullptr;
+        throw std::runtime_error("PacketMuxer: cannot allocate output context for " + path);
+    }
+
+    stream_ = avformat_new_stream(format_, nullptr);
+    if (!stream_ || avcodec_parameters_copy(stream_->codecpar, stream.codecParameters.get()) < 0) {
+        avformat_free_context(format_);
+        format_ = nullptr;
+        stream_ = nullptr;
+        throw std::runtime_error("PacketMuxer: cannot create stream for " + path);
+    }
+    stream_->codecpar->codec_tag = 0;
+    stream_->time_base = stream.timeBase;
+    input_time_base_ = stream.timeBase;
+
+    if (file_options) {
+        openSegmentFile(path, *file_options);
+    } else if (avio_open(&format_->pb, path.c_str(), AVIO_FLAG_WRITE) < 0) {
+        avformat_free_context(format_);
+        format_ = nullptr;
+        stream_ = nullptr;
+        throw std::runtime_error("PacketMuxer: cannot open " + path);
+    }
+    if (avformat_write_header(format_, nullptr) < 0) {
+        releaseOutput();
+        throw std::runtime_error("PacketMuxer: cannot write header to " + path);
+    }
+    first_dts_ = AV_NOPTS_VALUE;
+    last_dts_ = AV_NOPTS_VALUE;
+}
+
+std::optional<KeyframePosition> PacketMuxer::write(const MediaPacket& packet) {
+    if (!format_ || !packet.data) return std::nullopt;
+
+    AVPacket* out = av_packet_clone(packet.data.get());
+    if (!out) {
+        throw std::runtime_error("PacketMuxer: packet clone failed");
+    }
+
+    std::int64_t dts = packet.dts != AV_NOPTS_VALUE ? packet.dts : packet.pts;
+    std::int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : dts;
+    if (first_dts_ == AV_NOPTS_VALUE) first_dts_ = dts;
+    dts -= first_dts_;
+    pts -= first_dts_;
+    if (last_dts_ != AV_NOPTS_VALUE && dts <= last_dts_) {
+        dts = last_dts_ + 1;
+    }
+    if (pts < dts) pts = dts;
+    last_dts_ = dts;
+
+    out->dts = dts;
+    out->pts = pts;
+    out->stream_index = stream_->index;
+    out->pos = -1;
+    av_packet_rescale_ts(out, input_time_base_, stream_->time_base);
+
+    std::optional<KeyframePosition> position;
+    if (packet.keyframe) {
+        // Closing the cluster here makes the keyframe the first block of the next one,
+        // so a reader can start at that cluster with nothing before it but the header
+        if (av_write_frame(format_, nullptr) < 0) {
+            av_packet_free(&out);
+            throw std::runtime_error("PacketMuxer: write failed");
+        }
+        position = KeyframePosition{static_cast<std::uint64_t>(avio_tell(format_->pb)),
+                                    av_rescale_q(pts, input_time_base_, AVRational{1, 1000000})};
+    }
+
+    const int rc = av_write_frame(format_, out);
+    av_packet_free(&out);
+    if (rc < 0) {
+        throw std::runtime_error("PacketMuxer: write failed");
+    }
+    return position;
+}
+
+void PacketMuxer::openSegmentFile(const std::string& path, const SegmentFileOptions& options) {
+    file_ = std::make_unique<SegmentFile>(options);
+    unsigned char* buffer = nullptr;
+    try {
+        file_->open(path);
+        buffer = static_cast<unsigned char*>(av_malloc(avio_buffer_size));
+        if (!buffer) {
+            throw std::runtime_error("PacketMuxer: cannot allocate I/O buffer for " + path);
+        }
+        format_->pb = avio_alloc_context(buffer, avio_buffer_size, 1, file_.get(), nullptr,
+                                         &writeSegmentFile, &seekSegmentFile);
+        if (!format_->pb) {
+            av_freep(&buffer);
+            throw std::runtime_error("PacketMuxer: cannot create I/O context for " + path);
+        }
+        format_->flags |= AVFMT_FLAG_CUSTOM_IO;
+    } catch (...) {
+        file_.reset();
+        avformat_free_context(format_);
+        format_ = nullptr;
+        stream_ = nullptr;
+        throw;
+    }
+}
+
+void PacketMuxer::releaseOutput() {
+    if (file_) {
+        avio_flush(format_->pb);
+        av_freep(&format_->pb->buffer);
+        avio_context_free(&format_->pb);
+        try {
+            file_->close();
+        } catch (const std::exception&) {
+            // Same as a failed trailer write: the segment keeps whatever reached the disk
+        }
+        file_.reset();
+    } else {
+        avio_closep(&format_->pb);
+    }
+    avformat_free_context(format_);
+    format_ = nullptr;
+    stream_ = nullptr;
+}
+
+void PacketMuxer::close() {
+    if (!format_) return;
+    av_write_trailer(format_);
+    releaseOutput();
+}
+
+} // namespace buksan
@@ -0,0 +1,53 @@
+#ifndef PACKETMUXER_H
+#define PACKETMUXER_H
+
+#include "MediaPacket.h"
+#include "SegmentFile.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+struct AVFormatContext;
+struct AVStream;
+
+namespace buksan {
+
+// Where a keyframe landed in the file: each one starts a new cluster at offset
+struct KeyframePosition {
+    std::uint64_t offset{0};
+    // File timeline, which starts at 0
+    std::int64_t pts_us{0};
+};
+
+class PacketMuxer {
+public:
+    PacketMuxer() = default;
+    ~PacketMuxer();
+
+    PacketMuxer(const PacketMuxer&) = delete;
+    PacketMuxer& operator=(const PacketMuxer&) = delete;
+
+    // With file options the output goes through SegmentFile instead of libavformat's own file I/O
+    void open(const std::string& path, const StreamInfo& stream,
+              const std::optional<SegmentFileOptions>& file_options = std::nullopt);
+    // Returns the position of a keyframe, nothing for other packets
+    std::optional<KeyframePosition> write(const MediaPacket& packet);
+    void close();
+    bool isOpen() const { return format_ != nullptr; }
+
+private:
+    void openSegmentFile(const std::string& path, const SegmentFileOptions& options);
+    void releaseOutput();
+
+    AVFormatContext* format_{nullptr};
+    std::unique_ptr<SegmentFile> file_;
+    AVStream* stream_{nullptr};
+    AVRational input_time_base_{1, 90000};
+    std::int64_t first_dts_{AV_NOPTS_VALUE};
+    std::int64_t last_dts_{AV_NOPTS_VALUE};
+};
+
+} // namespace buksan
+
+#endif // PACKETMUXER_H
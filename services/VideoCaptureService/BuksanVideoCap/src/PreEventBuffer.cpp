@@ -0,0 +1,65 @@
+#include "PreEventBuffer.h"
+#include <algorithm>
+#include <iterator>
+
+namespace buksan {
+
+PreEventBuffer::PreEventBuffer(std::chrono::milliseconds window, std::size_t maxBytes)
+    : window_(window)
+    , max_bytes_(maxBytes)
+{
+}
+
+void PreEventBuffer::push(const MediaPacket& packet) {
+    if (!packet.data) return;
+    if (packets_.empty() && !packet.keyframe) return;
+
+    packets_.push_back(packet);
+    bytes_ += packet.size();
+    trim();
+}
+
+std::vector<MediaPacket> PreEventBuffer::drain() {
+    std::vector<MediaPacket> out(std::make_move_iterator(packets_.begin()), std::make_move_iterator(packets_.end()));
+    clear();
+    return out;
+}
+
+void PreEventBuffer::clear() {
+    packets_.clear();
+    bytes_ = 0;
+}
+
+bool PreEventBuffer::dropFrontGop() {
+    auto next = std::find_if(std::next(packets_.begin()), packets_.end(),
+                             [](const MediaPacket& p) { return p.keyframe; });
+    if (next == packets_.end()) return false;
+    for (auto it = packets_.begin(); it != next; ++it) {
+        bytes_ -= it->size();
+    }
+    packets_.erase(packets_.begin(), next);
+    return true;
+}
+
+void PreEventBuffer::trim() {
+    if (packets_.empty()) return;
+    const auto newest = packets_.back().received;
+
+    // Drop whole GOPs while the following GOP alone still covers the window
+    while (packets_.size() > 1) {
+        auto next = std::find_if(std::next(packets_.begin()), packets_.end(),
+                                 [](const MediaPacket& p) { return p.keyframe; });
+        if (next == packets_.end() || newest - next->received < window_) break;
+        dropFrontGop();
+    }
+
+    while (bytes_ > max_bytes_) {
+        if (!dropFrontGop()) {
+            // A single GOP larger than the budget cannot be kept without its keyframe
+            clear();
+            break;
+        }
+    }
+}
+
+} // namespace buksan
@@ -0,0 +1,36 @@
+#ifndef PREEVENTBUFFER_H
+#define PREEVENTBUFFER_H
+
+#include "MediaPacket.h"
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+namespace buksan {
+
+// Rolling window of compressed packets that always begins with a keyframe.
+class PreEventBuffer {
+public:
+    PreEventBuffer(std::chrono::milliseconds window, std::size_t maxBytes);
+
+    void push(const MediaPacket& packet);
+    std::vector<MediaPacket> drain();
+    void clear();
+
+    std::size_t bytes() const { return bytes_; }
+    std::size_t packets() const { return packets_.size(); }
+
+private:
+    void trim();
+    bool dropFrontGop();
+
+    std::chrono::milliseconds window_;
+    std::size_t max_bytes_;
+    std::deque<MediaPacket> packets_;
+    std::size_t bytes_{0};
+};
+
+} // namespace buksan
+
+#endif // PREEVENTBUFFER_H
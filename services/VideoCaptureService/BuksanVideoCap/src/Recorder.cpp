@@ -1,43 +1,122 @@
 #include "Recorder.h"
+#include "PacketMuxer.h"
+#include "SegmentIndex.h"
+#include "StorageVolumes.h"
+#include "utils/Logger.h"
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
+#include <iterator>
 #include <sstream>
 #include <stdexcept>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+extern "C" {
+#include <libavutil/mathematics.h>
+}
 
 namespace buksan {
 
 namespace fs = std::filesystem;
 
+namespace {
+const AVRational micros_time_base{1, 1000000};
+const std::size_t max_gop_bytes = 32 * 1024 * 1024;
+const std::size_t max_encoded_packets = 1024;
+
+bool volumeWritable(const std::string& root, const std::string& camera_id) {
+    const fs::path dir = fs::path(root) / camera_id;
+    struct statvfs vfs;
+    if (statvfs(root.c_str(), &vfs) != 0 || vfs.f_bavail == 0) return false;
+    return access(dir.c_str(), W_OK) == 0;
+}
+
+Histogram& rotationHistogram(const std::string& camera_id) {
+    return metrics().histogram("buksan_segment_rotation_seconds",
+                               "Time to finalize a segment and open the next one", {{"camera", camera_id}});
+}
+}
+
+std::int64_t SegmentInfo::firstPtsUs() const {
+    if (firstPts == AV_NOPTS_VALUE) return AV_NOPTS_VALUE;
+    return av_rescale_q(firstPts, timeBase, micros_time_base);
+}
+
+std::int64_t SegmentInfo::lastPtsUs() const {
+    if (lastPts == AV_NOPTS_VALUE) return AV_NOPTS_VALUE;
+    return av_rescale_q(lastPts, timeBase, micros_time_base);
+}
+
 Recorder::Recorder(const std::string& cameraId,
-                   const std::string& storagePath,
+                   std::shared_ptr<StorageVolumes> volumes,
                    int segmentDurationSeconds,
                    double fps,
-                   cv::Size frameSize)
+                   cv::Size frameSize,
+                   std::shared_ptr<EncoderPool> encoders,
+                   int targetWidth)
     : camera_id_(cameraId)
-    , storage_path_(storagePath)
+    , rotation_seconds_(rotationHistogram(cameraId))
+    , volumes_(std::move(volumes))
     , segment_duration_sec_(segmentDurationSeconds)
     , fps_(fps)
     , frame_size_(frameSize)
+    , passthrough_(encoders != nullptr)
+    , encoders_(std::move(encoders))
+    , target_width_(targetWidth)
 {
     if (segment_duration_sec_ <= 0) {
         throw std::runtime_error("Recorder: segmentDurationSeconds must be positive");
     }
+    if (!volumes_) {
+        throw std::runtime_error("Recorder: no storage volumes");
+    }
     if (fps_ <= 0.0 || frame_size_.width <= 0 || frame_size_.height <= 0) {
         throw std::runtime_error("Recorder: invalid fps or frame size");
     }
+    if (encoders_) {
+        openEncoder();
+    }
 
-    fs::path dir = fs::path(storage_path_) / camera_id_;
-    if (!fs::exists(dir)) {
-        if (!fs::create_directories(dir)) {
-            throw std::runtime_error("Recorder: failed to create directory " + dir.string());
-        }
+    segment_start_ = std::chrono::steady_clock::now();
+    openNextSegment();
+    if (!segmentOpen()) {
+        throw std::runtime_error("Recorder: failed to open first segment");
+    }
+}
+
+Recorder::Recorder(const std::string& cameraId,
+                   std::shared_ptr<StorageVolumes> volumes,
+                   int segmentDurationSeconds,
+                   const StreamInfo& stream,
+                   int maxOvershootSeconds,
+                   const SegmentIoConfig& segmentIo)
+    : camera_id_(cameraId)
+    , rotation_seconds_(rotationHistogram(cameraId))
+    , volumes_(std::move(volumes))
+    , segment_duration_sec_(segmentDurationSeconds)
+    , fps_(stream.fps)
+    , frame_size_(stream.width, stream.height)
+    , passthrough_(true)
+    , stream_(stream)
+    , segment_io_(segmentIo)
+    , max_overshoot_(maxOvershootSeconds < 0 ? 0 : maxOvershootSeconds)
+{
+    if (segment_duration_sec_ <= 0) {
+        throw std::runtime_error("Recorder: segmentDurationSeconds must be positive");
+    }
+    if (!volumes_) {
+        throw std::runtime_error("Recorder: no storage volumes");
+    }
+    if (!stream_.codecParameters) {
+        throw std::runtime_error("Recorder: passthrough requires codec parameters");
     }
 
     segment_start_ = std::chrono::steady_clock::now();
     openNextSegment();
-    if (!writer_ || !writer_->isOpened()) {
+    if (!segmentOpen()) {
         throw std::runtime_error("Recorder: failed to open first segment");
     }
 }
@@ -46,24 +125,195 @@ Recorder::~Recorder() {
     stop();
 }
 
+void Recorder::openEncoder() {
+    encoder_ = encoders_->open(camera_id_, fps_, frame_size_, target_width_,
+                               [this](const MediaPacket& packet) { queueEncoded(packet); });
+    stream_ = encoders_->streamInfo(encoder_);
+}
+
+void Recorder::prepareDirectory(const std::string& root) const {
+    fs::path dir = fs::path(root) / camera_id_;
+    if (!fs::exists(dir)) {
+        if (!fs::create_directories(dir)) {
+            throw std::runtime_error("Recorder: failed to create directory " + dir.string());
+        }
+    }
+}
+
+bool Recorder::segmentOpen() const {
+    if (passthrough_) {
+        return muxer_ && muxer_->isOpen();
+    }
+    return writer_ && writer_->isOpened();
+}
+
+void Recorder::setSegmentClosedHandler(SegmentClosedHandler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_segment_closed_ = std::move(handler);
+}
+
+void Recorder::setEncodedHandler(std::function<void()> handler) {
+    std::lock_guard<std::mutex> lock(encoded_mutex_);
+    on_encoded_ = std::move(handler);
+}
+
+void Recorder::setAlertId(std::optional<std::int64_t> alertId) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    alert_id_ = alertId;
+    if (alertId.has_value()) {
+        current_.alertId = alertId;
+    }
+}
+
+void Recorder::trackTimestamp(std::int64_t pts, bool keyframe) {
+    if (current_.frames == 0) {
+        current_.firstPts = pts;
+        current_.startTime = std::chrono::system_clock::now();
+        current_.startsWithKeyframe = keyframe;
+    }
+    if (current_.lastPts == AV_NOPTS_VALUE || pts > current_.lastPts) {
+        current_.lastPts = pts;
+    }
+    if (pts < current_.firstPts) {
+        current_.firstPts = pts;
+    }
+    ++current_.frames;
+}
+
+bool Recorder::rotationDue(const MediaPacket& packet) const {
+    std::chrono::microseconds elapsed;
+    const std::int64_t base = rotation_base_pts_ != AV_NOPTS_VALUE ? rotation_base_pts_ : current_.firstPts;
+    if (current_.frames > 0 && packet.pts != AV_NOPTS_VALUE && base != AV_NOPTS_VALUE) {
+        elapsed = std::chrono::microseconds(
+            av_rescale_q(packet.pts - base, stream_.timeBase, micros_time_base));
+    } else {
+        elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - segment_start_);
+    }
+
+    const auto limit = std::chrono::seconds(segment_duration_sec_);
+    if (elapsed < limit) return false;
+    // Wait for the next IDR so every segment is independently seekable, but never past the cap
+    return packet.keyframe || elapsed >= limit + max_overshoot_;
+}
+
 void Recorder::closeSegment() {
+    const bool had_segment = writer_ || muxer_;
+    const auto close_start = std::chrono::steady_clock::now();
     if (writer_) {
         writer_->release();
         writer_.reset();
     }
+    if (muxer_) {
+        muxer_->close();
+        muxer_.reset();
+    }
+    index_.reset();
+    gop_.clear();
+    gop_bytes_ = 0;
+    write_time_ += std::chrono::steady_clock::now() - close_start;
+    if (had_segment) {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(current_.path, ec);
+        current_.sizeBytes = ec ? 0 : static_cast<std::uint64_t>(size);
+        if (current_.sizeBytes > 0) last_segment_bytes_ = current_.sizeBytes;
+        volumes_->release(volume_, current_.sizeBytes, write_time_);
+    }
+    if (had_segment && current_.frames > 0) {
+        current_.endTime = std::chrono::system_clock::now();
+        if (on_segment_closed_) {
+            on_segment_closed_(current_);
+        }
+    }
+    current_ = SegmentInfo{};
+    volume_.clear();
+    write_time_ = std::chrono::nanoseconds(0);
 }
 
 void Recorder::openNextSegment() {
-    std::string path = makeSegmentPath();
-    writer_ = std::make_unique<cv::VideoWriter>();
-    writer_->open(path, cv::VideoWriter::fourcc('X', '2', '6', '4'), fps_, frame_size_);
-    if (!writer_->isOpened()) {
-        throw std::runtime_error("Recorder: failed to open segment " + path);
+    // A volume that refuses the segment is taken out of rotation and the next one is tried
+    std::string last_error;
+    for (std::size_t attempt = 0; attempt < volumes_->paths().size(); ++attempt) {
+        volume_ = volumes_->acquire(camera_id_);
+        try {
+            prepareDirectory(volume_);
+            openSegmentAt(makeSegmentPath(volume_));
+            return;
+        } catch (const std::exception& e) {
+            last_error = e.what();
+            writer_.reset();
+            muxer_.reset();
+            index_.reset();
+            const bool volume_at_fault = !volumeWritable(volume_, camera_id_);
+            if (volume_at_fault) volumes_->markFailed(volume_);
+            volumes_->release(volume_, 0, std::chrono::nanoseconds(0));
+            volume_.clear();
+            // A codec or stream problem would fail the same way on every volume
+            if (!volume_at_fault) throw;
+        }
+    }
+    current_ = SegmentInfo{};
+    throw std::runtime_error("Recorder: no volume accepted the segment: " + last_error);
+}
+
+void Recorder::failOver() {
+    volumes_->markFailed(volume_);
+    // The trailer may not make it to a failing disk; the segment is kept as far as it got
+    closeSegment();
+    if (stopped_.load()) return;
+    openNextSegment();
+}
+
+void Recorder::openSegmentAt(const std::string& path) {
+    current_ = SegmentInfo{};
+    rotation_base_pts_ = AV_NOPTS_VALUE;
+    current_.path = path;
+    current_.alertId = alert_id_;
+    if (passthrough_) {
+        current_.timeBase = stream_.timeBase;
+    } else {
+        current_.timeBase = AVRational{1000, static_cast<int>(fps_ * 1000.0 + 0.5)};
+    }
+    if (passthrough_) {
+        muxer_ = std::make_unique<PacketMuxer>();
+        muxer_->open(path, stream_, segmentFileOptions());
+        index_ = std::make_unique<SegmentIndexWriter>();
+        if (!index_->open(path)) {
+            logWarn(camera_id_) << "cannot create keyframe index for " << path;
+            index_.reset();
+        }
+        awaiting_keyframe_ = true;
+    } else {
+        writer_ = std::make_unique<cv::VideoWriter>();
+        writer_->open(path, cv::VideoWriter::fourcc('X', '2', '6', '4'), fps_, frame_size_);
+        if (!writer_->isOpened()) {
+            throw std::runtime_error("Recorder: failed to open segment " + path);
+        }
     }
     segment_start_ = std::chrono::steady_clock::now();
 }
 
-std::string Recorder::makeSegmentPath() const {
+std::optional<SegmentFileOptions> Recorder::segmentFileOptions() const {
+    if (!segment_io_.enabled()) return std::nullopt;
+
+    SegmentFileOptions options;
+    if (segment_io_.buffer_kb > 0) {
+        options.buffer_bytes = static_cast<std::size_t>(segment_io_.buffer_kb) * 1024;
+    }
+    options.direct_io = segment_io_.direct_io;
+    options.sync_interval = std::chrono::milliseconds(segment_io_.sync_interval_ms);
+    if (segment_io_.preallocate) {
+        // Expect about what the previous segment took; before the first one, go by the stream bitrate
+        std::uint64_t expected = last_segment_bytes_;
+        if (expected == 0 && stream_.codecParameters && stream_.codecParameters->bit_rate > 0) {
+            expected = static_cast<std::uint64_t>(stream_.codecParameters->bit_rate) / 8 *
+                       static_cast<std::uint64_t>(segment_duration_sec_);
+        }
+        options.preallocate_bytes = expected + expected / 10;
+    }
+    return options;
+}
+
+std::string Recorder::makeSegmentPath(const std::string& root) const {
     auto now = std::chrono::system_clock::now();
     std::time_t t = std::chrono::system_clock::to_time_t(now);
     std::tm* local = std::localtime(&t);
@@ -72,7 +322,7 @@ std::string Recorder::makeSegmentPath() const {
     }
     std::ostringstream os;
     os << std::put_time(local, "%Y-%m-%d_%H-%M-%S") << ".mkv";
-    fs::path dir = fs::path(storage_path_) / camera_id_;
+    fs::path dir = fs::path(root) / camera_id_;
     return (dir / os.str()).string();
 }
 
@@ -81,19 +331,151 @@ void Recorder::writeFrame(const cv::Mat& frame) {
 
     std::lock_guard<std::mutex> lock(mutex_);
     if (stopped_.load()) return;
+    if (encoder_) {
+        // Rotation happens on the encoded packets, at the keyframes the encoder places every gop_sec
+        encoders_->submit(encoder_, frame);
+        return;
+    }
     if (!writer_ || !writer_->isOpened()) return;
 
     auto elapsed = std::chrono::steady_clock::now() - segment_start_;
     auto limit = std::chrono::seconds(segment_duration_sec_);
     if (elapsed >= limit) {
+        ScopedTimer timer(rotation_seconds_);
         closeSegment();
         if (stopped_.load()) return;
         openNextSegment();
     }
 
     if (writer_ && writer_->isOpened()) {
+        const auto write_start = std::chrono::steady_clock::now();
         writer_->write(frame);
+        write_time_ += std::chrono::steady_clock::now() - write_start;
+        trackTimestamp(frame_counter_++, current_.frames == 0);
+    }
+}
+
+void Recorder::writePacket(const MediaPacket& packet) {
+    if (!packet.data) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_.load()) return;
+    writePacketLocked(packet);
+}
+
+void Recorder::queueEncoded(const MediaPacket& packet) {
+    if (!packet.data) return;
+
+    std::lock_guard<std::mutex> lock(encoded_mutex_);
+    if (packet.keyframe) encoded_dropping_ = false;
+    if (encoded_dropping_ || encoded_.size() >= max_encoded_packets) {
+        if (!encoded_dropping_) {
+            logRepeated(LogLevel::Warn, camera_id_, "encoded-backlog")
+                << "segment writes fall behind the encoder, dropping packets until the next keyframe";
+        }
+        encoded_dropping_ = true;
+        return;
+    }
+    encoded_.push_back(packet);
+    if (on_encoded_) on_encoded_();
+}
+
+bool Recorder::drainEncoded(std::size_t maxPackets) {
+    std::vector<MediaPacket> batch;
+    bool more = false;
+    {
+        std::lock_guard<std::mutex> lock(encoded_mutex_);
+        const std::size_t count = std::min(maxPackets, encoded_.size());
+        batch.assign(std::make_move_iterator(encoded_.begin()), std::make_move_iterator(encoded_.begin() + count));
+        encoded_.erase(encoded_.begin(), encoded_.begin() + count);
+        more = !encoded_.empty();
+    }
+    if (batch.empty()) return more;
+
+    // Also after stop(): the encoder flush lands in the segment before it is closed
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& packet : batch) {
+        writePacketLocked(packet);
+    }
+    return more;
+}
+
+void Recorder::writePacketLocked(const MediaPacket& packet) {
+    if (!muxer_ || !muxer_->isOpen()) return;
+
+    if (!awaiting_keyframe_ && rotationDue(packet)) {
+        ScopedTimer timer(rotation_seconds_);
+        // A forced cut at the overshoot cap lands mid-GOP: the open GOP goes to the new segment
+        // as well, so it starts on its keyframe instead of dropping or orphaning the partial GOP
+        std::vector<MediaPacket> carried;
+        if (!packet.keyframe && !gop_overflow_ && !gop_.empty() && gop_.front().keyframe) carried = std::move(gop_);
+        closeSegment();
+        if (stopped_.load()) return;
+        openNextSegment();
+        if (!packet.keyframe) {
+            if (carried.empty()) {
+                logWarn(camera_id_) << "GOP too long to carry over, segment starts without a keyframe";
+            }
+            awaiting_keyframe_ = false;
+            // The carried GOP starts before the cap was hit; counting from it would make the
+            // next packet due again and cut a run of tiny segments
+            rotation_base_pts_ = packet.pts;
+            for (const auto& held : carried) {
+                if (!muxPacket(held)) return;
+            }
+        }
+    }
+
+    if (awaiting_keyframe_) {
+        if (!packet.keyframe) return;
+        awaiting_keyframe_ = false;
+    }
+
+    muxPacket(packet);
+}
+
+// False when the write failed and the recorder moved to another volume
+bool Recorder::muxPacket(const MediaPacket& packet) {
+    if (!muxer_ || !muxer_->isOpen()) return false;
+
+    const auto write_start = std::chrono::steady_clock::now();
+    std::optional<KeyframePosition> keyframe;
+    try {
+        keyframe = muxer_->write(packet);
+    } catch (const std::exception&) {
+        // Disk error or full volume: continue on another one from the next keyframe
+        failOver();
+        return false;
+    }
+    write_time_ += std::chrono::steady_clock::now() - write_start;
+    trackTimestamp(packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts, packet.keyframe);
+    if (current_.frames == 1 && packet.received != std::chrono::steady_clock::time_point{}) {
+        // Replayed packets (a carried GOP, the pre-event buffer) arrived before they are written
+        current_.startTime -= std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            write_start - packet.received);
+    }
+    if (keyframe && index_) {
+        // The segment's wall clock starts at its first packet, which is file time 0
+        const auto start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            current_.startTime.time_since_epoch()).count();
+        index_->append(KeyframeEntry{keyframe->pts_us, start_us + keyframe->pts_us, keyframe->offset});
     }
+
+    if (packet.keyframe) {
+        gop_.clear();
+        gop_bytes_ = 0;
+        gop_overflow_ = false;
+    }
+    if (!gop_overflow_) {
+        gop_bytes_ += packet.size();
+        if (gop_bytes_ > max_gop_bytes) {
+            gop_.clear();
+            gop_overflow_ = true;
+        } else {
+            gop_.push_back(packet);
+        }
+    }
+    return true;
 }
 
 void Recorder::stop() {
@@ -101,20 +483,35 @@ void Recorder::stop() {
     if (!stopped_.compare_exchange_strong(expected, true)) {
         return;
     }
+    EncoderPool::StreamHandle encoder;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        encoder = std::move(encoder_);
+    }
+    if (encoder) {
+        // Not under the lock: the workers finish the frames still queued for the encoder
+        encoders_->close(encoder);
+    }
+    while (drainEncoded(max_encoded_packets)) {
+    }
     std::lock_guard<std::mutex> lock(mutex_);
     closeSegment();
 }
 
 void Recorder::startNewSegment() {
     std::lock_guard<std::mutex> lock(mutex_);
+    ScopedTimer timer(rotation_seconds_);
     closeSegment();
     stopped_.store(false);
+    if (encoders_ && !encoder_) {
+        openEncoder();
+    }
     openNextSegment();
 }
 
 bool Recorder::isRecording() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    return !stopped_.load() && writer_ && writer_->isOpened();
+    return !stopped_.load() && segmentOpen();
 }
 
 } // namespace buksan
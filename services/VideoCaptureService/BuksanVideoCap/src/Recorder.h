@@ -1,7 +1,17 @@
 #ifndef RECORDER_H
 #define RECORDER_H
 
+#include "ConfigLoader.h"
+#include "EncoderPool.h"
+#include "MediaPacket.h"
+#include "utils/Metrics.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
 #include <string>
+#include <vector>
 #include <memory>
 #include <mutex>
 #include <atomic>
@@ -10,36 +20,128 @@
 
 namespace buksan {
 
+class PacketMuxer;
+class SegmentIndexWriter;
+class StorageVolumes;
+struct SegmentFileOptions;
+
+struct SegmentInfo {
+    std::string path;
+    std::int64_t firstPts{AV_NOPTS_VALUE};
+    std::int64_t lastPts{AV_NOPTS_VALUE};
+    AVRational timeBase{1, 90000};
+    std::chrono::system_clock::time_point startTime;
+    std::chrono::system_clock::time_point endTime;
+    std::uint64_t frames{0};
+    std::uint64_t sizeBytes{0};
+    bool startsWithKeyframe{false};
+    std::optional<std::int64_t> alertId;
+
+    std::int64_t firstPtsUs() const;
+    std::int64_t lastPtsUs() const;
+};
+
+using SegmentClosedHandler = std::function<void(const SegmentInfo&)>;
+using CameraSegmentHandler = std::function<void(const std::string& cameraId, const SegmentInfo&)>;
+
 class Recorder {
 public:
+    // Transcoding: frames go to the encoder pool when one is given, to cv::VideoWriter otherwise
     Recorder(const std::string& cameraId,
-             const std::string& storagePath,
+             std::shared_ptr<StorageVolumes> volumes,
              int segmentDurationSeconds,
              double fps,
-             cv::Size frameSize);
+             cv::Size frameSize,
+             std::shared_ptr<EncoderPool> encoders = nullptr,
+             int targetWidth = 0);
+
+    Recorder(const std::string& cameraId,
+             std::shared_ptr<StorageVolumes> volumes,
+             int segmentDurationSeconds,
+             const StreamInfo& stream,
+             int maxOvershootSeconds = 10,
+             const SegmentIoConfig& segmentIo = {});
 
     ~Recorder();
 
     void writeFrame(const cv::Mat& frame);
+    void writePacket(const MediaPacket& packet);
     void stop();
     void startNewSegment();
 
     bool isRecording() const;
 
+    // Tags the current and following segments with the alert that caused them.
+    void setAlertId(std::optional<std::int64_t> alertId);
+
+    // Invoked under the recorder lock, so the handler must not block.
+    void setSegmentClosedHandler(SegmentClosedHandler handler);
+
+    // The encoder pool only queues its packets here; the camera's writer puts them on disk with
+    // drainEncoded(), so a slow volume never holds up an encoder thread. The handler is called on an
+    // encoder thread whenever packets are waiting and must not block.
+    void setEncodedHandler(std::function<void()> handler);
+    // Writes up to maxPackets queued encoded packets; true when more are already waiting
+    bool drainEncoded(std::size_t maxPackets);
+
 private:
+    void openEncoder();
+    void queueEncoded(const MediaPacket& packet);
+    void writePacketLocked(const MediaPacket& packet);
+    bool muxPacket(const MediaPacket& packet);
     void closeSegment();
     void openNextSegment();
-    std::string makeSegmentPath() const;
+    void openSegmentAt(const std::string& path);
+    void failOver();
+    bool rotationDue(const MediaPacket& packet) const;
+    void trackTimestamp(std::int64_t pts, bool keyframe);
+    std::string makeSegmentPath(const std::string& root) const;
+    std::optional<SegmentFileOptions> segmentFileOptions() const;
+    void prepareDirectory(const std::string& root) const;
+    bool segmentOpen() const;
 
     std::string camera_id_;
-    std::string storage_path_;
+    Histogram& rotation_seconds_;
+    std::shared_ptr<StorageVolumes> volumes_;
+    std::string volume_;
+    std::chrono::nanoseconds write_time_{0};
     int segment_duration_sec_;
     double fps_;
     cv::Size frame_size_;
+    // Segments are muxed from packets: the camera's own, or the encoder pool's
+    bool passthrough_{false};
+    std::shared_ptr<EncoderPool> encoders_;
+    EncoderPool::StreamHandle encoder_;
+    int target_width_{0};
+    StreamInfo stream_;
+    SegmentIoConfig segment_io_;
+    std::uint64_t last_segment_bytes_{0};
+    bool awaiting_keyframe_{true};
+    // Packets since the last keyframe, replayed at the head of a segment the overshoot cap forces
+    // open so it still starts on that keyframe; dropped past max_gop_bytes
+    std::vector<MediaPacket> gop_;
+    std::size_t gop_bytes_{0};
+    bool gop_overflow_{false};
+    // Where the segment's duration counts from when it is not its first packet: the cut time of a
+    // forced cut that carried a GOP over
+    std::int64_t rotation_base_pts_{AV_NOPTS_VALUE};
+    std::chrono::seconds max_overshoot_{10};
+    std::int64_t frame_counter_{0};
+    SegmentInfo current_;
+    std::optional<std::int64_t> alert_id_;
+    SegmentClosedHandler on_segment_closed_;
 
     std::unique_ptr<cv::VideoWriter> writer_;
+    std::unique_ptr<PacketMuxer> muxer_;
+    // Keyframe sidecar of the open segment; muxed segments only
+    std::unique_ptr<SegmentIndexWriter> index_;
     std::chrono::steady_clock::time_point segment_start_;
     mutable std::mutex mutex_;
+    // Encoded packets waiting for the writer; past max_encoded_packets the rest of the GOP is dropped
+    std::mutex encoded_mutex_;
+    std::deque<MediaPacket> encoded_;
+    bool encoded_dropping_{false};
+    std::function<void()> on_encoded_;
     std::atomic<bool> stopped_{false};
 };
 
@@ -0,0 +1,117 @@
+#include "RtspDemuxer.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+}
+
+namespace buksan {
+
+RtspDemuxer::RtspDemuxer(const std::atomic<bool>& running, std::chrono::milliseconds ioTimeout)
+    : running_(running)
+    , io_timeout_(ioTimeout)
+{
+}
+
+RtspDemuxer::~RtspDemuxer() {
+    close();
+}
+
+int RtspDemuxer::interruptCallback(void* opaque) {
+    auto* self = static_cast<RtspDemuxer*>(opaque);
+    if (!self->running_.load()) return 1;
+    return std::chrono::steady_clock::now() > self->deadline_ ? 1 : 0;
+}
+
+void RtspDemuxer::armDeadline() {
+    deadline_ = std::chrono::steady_clock::now() + io_timeout_;
+}
+
+bool RtspDemuxer::open(const std::string& url) {
+    close();
+
+    format_ = avformat_alloc_context();
+    if (!format_) return false;
+    format_->interrupt_callback.callback = &RtspDemuxer::interruptCallback;
+    format_->interrupt_callback.opaque = this;
+
+    AVDictionary* options = nullptr;
+    av_dict_set(&options, "rtsp_transport", "tcp", 0);
+    av_dict_set(&options, "fflags", "nobuffer", 0);
+
+    armDeadline();
+    const int rc = avformat_open_input(&format_, url.c_str(), nullptr, &options);
+    av_dict_free(&options);
+    if (rc < 0) {
+        // avformat_open_input frees the context on failure
+        format_ = nullptr;
+        return false;
+    }
+
+    armDeadline();
+    if (avformat_find_stream_info(format_, nullptr) < 0) {
+        close();
+        return false;
+    }
+
+    video_stream_ = av_find_best_stream(format_, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (video_stream_ < 0) {
+        close();
+        return false;
+    }
+
+    const AVStream* stream = format_->streams[video_stream_];
+    AVCodecParameters* params = avcodec_parameters_alloc();
+    if (!params || avcodec_parameters_copy(params, stream->codecpar) < 0) {
+        avcodec_parameters_free(&params);
+        close();
+        return false;
+    }
+    info_.codecParameters = std::shared_ptr<AVCodecParameters>(params, [](AVCodecParameters* p) {
+        avcodec_parameters_free(&p);
+    });
+    info_.timeBase = stream->time_base;
+    info_.width = params->width;
+    info_.height = params->height;
+    AVRational rate = stream->avg_frame_rate.num > 0 ? stream->avg_frame_rate : stream->r_frame_rate;
+    info_.fps = (rate.num > 0 && rate.den > 0) ? av_q2d(rate) : 25.0;
+    return true;
+}
+
+void RtspDemuxer::close() {
+    if (format_) {
+        avformat_close_input(&format_);
+        format_ = nullptr;
+    }
+    video_stream_ = -1;
+}
+
+bool RtspDemuxer::read(MediaPacket& packet) {
+    if (!format_) return false;
+
+    AVPacket* pkt = av_packet_alloc();
+    if (!pkt) return false;
+
+    while (true) {
+        armDeadline();
+        if (av_read_frame(format_, pkt) < 0) {
+            av_packet_free(&pkt);
+            return false;
+        }
+        if (pkt->stream_index == video_stream_) break;
+        av_packet_unref(pkt);
+    }
+
+    packet.keyframe = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+    packet.dts = pkt->dts;
+    packet.pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    packet.timeBase = info_.timeBase;
+    packet.received = std::chrono::steady_clock::now();
+    packet.data = std::shared_ptr<const AVPacket>(pkt, [](const AVPacket* p) {
+        AVPacket* owned = const_cast<AVPacket*>(p);
+        av_packet_free(&owned);
+    });
+    return true;
+}
+
+} // namespace buksan
@@ -0,0 +1,43 @@
+#ifndef RTSPDEMUXER_H
+#define RTSPDEMUXER_H
+
+#include "MediaPacket.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+
+struct AVFormatContext;
+
+namespace buksan {
+
+class RtspDemuxer {
+public:
+    explicit RtspDemuxer(const std::atomic<bool>& running,
+                         std::chrono::milliseconds ioTimeout = std::chrono::seconds(10));
+    ~RtspDemuxer();
+
+    RtspDemuxer(const RtspDemuxer&) = delete;
+    RtspDemuxer& operator=(const RtspDemuxer&) = delete;
+
+    bool open(const std::string& url);
+    void close();
+    bool isOpen() const { return format_ != nullptr; }
+
+    bool read(MediaPacket& packet);
+    const StreamInfo& streamInfo() const { return info_; }
+
+private:
+    static int interruptCallback(void* opaque);
+    void armDeadline();
+
+    const std::atomic<bool>& running_;
+    std::chrono::milliseconds io_timeout_;
+    std::chrono::steady_clock::time_point deadline_;
+    AVFormatContext* format_{nullptr};
+    int video_stream_{-1};
+    StreamInfo info_;
+};
+
+} // namespace buksan
+
+#endif // RTSPDEMUXER_H
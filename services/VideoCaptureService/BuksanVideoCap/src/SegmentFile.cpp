@@ -0,0 +1,250 @@
+#include "SegmentFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace buksan {
+
+namespace {
+// Logical block size accepted by O_DIRECT on the 4Kn/512e drives we deploy on
+const std::size_t direct_alignment = 4096;
+const std::size_t min_buffer_bytes = 64 * 1024;
+
+std::size_t roundUp(std::size_t value, std::size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+std::runtime_error ioError(const std::string& what, const std::string& path) {
+    return std::runtime_error("SegmentFile: " + what + " " + path + ": " + std::strerror(errno));
+}
+
+void writeAll(int fd, const std::uint8_t* data, std::size_t size, std::uint64_t offset, const std::string& path) {
+    while (size > 0) {
+        const ssize_t n = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw ioError("write failed for", path);
+        }
+        data += n;
+        size -= static_cast<std::size_t>(n);
+        offset += static_cast<std::uint64_t>(n);
+    }
+}
+
+// Reads one block; whatever lies past the end of the file reads as zeros
+void readBlock(int fd, std::uint8_t* block, std::size_t size, std::uint64_t offset, const std::string& path) {
+    std::size_t done = 0;
+    while (done < size) {
+        const ssize_t n = ::pread(fd, block + done, size - done, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw ioError("read failed for", path);
+        }
+        if (n == 0) break;
+        done += static_cast<std::size_t>(n);
+    }
+    std::memset(block + done, 0, size - done);
+}
+}
+
+void SegmentFile::FreeDeleter::operator()(std::uint8_t* p) const {
+    std::free(p);
+}
+
+SegmentFile::SegmentFile(const SegmentFileOptions& options)
+    : options_(options)
+{
+}
+
+SegmentFile::~SegmentFile() {
+    try {
+        close();
+    } catch (...) {
+    }
+}
+
+void SegmentFile::open(const std::string& path) {
+    close();
+    path_ = path;
+    direct_ = false;
+
+    // Read access is needed to patch partially written blocks under O_DIRECT
+    const int flags = O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if (options_.direct_io) {
+        fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        if (fd_ >= 0) {
+            direct_ = true;
+        } else if (errno != EINVAL) {
+            throw ioError("cannot open", path);
+        }
+    }
+    if (fd_ < 0) {
+        fd_ = ::open(path.c_str(), flags, 0644);
+        if (fd_ < 0) {
+            throw ioError("cannot open", path);
+        }
+    }
+    alignment_ = direct_ ? direct_alignment : 1;
+
+    const std::size_t capacity = roundUp(std::max(options_.buffer_bytes, min_buffer_bytes), direct_alignment);
+    if (!buffer_ || capacity_ != capacity) {
+        void* memory = nullptr;
+        if (posix_memalign(&memory, direct_alignment, capacity + direct_alignment) != 0) {
+            ::close(fd_);
+            fd_ = -1;
+            throw std::runtime_error("SegmentFile: cannot allocate write buffer");
+        }
+        buffer_.reset(static_cast<std::uint8_t*>(memory));
+        capacity_ = capacity;
+    }
+
+#ifdef __linux__
+    if (options_.preallocate_bytes > 0) {
+        // Best effort: one contiguous reservation up front instead of an extent per append. KEEP_SIZE
+        // leaves the visible size at what was written, so readers, range requests and retention never
+        // see zero padding, not even after a crash
+        ::fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(options_.preallocate_bytes));
+    }
+#endif
+
+    buffer_offset_ = 0;
+    buffer_length_ = 0;
+    dirty_ = false;
+    position_ = 0;
+    size_ = 0;
+    flushed_size_ = 0;
+    last_sync_ = std::chrono::steady_clock::now();
+}
+
+void SegmentFile::write(const std::uint8_t* data, std::size_t size) {
+    if (fd_ < 0) {
+        throw std::runtime_error("SegmentFile: write to closed file");
+    }
+    while (size > 0) {
+        if (position_ < buffer_offset_ || position_ > buffer_offset_ + buffer_length_ ||
+            position_ - buffer_offset_ >= capacity_) {
+            rebase(position_);
+        }
+        const std::size_t at = static_cast<std::size_t>(position_ - buffer_offset_);
+        const std::size_t n = std::min(size, capacity_ - at);
+        std::memcpy(buffer_.get() + at, data, n);
+        buffer_length_ = std::max(buffer_length_, at + n);
+        dirty_ = true;
+        position_ += n;
+        size_ = std::max(size_, position_);
+        data += n;
+        size -= n;
+        if (at + n == capacity_) {
+            flush();
+        }
+    }
+    syncIfDue();
+}
+
+std::int64_t SegmentFile::seek(std::int64_t offset, int whence) {
+    std::int64_t base = 0;
+    switch (whence) {
+    case SEEK_SET: base = 0; break;
+    case SEEK_CUR: base = static_cast<std::int64_t>(position_); break;
+    case SEEK_END: base = static_cast<std::int64_t>(size_); break;
+    default: return -EINVAL;
+    }
+    if (base + offset < 0) return -EINVAL;
+    position_ = static_cast<std::uint64_t>(base + offset);
+    return static_cast<std::int64_t>(position_);
+}
+
+void SegmentFile::flush() {
+    if (!dirty_ || buffer_length_ == 0) {
+        dirty_ = false;
+        return;
+    }
+
+    std::uint8_t* buffer = buffer_.get();
+    std::size_t length = buffer_length_;
+    if (direct_) {
+        // O_DIRECT writes whole blocks; the padding must not wipe bytes already on disk past this point
+        length = roundUp(buffer_length_, alignment_);
+        if (length > buffer_length_) {
+            const std::uint64_t tail_block = buffer_offset_ + length - alignment_;
+            if (buffer_offset_ + buffer_length_ < flushed_size_) {
+                std::uint8_t* scratch = buffer + capacity_;
+                readBlock(fd_, scratch, alignment_, tail_block, path_);
+                const std::size_t keep = buffer_length_ - (length - alignment_);
+                std::memcpy(buffer + buffer_length_, scratch + keep, alignment_ - keep);
+            } else {
+                std::memset(buffer + buffer_length_, 0, length - buffer_length_);
+            }
+        }
+    }
+    writeAll(fd_, buffer, length, buffer_offset_, path_);
+    flushed_size_ = std::max(flushed_size_, buffer_offset_ + buffer_length_);
+    dirty_ = false;
+
+    // Everything up to the last partial block is final; only that block may need rewriting
+    const std::size_t keep_from = buffer_length_ / alignment_ * alignment_;
+    if (keep_from > 0) {
+        std::memmove(buffer, buffer + keep_from, buffer_length_ - keep_from);
+        buffer_offset_ += keep_from;
+        buffer_length_ -= keep_from;
+    }
+}
+
+void SegmentFile::rebase(std::uint64_t position) {
+    flush();
+    buffer_offset_ = position / alignment_ * alignment_;
+    buffer_length_ = static_cast<std::size_t>(position - buffer_offset_);
+    if (buffer_length_ > 0) {
+        // Writing into the middle of a block: start from what the disk already has
+        readBlock(fd_, buffer_.get(), alignment_, buffer_offset_, path_);
+        const std::uint64_t on_disk = flushed_size_ > buffer_offset_ ? flushed_size_ - buffer_offset_ : 0;
+        buffer_length_ = static_cast<std::size_t>(
+            std::min<std::uint64_t>(alignment_, std::max<std::uint64_t>(on_disk, buffer_length_)));
+    }
+}
+
+void SegmentFile::syncIfDue() {
+    if (options_.sync_interval.count() <= 0) return;
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_sync_ < options_.sync_interval) return;
+    last_sync_ = now;
+    flush();
+    if (::fdatasync(fd_) != 0) {
+        throw ioError("fdatasync failed for", path_);
+    }
+}
+
+void SegmentFile::close() {
+    if (fd_ < 0) return;
+    std::string error;
+    try {
+        flush();
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    // Drops the block padding and whatever part of the reservation went unused
+    if (::ftruncate(fd_, static_cast<off_t>(size_)) != 0 && error.empty()) {
+        error = ioError("truncate failed for", path_).what();
+    }
+#ifdef __linux__
+    if (options_.preallocate_bytes > size_) {
+        // Blocks reserved past the end are not released by a truncate that keeps the size
+        ::fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(size_),
+                    static_cast<off_t>(options_.preallocate_bytes - size_));
+    }
+#endif
+    if (options_.sync_interval.count() > 0 && ::fdatasync(fd_) != 0 && error.empty()) {
+        error = ioError("fdatasync failed for", path_).what();
+    }
+    ::close(fd_);
+    fd_ = -1;
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+} // namespace buksan
@@ -0,0 +1,72 @@
+#ifndef SEGMENTFILE_H
+#define SEGMENTFILE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace buksan {
+
+struct SegmentFileOptions {
+    // Reserved with fallocate when the file is opened; 0 lets the file grow append by append
+    std::uint64_t preallocate_bytes{0};
+    std::size_t buffer_bytes{1024 * 1024};
+    // Bypass the page cache; falls back to buffered I/O where the filesystem refuses O_DIRECT
+    bool direct_io{false};
+    // fdatasync at most this often while writing; 0 only syncs on close
+    std::chrono::milliseconds sync_interval{0};
+};
+
+// Write-behind segment file for the muxer. Data is collected in one large aligned buffer and
+// written out in whole blocks, so the disk sees a few big sequential writes instead of one per packet.
+// Seeks (the muxer patches headers on close) flush the buffer and, with O_DIRECT, reload the block
+// being modified. close() cuts the file back to the bytes actually written.
+class SegmentFile {
+public:
+    explicit SegmentFile(const SegmentFileOptions& options);
+    ~SegmentFile();
+
+    SegmentFile(const SegmentFile&) = delete;
+    SegmentFile& operator=(const SegmentFile&) = delete;
+
+    void open(const std::string& path);
+    void write(const std::uint8_t* data, std::size_t size);
+    // Same contract as lseek; returns the new position
+    std::int64_t seek(std::int64_t offset, int whence);
+    void close();
+
+    bool isOpen() const { return fd_ >= 0; }
+    bool directIo() const { return direct_; }
+    std::uint64_t size() const { return size_; }
+
+private:
+    struct FreeDeleter {
+        void operator()(std::uint8_t* p) const;
+    };
+
+    void flush();
+    void rebase(std::uint64_t position);
+    void syncIfDue();
+
+    SegmentFileOptions options_;
+    std::string path_;
+    int fd_{-1};
+    bool direct_{false};
+    std::size_t alignment_{1};
+    std::unique_ptr<std::uint8_t, FreeDeleter> buffer_;
+    std::size_t capacity_{0};
+    // The buffer holds file bytes [buffer_offset_, buffer_offset_ + buffer_length_)
+    std::uint64_t buffer_offset_{0};
+    std::size_t buffer_length_{0};
+    bool dirty_{false};
+    std::uint64_t position_{0};
+    std::uint64_t size_{0};
+    std::uint64_t flushed_size_{0};
+    std::chrono::steady_clock::time_point last_sync_;
+};
+
+} // namespace buksan
+
+#endif // SEGMENTFILE_H
@@ -0,0 +1,178 @@
+#include "SegmentIndex.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace buksan {
+
+namespace {
+const char index_magic[4] = {'B', 'K', 'I', 'X'};
+const std::size_t header_size = 8;
+const std::size_t entry_size = 24;
+
+void putLe64(unsigned char* out, std::uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+std::uint64_t getLe64(const unsigned char* in) {
+    std::uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+const std::uint64_t ebml_id = 0x1A45DFA3;
+const std::uint64_t segment_id = 0x18538067;
+const std::uint64_t cluster_id = 0x1F43B675;
+// Codec private data keeps the header small; anything longer is not a header we wrote
+const std::size_t max_header_bytes = 1 << 20;
+
+// EBML variable-length integer at data[pos]. Ids keep their length marker, sizes drop it;
+// `unknown` is set for an all-ones size. False when it is malformed or runs past the data.
+bool readVint(const std::vector<unsigned char>& data, std::size_t& pos, bool keep_marker, std::uint64_t& value,
+              bool& unknown) {
+    if (pos >= data.size() || data[pos] == 0) return false;
+    std::size_t length = 1;
+    while (!(data[pos] & (0x80 >> (length - 1)))) ++length;
+    if (pos + length > data.size()) return false;
+    value = keep_marker ? data[pos] : data[pos] & (0xFF >> length);
+    bool all_ones = value == (0xFFu >> length);
+    for (std::size_t i = 1; i < length; ++i) {
+        value = (value << 8) | data[pos + i];
+        all_ones = all_ones && data[pos + i] == 0xFF;
+    }
+    unknown = !keep_marker && all_ones;
+    pos += length;
+    return true;
+}
+
+template <typename Key>
+std::optional<KeyframeEntry> findKeyframe(const std::vector<KeyframeEntry>& entries, std::int64_t value, Key key) {
+    if (entries.empty()) return std::nullopt;
+    // Entries are in write order, which is time order
+    auto it = std::upper_bound(entries.begin(), entries.end(), value,
+                               [&key](std::int64_t v, const KeyframeEntry& entry) { return v < key(entry); });
+    if (it == entries.begin()) return entries.front();
+    return *std::prev(it);
+}
+}
+
+std::string segmentIndexPath(const std::string& segment_path) {
+    return segment_path + ".idx";
+}
+
+SegmentIndexWriter::~SegmentIndexWriter() {
+    close();
+}
+
+bool SegmentIndexWriter::open(const std::string& segment_path) {
+    close();
+    file_ = std::fopen(segmentIndexPath(segment_path).c_str(), "wb");
+    if (!file_) return false;
+    unsigned char header[header_size] = {};
+    std::memcpy(header, index_magic, sizeof(index_magic));
+    header[4] = static_cast<unsigned char>(entry_size);
+    if (std::fwrite(header, 1, sizeof(header), file_) != sizeof(header) || std::fflush(file_) != 0) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SegmentIndexWriter::append(const KeyframeEntry& entry) {
+    if (!file_) return;
+    unsigned char record[entry_size];
+    putLe64(record, static_cast<std::uint64_t>(entry.pts_us));
+    putLe64(record + 8, static_cast<std::uint64_t>(entry.unix_us));
+    putLe64(record + 16, entry.offset);
+    if (std::fwrite(record, 1, sizeof(record), file_) != sizeof(record) || std::fflush(file_) != 0) {
+        // The entries so far stay usable; the rest of the segment is simply not indexed
+        close();
+    }
+}
+
+void SegmentIndexWriter::close() {
+    if (file_) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+std::vector<KeyframeEntry> readSegmentIndex(const std::string& segment_path) {
+    std::vector<KeyframeEntry> entries;
+    const int fd = ::open(segmentIndexPath(segment_path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return entries;
+
+    struct stat st;
+    std::vector<unsigned char> data;
+    if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(header_size)) {
+        data.resize(static_cast<std::size_t>(st.st_size));
+        const ssize_t got = ::pread(fd, data.data(), data.size(), 0);
+        data.resize(got > 0 ? static_cast<std::size_t>(got) : 0);
+    }
+    ::close(fd);
+
+    if (data.size() < header_size || std::memcmp(data.data(), index_magic, sizeof(index_magic)) != 0 ||
+        data[4] != entry_size) {
+        return entries;
+    }
+    const std::size_t count = (data.size() - header_size) / entry_size;
+    entries.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const unsigned char* record = data.data() + header_size + i * entry_size;
+        KeyframeEntry entry;
+        entry.pts_us = static_cast<std::int64_t>(getLe64(record));
+        entry.unix_us = static_cast<std::int64_t>(getLe64(record + 8));
+        entry.offset = getLe64(record + 16);
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+std::optional<KeyframeEntry> findKeyframeByPts(const std::vector<KeyframeEntry>& entries, std::int64_t pts_us) {
+    return findKeyframe(entries, pts_us, [](const KeyframeEntry& entry) { return entry.pts_us; });
+}
+
+std::optional<KeyframeEntry> findKeyframeByUnix(const std::vector<KeyframeEntry>& entries, std::int64_t unix_us) {
+    return findKeyframe(entries, unix_us, [](const KeyframeEntry& entry) { return entry.unix_us; });
+}
+
+std::string readMatroskaHeader(const std::string& segment_path) {
+    const int fd = ::open(segment_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return std::string();
+    std::vector<unsigned char> data(max_header_bytes);
+    const ssize_t got = ::pread(fd, data.data(), data.size(), 0);
+    ::close(fd);
+    data.resize(got > 0 ? static_cast<std::size_t>(got) : 0);
+
+    std::size_t pos = 0;
+    std::uint64_t id = 0;
+    std::uint64_t size = 0;
+    bool unknown = false;
+    if (!readVint(data, pos, true, id, unknown) || id != ebml_id || !readVint(data, pos, false, size, unknown) ||
+        unknown || size > data.size() - pos) {
+        return std::string();
+    }
+    pos += static_cast<std::size_t>(size);
+    // The Segment's own size is unknown while it is written, so only its children are walked
+    if (!readVint(data, pos, true, id, unknown) || id != segment_id || !readVint(data, pos, false, size, unknown)) {
+        return std::string();
+    }
+    while (pos < data.size()) {
+        const std::size_t element_start = pos;
+        if (!readVint(data, pos, true, id, unknown)) break;
+        if (id == cluster_id) {
+            return std::string(data.begin(), data.begin() + static_cast<std::ptrdiff_t>(element_start));
+        }
+        if (!readVint(data, pos, false, size, unknown) || unknown || size > data.size() - pos) break;
+        pos += static_cast<std::size_t>(size);
+    }
+    return std::string();
+}
+
+} // namespace buksan
@@ -0,0 +1,58 @@
+#ifndef SEGMENTINDEX_H
+#define SEGMENTINDEX_H
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace buksan {
+
+// One keyframe of a segment: the byte offset of the cluster it opens, so reading the file from
+// there (after the header) decodes without anything earlier
+struct KeyframeEntry {
+    // Time in the segment's own timeline, from 0
+    std::int64_t pts_us{0};
+    std::int64_t unix_us{0};
+    std::uint64_t offset{0};
+};
+
+// The sidecar next to a segment: <segment>.idx
+std::string segmentIndexPath(const std::string& segment_path);
+
+// Appends keyframes to a segment's sidecar as they are written. The file is an 8-byte header
+// ("BKIX", entry size) followed by fixed-size little-endian entries, flushed one by one so an
+// open segment can be seeked as well.
+class SegmentIndexWriter {
+public:
+    SegmentIndexWriter() = default;
+    ~SegmentIndexWriter();
+
+    SegmentIndexWriter(const SegmentIndexWriter&) = delete;
+    SegmentIndexWriter& operator=(const SegmentIndexWriter&) = delete;
+
+    // False when the sidecar cannot be created; the segment is then written without one
+    bool open(const std::string& segment_path);
+    void append(const KeyframeEntry& entry);
+    void close();
+    bool isOpen() const { return file_ != nullptr; }
+
+private:
+    std::FILE* file_{nullptr};
+};
+
+// Whole sidecar in one read; empty when it is missing or damaged. A truncated last entry is ignored.
+std::vector<KeyframeEntry> readSegmentIndex(const std::string& segment_path);
+
+// Last keyframe at or before the time, or the first one when the time is before it
+std::optional<KeyframeEntry> findKeyframeByPts(const std::vector<KeyframeEntry>& entries, std::int64_t pts_us);
+std::optional<KeyframeEntry> findKeyframeByUnix(const std::vector<KeyframeEntry>& entries, std::int64_t unix_us);
+
+// Bytes of a Matroska segment up to its first Cluster (EBML header, Segment start, Info, Tracks...),
+// which a player needs in front of data taken from a keyframe offset; empty when it cannot be found
+std::string readMatroskaHeader(const std::string& segment_path);
+
+} // namespace buksan
+
+#endif // SEGMENTINDEX_H
@@ -1,19 +1,468 @@
 #include "StorageManager.h"
+#include "SegmentIndex.h"
+#include "utils/Logger.h"
+#include <algorithm>
+#include <filesystem>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <errno.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
 
 namespace buksan {
 
-StorageManager::StorageManager(const std::string& base_path) : base_path_(base_path) {}
+namespace {
+
+const std::size_t catalog_page_size = 1000;
+
+bool isSegmentFile(const fs::path& path) {
+    const std::string extension = path.extension().string();
+    return extension == ".mkv" || extension == ".mp4";
+}
+
+void lowerIoPriority() {
+#ifdef __linux__
+    // IOPRIO_WHO_PROCESS with pid 0 targets the calling thread; class IDLE only gets otherwise unused disk time
+    const int who_process = 1;
+    const int idle_class = 3 << 13;
+    syscall(SYS_ioprio_set, who_process, 0, idle_class);
+#endif
+}
+
+} // namespace
+
+StorageManager::StorageManager(std::vector<std::string> volumes, const RetentionConfig& retention)
+    : volumes_(std::move(volumes))
+    , retention_(retention)
+{
+    retention_.check_interval_sec = std::max(1, retention_.check_interval_sec);
+    retention_.max_deletes_per_sec = std::max(1, retention_.max_deletes_per_sec);
+    retention_.delete_batch = std::max(1, retention_.delete_batch);
+}
+
+StorageManager::~StorageManager() {
+    stop();
+}
 
 bool StorageManager::ensureDirectory() const {
-    if (base_path_.empty()) return false;
-    struct stat st;
-    if (stat(base_path_.c_str(), &st) == 0) {
-        return S_ISDIR(st.st_mode);
+    if (volumes_.empty()) return false;
+    bool ok = true;
+    for (const auto& volume : volumes_) {
+        struct stat st;
+        if (volume.empty()) {
+            ok = false;
+        } else if (stat(volume.c_str(), &st) == 0) {
+            ok = ok && S_ISDIR(st.st_mode);
+        } else if (mkdir(volume.c_str(), 0755) != 0 && errno != EEXIST) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+std::size_t StorageManager::volumeOf(const std::string& path) const {
+    std::size_t best = 0;
+    std::size_t best_length = 0;
+    for (std::size_t i = 0; i < volumes_.size(); ++i) {
+        const std::string& root = volumes_[i];
+        if (root.size() > best_length && path.compare(0, root.size(), root) == 0) {
+            best = i;
+            best_length = root.size();
+        }
+    }
+    return best;
+}
+
+void StorageManager::setCameraQuota(const std::string& camera_id, const RetentionQuota& quota) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    camera_quotas_[camera_id] = quota;
+    auto it = cameras_.find(camera_id);
+    if (it != cameras_.end()) {
+        it->second.quota = quota;
+    }
+}
+
+void StorageManager::setProtectedPathsLookup(ProtectedPathsLookup lookup) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    protected_lookup_ = std::move(lookup);
+}
+
+void StorageManager::setDeletedPathsHandler(DeletedPathsHandler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deleted_handler_ = std::move(handler);
+}
+
+void StorageManager::setCatalogPageLookup(CatalogPageLookup lookup) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    catalog_lookup_ = std::move(lookup);
+}
+
+void StorageManager::start() {
+    if (running_.exchange(true)) return;
+    scanExisting();
+    thread_ = std::thread(&StorageManager::run, this);
+}
+
+void StorageManager::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_.exchange(false)) return;
+    }
+    wake_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+void StorageManager::segmentClosed(const std::string& camera_id,
+                                   const std::string& path,
+                                   std::uint64_t size_bytes,
+                                   std::chrono::system_clock::time_point end_time,
+                                   bool protected_segment) {
+    SegmentEntry entry;
+    entry.camera_id = camera_id;
+    entry.volume = volumeOf(path);
+    entry.size_bytes = size_bytes;
+    entry.protected_segment = protected_segment;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    addLocked(camera_id, SegmentKey{end_time, path}, std::move(entry));
+}
+
+RetentionStats StorageManager::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    RetentionStats s;
+    s.indexedSegments = segments_.size();
+    s.indexedBytes = total_bytes_;
+    s.protectedSegments = protected_segments_;
+    s.deletedSegments = deleted_segments_;
+    s.deletedBytes = deleted_bytes_;
+    return s;
+}
+
+void StorageManager::addLocked(const std::string& camera_id, SegmentKey key, SegmentEntry entry) {
+    // A path is indexed once; a repeated report replaces the old entry
+    auto known = paths_.find(key.path);
+    if (known != paths_.end()) {
+        const SegmentKey previous = known->second;
+        removeLocked(previous);
+    }
+
+    CameraUsage& usage = cameras_[camera_id];
+    auto quota = camera_quotas_.find(camera_id);
+    if (quota != camera_quotas_.end()) {
+        usage.quota = quota->second;
+    }
+    usage.segments.insert(key);
+    usage.bytes += entry.size_bytes;
+    total_bytes_ += entry.size_bytes;
+    if (entry.protected_segment) ++protected_segments_;
+    paths_[key.path] = key;
+    segments_.emplace(std::move(key), std::move(entry));
+}
+
+void StorageManager::removeLocked(const SegmentKey& key) {
+    auto it = segments_.find(key);
+    if (it == segments_.end()) return;
+    CameraUsage& usage = cameras_[it->second.camera_id];
+    usage.segments.erase(key);
+    usage.bytes -= std::min(usage.bytes, it->second.size_bytes);
+    total_bytes_ -= std::min(total_bytes_, it->second.size_bytes);
+    if (it->second.protected_segment) --protected_segments_;
+    paths_.erase(key.path);
+    segments_.erase(it);
+}
+
+void StorageManager::scanExisting() {
+    for (std::size_t volume = 0; volume < volumes_.size(); ++volume) {
+        const std::string& root = volumes_[volume];
+        std::error_code ec;
+        if (root.empty() || !fs::is_directory(root, ec)) continue;
+
+        std::size_t indexed = 0;
+        for (const auto& camera_dir : fs::directory_iterator(root, ec)) {
+            const std::string camera_id = camera_dir.path().filename().string();
+            if (camera_id.empty() || camera_id[0] == '.' || !camera_dir.is_directory(ec)) continue;
+
+            for (const auto& file : fs::directory_iterator(camera_dir.path(), ec)) {
+                if (!isSegmentFile(file.path())) continue;
+                struct stat st;
+                if (stat(file.path().c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+                SegmentEntry entry;
+                entry.camera_id = camera_id;
+                entry.volume = volume;
+                entry.size_bytes = static_cast<std::uint64_t>(st.st_size);
+                std::lock_guard<std::mutex> lock(mutex_);
+                addLocked(camera_id,
+                          SegmentKey{std::chrono::system_clock::from_time_t(st.st_mtime), file.path().string()},
+                          std::move(entry));
+                ++indexed;
+            }
+        }
+        logInfo("storage") << "indexed " << indexed << " segment(s) in " << root;
+    }
+}
+
+// Only <volume>/<camera>/ paths of cameras known here: other nodes may share the catalog
+bool StorageManager::ownsPath(const std::string& path) const {
+    for (const auto& root : volumes_) {
+        if (root.empty() || path.size() <= root.size() + 1 || path.compare(0, root.size(), root) != 0 ||
+            path[root.size()] != '/') {
+            continue;
+        }
+        const std::size_t camera_end = path.find('/', root.size() + 1);
+        if (camera_end == std::string::npos) return false;
+        const std::string camera_id = path.substr(root.size() + 1, camera_end - root.size() - 1);
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cameras_.count(camera_id) > 0 || camera_quotas_.count(camera_id) > 0;
+    }
+    return false;
+}
+
+bool StorageManager::reconcileCatalog() {
+    CatalogPageLookup lookup;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lookup = catalog_lookup_;
+    }
+    if (!lookup) return true;
+
+    std::size_t missing_total = 0;
+    try {
+        while (running_.load()) {
+            const auto page = lookup(catalog_cursor_, catalog_page_size);
+            std::vector<std::string> missing;
+            for (const auto& [id, path] : page) {
+                catalog_cursor_ = id;
+                if (!ownsPath(path)) continue;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (paths_.count(path)) continue;
+                }
+                std::error_code ec;
+                // An unreadable volume is not proof the file is gone
+                if (fs::exists(path, ec) || ec) continue;
+                missing.push_back(path);
+            }
+            if (!missing.empty()) {
+                missing_total += missing.size();
+                std::lock_guard<std::mutex> lock(mutex_);
+                unreported_deletions_.insert(unreported_deletions_.end(), missing.begin(), missing.end());
+            }
+            if (page.size() < catalog_page_size) {
+                logInfo("storage") << "catalog checked, " << missing_total << " recording(s) without a file";
+                return true;
+            }
+        }
+    } catch (const std::exception& e) {
+        logRepeated(LogLevel::Warn, "storage", "reconcile") << "catalog check postponed: " << e.what();
+    }
+    return false;
+}
+
+std::uint64_t StorageManager::freeBytes(std::size_t volume) const {
+    struct statvfs vfs;
+    if (statvfs(volumes_[volume].c_str(), &vfs) != 0) return UINT64_MAX;
+    return static_cast<std::uint64_t>(vfs.f_bavail) * vfs.f_frsize;
+}
+
+std::vector<StorageManager::SegmentKey> StorageManager::selectCandidates(std::size_t limit, bool& emergency) const {
+    const auto now = std::chrono::system_clock::now();
+    std::vector<std::uint64_t> free_bytes(volumes_.size(), UINT64_MAX);
+    emergency = false;
+    if (retention_.min_free_bytes > 0) {
+        for (std::size_t v = 0; v < volumes_.size(); ++v) {
+            free_bytes[v] = freeBytes(v);
+            emergency = emergency || free_bytes[v] < retention_.min_free_bytes;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<SegmentKey> chosen;
+    std::set<std::string> chosen_paths;
+    auto take = [&](const SegmentKey& key) {
+        if (chosen.size() >= limit || chosen_paths.count(key.path)) return false;
+        chosen.push_back(key);
+        chosen_paths.insert(key.path);
+        return true;
+    };
+    auto deletable = [&](const SegmentKey& key) {
+        auto it = segments_.find(key);
+        return it != segments_.end() && !it->second.protected_segment && !chosen_paths.count(key.path);
+    };
+
+    // Age limits, camera override first
+    for (const auto& [camera_id, usage] : cameras_) {
+        const int days = usage.quota.max_age_days > 0 ? usage.quota.max_age_days : retention_.quota.max_age_days;
+        if (days <= 0) continue;
+        const auto cutoff = now - std::chrono::hours(24 * days);
+        for (const auto& key : usage.segments) {
+            if (key.end_time >= cutoff || chosen.size() >= limit) break;
+            if (deletable(key)) take(key);
+        }
+    }
+
+    // Per-camera byte quotas
+    std::int64_t freed = 0;
+    for (const auto& c : chosen) freed += static_cast<std::int64_t>(segments_.at(c).size_bytes);
+    for (const auto& [camera_id, usage] : cameras_) {
+        if (usage.quota.max_bytes == 0) continue;
+        std::int64_t over = static_cast<std::int64_t>(usage.bytes) - static_cast<std::int64_t>(usage.quota.max_bytes);
+        for (const auto& c : chosen) {
+            const SegmentEntry& e = segments_.at(c);
+            if (e.camera_id == camera_id) over -= static_cast<std::int64_t>(e.size_bytes);
+        }
+        for (const auto& key : usage.segments) {
+            if (over <= 0 || chosen.size() >= limit) break;
+            if (!deletable(key)) continue;
+            const std::int64_t size = static_cast<std::int64_t>(segments_.at(key).size_bytes);
+            take(key);
+            over -= size;
+            freed += size;
+        }
+    }
+
+    // Global byte quota, oldest segment of any camera first
+    if (retention_.quota.max_bytes > 0) {
+        std::int64_t deficit = static_cast<std::int64_t>(total_bytes_) -
+                               static_cast<std::int64_t>(retention_.quota.max_bytes) - freed;
+        for (const auto& [key, entry] : segments_) {
+            if (deficit <= 0 || chosen.size() >= limit) break;
+            if (!deletable(key)) continue;
+            take(key);
+            deficit -= static_cast<std::int64_t>(entry.size_bytes);
+        }
+    }
+
+    // Free-space floor of each volume, counting what is already chosen there
+    for (std::size_t v = 0; v < volumes_.size(); ++v) {
+        if (retention_.min_free_bytes == 0 || free_bytes[v] == UINT64_MAX) continue;
+        std::int64_t deficit = static_cast<std::int64_t>(retention_.min_free_bytes) -
+                               static_cast<std::int64_t>(free_bytes[v]);
+        for (const auto& c : chosen) {
+            const SegmentEntry& e = segments_.at(c);
+            if (e.volume == v) deficit -= static_cast<std::int64_t>(e.size_bytes);
+        }
+        for (const auto& [key, entry] : segments_) {
+            if (deficit <= 0 || chosen.size() >= limit) break;
+            if (entry.volume != v || !deletable(key)) continue;
+            take(key);
+            deficit -= static_cast<std::int64_t>(entry.size_bytes);
+        }
+    }
+
+    return chosen;
+}
+
+bool StorageManager::waitFor(std::chrono::milliseconds delay) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    wake_.wait_for(lock, delay, [this] { return !running_.load(); });
+    return running_.load();
+}
+
+bool StorageManager::deleteSegments(const std::vector<SegmentKey>& candidates, bool emergency) {
+    ProtectedPathsLookup lookup;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lookup = protected_lookup_;
+    }
+
+    std::vector<std::string> paths;
+    paths.reserve(candidates.size());
+    for (const auto& key : candidates) paths.push_back(key.path);
+
+    std::set<std::string> keep;
+    if (lookup) {
+        try {
+            const auto kept = lookup(paths);
+            keep.insert(kept.begin(), kept.end());
+        } catch (const std::exception& e) {
+            if (!emergency) {
+                // Without the catalog a mandatory segment could be lost; wait unless the disk is about to fill
+                logRepeated(LogLevel::Warn, "storage", "postponed") << "retention postponed, catalog unavailable: "
+                                                                    << e.what();
+                return false;
+            }
+            logRepeated(LogLevel::Warn, "storage", "unchecked")
+                << "disk nearly full, deleting without catalog check: " << e.what();
+        }
+    }
+
+    const auto pace = std::chrono::milliseconds(1000 / retention_.max_deletes_per_sec);
+    for (const auto& key : candidates) {
+        if (keep.count(key.path)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = segments_.find(key);
+            if (it != segments_.end() && !it->second.protected_segment) {
+                it->second.protected_segment = true;
+                ++protected_segments_;
+            }
+            continue;
+        }
+        if (!waitFor(pace)) return true;
+
+        std::error_code ec;
+        fs::remove(key.path, ec);
+        if (ec) {
+            logError("storage") << "cannot delete " << key.path << ": " << ec.message();
+        } else {
+            std::error_code index_ec;
+            fs::remove(segmentIndexPath(key.path), index_ec);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = segments_.find(key);
+        if (it == segments_.end()) continue;
+        if (!ec) {
+            ++deleted_segments_;
+            deleted_bytes_ += it->second.size_bytes;
+            unreported_deletions_.push_back(key.path);
+        }
+        // A file that cannot be removed is dropped from the index so it is not retried forever
+        removeLocked(key);
+    }
+    return true;
+}
+
+void StorageManager::run() {
+    lowerIoPriority();
+
+    while (running_.load()) {
+        if (!catalog_reconciled_) {
+            catalog_reconciled_ = reconcileCatalog();
+        }
+        bool emergency = false;
+        const auto candidates = selectCandidates(static_cast<std::size_t>(retention_.delete_batch), emergency);
+        bool postponed = false;
+        if (!candidates.empty()) {
+            postponed = !deleteSegments(candidates, emergency);
+        }
+
+        std::vector<std::string> deleted;
+        DeletedPathsHandler handler;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            deleted.swap(unreported_deletions_);
+            handler = deleted_handler_;
+        }
+        if (!deleted.empty() && handler) {
+            try {
+                handler(deleted);
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                unreported_deletions_.insert(unreported_deletions_.begin(), deleted.begin(), deleted.end());
+            }
+        }
+
+        // A full batch means more is probably due; otherwise, or when the catalog held the batch back,
+        // sleep until the next check
+        if (postponed || candidates.size() < static_cast<std::size_t>(retention_.delete_batch)) {
+            waitFor(std::chrono::seconds(retention_.check_interval_sec));
+        }
     }
-    if (mkdir(base_path_.c_str(), 0755) == 0) return true;
-    return (errno == EEXIST);
 }
 
 } // namespace buksan
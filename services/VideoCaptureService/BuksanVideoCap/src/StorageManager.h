@@ -1,19 +1,133 @@
 #ifndef STORAGEMANAGER_H
 #define STORAGEMANAGER_H
 
+#include "ConfigLoader.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace buksan {
 
+struct RetentionStats {
+    std::uint64_t indexedSegments{0};
+    std::uint64_t indexedBytes{0};
+    std::uint64_t protectedSegments{0};
+    std::uint64_t deletedSegments{0};
+    std::uint64_t deletedBytes{0};
+};
+
+// Returns the subset of paths that must be kept (mandatory mark or alert in the catalog); throws when unknown.
+using ProtectedPathsLookup = std::function<std::vector<std::string>(const std::vector<std::string>&)>;
+// Told about deleted files so the catalog can drop them; throws to have them reported again later.
+using DeletedPathsHandler = std::function<void(const std::vector<std::string>&)>;
+// Pages through the deletable catalog entries: up to `limit` (entry id, path) pairs with id > after,
+// in id order; throws when the catalog is unavailable.
+using CatalogPageLookup =
+    std::function<std::vector<std::pair<std::int64_t, std::string>>(std::int64_t after, std::size_t limit)>;
+
+// Owns the storage volumes and keeps them within the configured quotas.
+// Segment files are indexed once at start() and then only through segmentClosed(), so the
+// retention thread never walks the tree while cameras are writing. Deletion is oldest-first,
+// paced by max_deletes_per_sec and runs at idle I/O priority. Once after start, catalog entries
+// for this node's cameras whose file is gone are reported as deleted so the catalog drops them.
 class StorageManager {
 public:
-    explicit StorageManager(const std::string& base_path);
+    // Byte and age quotas span all volumes; min_free_bytes applies to each volume separately.
+    explicit StorageManager(std::vector<std::string> volumes, const RetentionConfig& retention = {});
+    ~StorageManager();
+
+    StorageManager(const StorageManager&) = delete;
+    StorageManager& operator=(const StorageManager&) = delete;
 
     bool ensureDirectory() const;
-    std::string basePath() const { return base_path_; }
+    const std::vector<std::string>& volumes() const { return volumes_; }
+
+    void setCameraQuota(const std::string& camera_id, const RetentionQuota& quota);
+    void setProtectedPathsLookup(ProtectedPathsLookup lookup);
+    void setDeletedPathsHandler(DeletedPathsHandler handler);
+    void setCatalogPageLookup(CatalogPageLookup lookup);
+
+    // Indexes existing segments and starts the retention thread; call before cameras start writing.
+    void start();
+    void stop();
+
+    void segmentClosed(const std::string& camera_id,
+                       const std::string& path,
+                       std::uint64_t size_bytes,
+                       std::chrono::system_clock::time_point end_time,
+                       bool protected_segment);
+
+    RetentionStats stats() const;
 
 private:
-    std::string base_path_;
+    struct SegmentKey {
+        std::chrono::system_clock::time_point end_time;
+        std::string path;
+        bool operator<(const SegmentKey& other) const {
+            return end_time != other.end_time ? end_time < other.end_time : path < other.path;
+        }
+    };
+
+    struct SegmentEntry {
+        std::string camera_id;
+        std::size_t volume{0};
+        std::uint64_t size_bytes{0};
+        bool protected_segment{false};
+    };
+
+    struct CameraUsage {
+        std::set<SegmentKey> segments;
+        std::uint64_t bytes{0};
+        RetentionQuota quota;
+    };
+
+    void scanExisting();
+    // False while the catalog is unavailable; resumes from catalog_cursor_ next time
+    bool reconcileCatalog();
+    bool ownsPath(const std::string& path) const;
+    void run();
+    std::vector<SegmentKey> selectCandidates(std::size_t limit, bool& emergency) const;
+    std::uint64_t freeBytes(std::size_t volume) const;
+    std::size_t volumeOf(const std::string& path) const;
+    // False when the batch was postponed because the catalog is unavailable
+    bool deleteSegments(const std::vector<SegmentKey>& candidates, bool emergency);
+    void addLocked(const std::string& camera_id, SegmentKey key, SegmentEntry entry);
+    void removeLocked(const SegmentKey& key);
+    bool waitFor(std::chrono::milliseconds delay);
+
+    std::vector<std::string> volumes_;
+    RetentionConfig retention_;
+
+    mutable std::mutex mutex_;
+    std::map<SegmentKey, SegmentEntry> segments_;
+    std::unordered_map<std::string, SegmentKey> paths_;
+    std::unordered_map<std::string, CameraUsage> cameras_;
+    std::unordered_map<std::string, RetentionQuota> camera_quotas_;
+    std::uint64_t total_bytes_{0};
+    std::uint64_t protected_segments_{0};
+    std::uint64_t deleted_segments_{0};
+    std::uint64_t deleted_bytes_{0};
+    std::vector<std::string> unreported_deletions_;
+    ProtectedPathsLookup protected_lookup_;
+    DeletedPathsHandler deleted_handler_;
+    CatalogPageLookup catalog_lookup_;
+    // Retention thread only
+    std::int64_t catalog_cursor_{0};
+    bool catalog_reconciled_{false};
+
+    std::condition_variable wake_;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
 };
 
 } // namespace buksan
@@ -0,0 +1,162 @@
+#include "StorageVolumes.h"
+#include "utils/Logger.h"
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <sys/statvfs.h>
+
+namespace buksan {
+
+namespace {
+const auto failure_cooldown = std::chrono::seconds(30);
+const double throughput_smoothing = 0.2;
+const std::size_t no_volume = std::numeric_limits<std::size_t>::max();
+
+std::uint64_t freeBytesAt(const std::string& path) {
+    struct statvfs vfs;
+    if (statvfs(path.c_str(), &vfs) != 0) return 0;
+    return static_cast<std::uint64_t>(vfs.f_bavail) * vfs.f_frsize;
+}
+}
+
+StorageVolumes::StorageVolumes(std::vector<std::string> paths,
+                               StoragePlacement placement,
+                               std::uint64_t reserve_bytes)
+    : paths_(std::move(paths))
+    , placement_(placement)
+    , reserve_bytes_(reserve_bytes)
+{
+    if (paths_.empty()) {
+        throw std::invalid_argument("StorageVolumes: at least one volume is required");
+    }
+    for (const auto& path : paths_) {
+        Volume volume;
+        volume.path = path;
+        volumes_.push_back(std::move(volume));
+    }
+}
+
+std::size_t StorageVolumes::indexOf(const std::string& root) const {
+    for (std::size_t i = 0; i < paths_.size(); ++i) {
+        if (paths_[i] == root) return i;
+    }
+    return no_volume;
+}
+
+bool StorageVolumes::usableLocked(std::size_t index, std::chrono::steady_clock::time_point now) const {
+    if (now < volumes_[index].failed_until) return false;
+    return reserve_bytes_ == 0 || freeBytesAt(volumes_[index].path) >= reserve_bytes_;
+}
+
+std::size_t StorageVolumes::pickLocked(std::chrono::steady_clock::time_point now) {
+    // Unmeasured volumes are assumed as fast as the fastest one so they get tried
+    double fastest = 0.0;
+    for (const auto& v : volumes_) fastest = std::max(fastest, v.write_bytes_per_sec);
+    if (fastest <= 0.0) fastest = 1.0;
+
+    std::size_t best = no_volume;
+    double best_score = std::numeric_limits<double>::max();
+    std::uint64_t best_free = 0;
+    for (std::size_t i = 0; i < volumes_.size(); ++i) {
+        if (!usableLocked(i, now)) continue;
+        const Volume& v = volumes_[i];
+        const double rate = v.write_bytes_per_sec > 0.0 ? v.write_bytes_per_sec : fastest;
+        const double score = (v.open_segments + 1) / rate;
+        const std::uint64_t free_bytes = freeBytesAt(v.path);
+        if (score < best_score * 0.999 || (score <= best_score * 1.001 && free_bytes > best_free)) {
+            best = i;
+            best_score = score;
+            best_free = free_bytes;
+        }
+    }
+    if (best != no_volume) return best;
+
+    // Every volume is full or failing: prefer one that has not failed recently, then the emptiest
+    bool best_healthy = false;
+    best = 0;
+    best_free = 0;
+    for (std::size_t i = 0; i < volumes_.size(); ++i) {
+        const bool healthy = now >= volumes_[i].failed_until;
+        const std::uint64_t free_bytes = freeBytesAt(volumes_[i].path);
+        if ((healthy && !best_healthy) || (healthy == best_healthy && free_bytes > best_free)) {
+            best = i;
+            best_healthy = healthy;
+            best_free = free_bytes;
+        }
+    }
+    return best;
+}
+
+std::string StorageVolumes::acquire(const std::string& camera_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = std::chrono::steady_clock::now();
+
+    std::size_t index = no_volume;
+    if (placement_ == StoragePlacement::PerCamera) {
+        auto it = assignments_.find(camera_id);
+        if (it != assignments_.end() && usableLocked(it->second, now)) {
+            index = it->second;
+        }
+    }
+    if (index == no_volume) {
+        index = pickLocked(now);
+        if (placement_ == StoragePlacement::PerCamera) {
+            auto it = assignments_.find(camera_id);
+            if (it != assignments_.end() && it->second != index) {
+                logInfo(camera_id) << "moving recordings from " << volumes_[it->second].path
+                                   << " to " << volumes_[index].path;
+            }
+            assignments_[camera_id] = index;
+        }
+    }
+    ++volumes_[index].open_segments;
+    return volumes_[index].path;
+}
+
+void StorageVolumes::release(const std::string& root, std::uint64_t bytes, std::chrono::nanoseconds write_time) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::size_t index = indexOf(root);
+    if (index == no_volume) return;
+    Volume& v = volumes_[index];
+    if (v.open_segments > 0) --v.open_segments;
+    if (bytes == 0 || write_time.count() <= 0) return;
+
+    const double rate = bytes / std::chrono::duration<double>(write_time).count();
+    v.write_bytes_per_sec = v.write_bytes_per_sec > 0.0
+        ? v.write_bytes_per_sec + throughput_smoothing * (rate - v.write_bytes_per_sec)
+        : rate;
+}
+
+void StorageVolumes::markFailed(const std::string& root) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::size_t index = indexOf(root);
+    if (index == no_volume) return;
+    volumes_[index].failed_until = std::chrono::steady_clock::now() + failure_cooldown;
+    ++volumes_[index].failures;
+    for (auto it = assignments_.begin(); it != assignments_.end();) {
+        it = it->second == index ? assignments_.erase(it) : std::next(it);
+    }
+    logError("storage") << "volume " << root << " failed, out of rotation for "
+                        << failure_cooldown.count() << "s";
+}
+
+std::vector<VolumeStats> StorageVolumes::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<VolumeStats> result;
+    result.reserve(volumes_.size());
+    for (const auto& v : volumes_) {
+        VolumeStats s;
+        s.path = v.path;
+        s.healthy = now >= v.failed_until;
+        s.freeBytes = freeBytesAt(v.path);
+        s.writeBytesPerSec = v.write_bytes_per_sec;
+        s.openSegments = v.open_segments;
+        s.failures = v.failures;
+        result.push_back(std::move(s));
+    }
+    return result;
+}
+
+} // namespace buksan
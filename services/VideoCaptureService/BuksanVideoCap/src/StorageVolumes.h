@@ -0,0 +1,70 @@
+#ifndef STORAGEVOLUMES_H
+#define STORAGEVOLUMES_H
+
+#include "ConfigLoader.h"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace buksan {
+
+struct VolumeStats {
+    std::string path;
+    bool healthy{true};
+    std::uint64_t freeBytes{0};
+    double writeBytesPerSec{0.0};
+    unsigned openSegments{0};
+    std::uint64_t failures{0};
+};
+
+// Chooses the volume each new segment is written to. A volume is skipped while its free space is
+// below the reserve and for a cool-down period after an I/O error. Among the rest, the one with the
+// fewest open segments per unit of measured write throughput wins, so writers spread over spindles
+// in proportion to how fast each one drains.
+class StorageVolumes {
+public:
+    explicit StorageVolumes(std::vector<std::string> paths,
+                            StoragePlacement placement = StoragePlacement::PerCamera,
+                            std::uint64_t reserve_bytes = 0);
+
+    StorageVolumes(const StorageVolumes&) = delete;
+    StorageVolumes& operator=(const StorageVolumes&) = delete;
+
+    // Returns the volume root for the next segment of the camera; pair with release().
+    std::string acquire(const std::string& camera_id);
+    // Called when the segment is closed with the bytes written and the time spent writing them.
+    void release(const std::string& root, std::uint64_t bytes, std::chrono::nanoseconds write_time);
+    // Takes the volume out of rotation for a while and moves cameras pinned to it elsewhere.
+    void markFailed(const std::string& root);
+
+    const std::vector<std::string>& paths() const { return paths_; }
+    std::vector<VolumeStats> stats() const;
+
+private:
+    struct Volume {
+        std::string path;
+        unsigned open_segments{0};
+        double write_bytes_per_sec{0.0};
+        std::chrono::steady_clock::time_point failed_until{};
+        std::uint64_t failures{0};
+    };
+
+    std::size_t pickLocked(std::chrono::steady_clock::time_point now);
+    bool usableLocked(std::size_t index, std::chrono::steady_clock::time_point now) const;
+    std::size_t indexOf(const std::string& root) const;
+
+    std::vector<std::string> paths_;
+    StoragePlacement placement_;
+    std::uint64_t reserve_bytes_;
+
+    mutable std::mutex mutex_;
+    std::vector<Volume> volumes_;
+    std::unordered_map<std::string, std::size_t> assignments_;
+};
+
+} // namespace buksan
+
+#endif // STORAGEVOLUMES_H
@@ -0,0 +1,524 @@
+#include "ThumbnailCache.h"
+#include "FrameDecoder.h"
+#include "utils/Logger.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+namespace buksan {
+
+namespace fs = std::filesystem;
+
+namespace {
+// JPEG caps both dimensions at 65535 pixels
+const int max_sprite_pixels = 65500;
+
+std::string hashPath(const std::string& path) {
+    std::uint64_t hash = 1469598103934665603ull;
+    for (const unsigned char c : path) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return hex;
+}
+
+std::string encodeJpeg(const cv::Mat& image, int quality) {
+    std::vector<unsigned char> buffer;
+    if (!cv::imencode(".jpg", image, buffer, {cv::IMWRITE_JPEG_QUALITY, std::clamp(quality, 1, 100)})) {
+        return {};
+    }
+    return std::string(buffer.begin(), buffer.end());
+}
+
+// Stem of a disk cache file: <path hash>-<segment size>-<count>x<tile height>
+bool parseDiskName(const std::string& stem, std::string& key_part, int& count, int& tile_height) {
+    const auto dims = stem.rfind('-');
+    if (dims == std::string::npos) return false;
+    if (std::sscanf(stem.c_str() + dims + 1, "%dx%d", &count, &tile_height) != 2) return false;
+    key_part = stem.substr(0, dims);
+    return count > 0 && tile_height > 0;
+}
+}
+
+ThumbnailCache::ThumbnailCache(const ThumbnailConfig& config, const std::string& cache_dir)
+    : config_(config)
+    , cache_dir_(cache_dir)
+    , memory_budget_(static_cast<std::uint64_t>(std::max(0, config.memory_mb)) * 1024 * 1024)
+    , disk_budget_(static_cast<std::uint64_t>(std::max(0, config.disk_mb)) * 1024 * 1024)
+    , hits_(metrics().counter("buksan_thumbnail_cache_hits_total", "Thumbnail sprites served from cache"))
+    , misses_(metrics().counter("buksan_thumbnail_cache_misses_total", "Thumbnail sprites built from segments"))
+    , build_seconds_(metrics().histogram("buksan_thumbnail_build_seconds", "Time to build one segment's thumbnails"))
+{
+    if (config_.widths.empty()) config_.widths.push_back(160);
+    config_.interval_sec = std::max(1, config_.interval_sec);
+    config_.columns = std::max(1, config_.columns);
+    config_.max_tiles = std::max(1, config_.max_tiles);
+    if (!cache_dir_.empty()) {
+        try {
+            scanDisk();
+        } catch (const std::exception& e) {
+            logWarn("thumbnails") << "disk cache " << cache_dir_ << " unavailable: " << e.what();
+            cache_dir_.clear();
+        }
+    }
+    for (int i = 0; i < std::max(1, config_.workers); ++i) {
+        workers_.emplace_back(&ThumbnailCache::runWorker, this);
+    }
+}
+
+ThumbnailCache::~ThumbnailCache() {
+    stop();
+}
+
+bool ThumbnailCache::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex_);
+        if (stopping_) return false;
+        jobs_.push_back(std::move(job));
+    }
+    jobs_wake_.notify_one();
+    return true;
+}
+
+void ThumbnailCache::stop() {
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex_);
+        if (stopping_) return;
+        stopping_ = true;
+        jobs_.clear();
+    }
+    jobs_wake_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+void ThumbnailCache::runWorker() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex_);
+            jobs_wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        try {
+            job();
+        } catch (const std::exception& e) {
+            logError("thumbnails") << "thumbnail job failed: " << e.what();
+        }
+    }
+}
+
+int ThumbnailCache::tileWidth(int requested) const {
+    int best = config_.widths.front();
+    for (const int width : config_.widths) {
+        if (requested <= 0 ? width < best : std::abs(width - requested) < std::abs(best - requested)) {
+            best = width;
+        }
+    }
+    return best;
+}
+
+std::shared_ptr<const ThumbnailSprite> ThumbnailCache::segmentSprite(const std::string& path, int width) {
+    width = tileWidth(width);
+    std::error_code ec;
+    const auto size = fs::file_size(path, ec);
+    if (ec) return nullptr;
+    // A rewritten file gets a new key
+    const std::string key = std::to_string(width) + "/" + hashPath(path) + "-" + std::to_string(size);
+
+    if (auto sprite = findInMemory(key)) {
+        hits_.inc();
+        return sprite;
+    }
+    if (auto sprite = loadFromDisk(key, width)) {
+        hits_.inc();
+        putInMemory(key, sprite);
+        return sprite;
+    }
+
+    std::promise<std::shared_ptr<const ThumbnailSprite>> promise;
+    {
+        std::unique_lock<std::mutex> lock(building_mutex_);
+        const auto it = building_.find(key);
+        if (it != building_.end()) {
+            auto pending = it->second;
+            lock.unlock();
+            hits_.inc();
+            return pending.get();
+        }
+        building_.emplace(key, promise.get_future().share());
+    }
+
+    misses_.inc();
+    std::shared_ptr<const ThumbnailSprite> sprite;
+    try {
+        ScopedTimer timer(build_seconds_);
+        sprite = build(path, width);
+        if (sprite) {
+            putInMemory(key, sprite);
+            storeOnDisk(key, *sprite, width);
+        }
+    } catch (...) {
+        sprite.reset();
+    }
+    promise.set_value(sprite);
+    std::lock_guard<std::mutex> lock(building_mutex_);
+    building_.erase(key);
+    return sprite;
+}
+
+std::shared_ptr<const ThumbnailSprite> ThumbnailCache::build(const std::string& path, int width) const {
+    AVFormatContext* format = nullptr;
+    if (avformat_open_input(&format, path.c_str(), nullptr, nullptr) < 0) {
+        logWarn("thumbnails") << "cannot open " << path;
+        return nullptr;
+    }
+    std::unique_ptr<AVFormatContext, void (*)(AVFormatContext*)> input(format, [](AVFormatContext* f) {
+        avformat_close_input(&f);
+    });
+    if (avformat_find_stream_info(format, nullptr) < 0) return nullptr;
+    const int index = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (index < 0) return nullptr;
+    const AVStream* stream = format->streams[index];
+
+    StreamInfo info;
+    AVCodecParameters* params = avcodec_parameters_alloc();
+    if (!params || avcodec_parameters_copy(params, stream->codecpar) < 0) {
+        avcodec_parameters_free(&params);
+        return nullptr;
+    }
+    info.codecParameters = std::shared_ptr<AVCodecParameters>(params, [](AVCodecParameters* p) {
+        avcodec_parameters_free(&p);
+    });
+    info.timeBase = stream->time_base;
+    std::unique_ptr<FrameDecoder> decoder;
+    try {
+        decoder = std::make_unique<FrameDecoder>(info, width);
+    } catch (const std::exception& e) {
+        logWarn("thumbnails") << path << ": " << e.what();
+        return nullptr;
+    }
+
+    double duration = format->duration != AV_NOPTS_VALUE ? static_cast<double>(format->duration) / AV_TIME_BASE : 0.0;
+    if (stream->duration != AV_NOPTS_VALUE) {
+        duration = std::max(duration, stream->duration * av_q2d(stream->time_base));
+    }
+    const int interval = config_.interval_sec;
+    const int count = std::clamp(static_cast<int>(std::ceil(duration / interval)), 1, max_sprite_pixels / width);
+    const std::int64_t origin = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+
+    std::vector<cv::Mat> tiles(static_cast<std::size_t>(count));
+    cv::Size tile_size;
+    cv::Mat last;
+    std::int64_t last_pts = AV_NOPTS_VALUE;
+    bool seekable = true;
+    AVPacket* packet = av_packet_alloc();
+    if (!packet) return nullptr;
+
+    for (int k = 0; k < count; ++k) {
+        const std::int64_t target = origin + av_rescale_q(static_cast<std::int64_t>(k) * interval,
+                                                          AVRational{1, 1}, stream->time_base);
+        // Through the container's index when it has one; otherwise read on to the next keyframe
+        if (seekable && av_seek_frame(format, index, target, AVSEEK_FLAG_BACKWARD) < 0) {
+            seekable = false;
+        }
+        bool found = false;
+        while (av_read_frame(format, packet) >= 0) {
+            const std::int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            if (packet->stream_index == index && (packet->flags & AV_PKT_FLAG_KEY) &&
+                (seekable || pts == AV_NOPTS_VALUE || pts >= target)) {
+                found = true;
+                break;
+            }
+            av_packet_unref(packet);
+        }
+        if (!found) break;
+
+        const std::int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        if (pts != AV_NOPTS_VALUE && pts == last_pts) {
+            // A GOP longer than the interval: same keyframe as the previous tile
+            av_packet_unref(packet);
+            tiles[static_cast<std::size_t>(k)] = last;
+            continue;
+        }
+        last_pts = pts;
+
+        AVPacket* owned = av_packet_alloc();
+        if (!owned) {
+            av_packet_unref(packet);
+            break;
+        }
+        av_packet_move_ref(owned, packet);
+        MediaPacket media;
+        media.keyframe = true;
+        media.data = std::shared_ptr<const AVPacket>(owned, [](const AVPacket* p) {
+            AVPacket* freed = const_cast<AVPacket*>(p);
+            av_packet_free(&freed);
+        });
+        cv::Mat frame;
+        if (!decoder->decodeKeyframe(media, &frame) || frame.empty()) continue;
+        if (tile_size.width == 0) {
+            tile_size = cv::Size(width, std::max(2, frame.rows * width / std::max(1, frame.cols)));
+        }
+        if (frame.size() != tile_size) {
+            cv::Mat scaled;
+            cv::resize(frame, scaled, tile_size, 0, 0, cv::INTER_AREA);
+            frame = scaled;
+        }
+        last = frame;
+        tiles[static_cast<std::size_t>(k)] = frame;
+    }
+    av_packet_free(&packet);
+    if (tile_size.width == 0) return nullptr;
+
+    // Slots without a keyframe of their own show the nearest earlier one
+    cv::Mat sheet(tile_size.height, tile_size.width * count, CV_8UC3, cv::Scalar::all(0));
+    cv::Mat previous;
+    for (int k = 0; k < count; ++k) {
+        cv::Mat tile = tiles[static_cast<std::size_t>(k)].empty() ? previous : tiles[static_cast<std::size_t>(k)];
+        if (tile.empty()) {
+            tile = *std::find_if(tiles.begin(), tiles.end(), [](const cv::Mat& t) { return !t.empty(); });
+        }
+        tile.copyTo(sheet(cv::Rect(k * tile_size.width, 0, tile_size.width, tile_size.height)));
+        previous = tile;
+    }
+
+    auto sprite = std::make_shared<ThumbnailSprite>();
+    sprite->jpeg = encodeJpeg(sheet, config_.jpeg_quality);
+    sprite->tile_width = tile_size.width;
+    sprite->tile_height = tile_size.height;
+    sprite->count = count;
+    if (sprite->jpeg.empty()) return nullptr;
+    return sprite;
+}
+
+std::optional<ThumbnailSheet> ThumbnailCache::rangeSheet(const std::vector<ThumbnailSource>& sources,
+                                                         std::int64_t from_unix, std::int64_t to_unix, int width) {
+    if (sources.empty() || to_unix <= from_unix) return std::nullopt;
+    width = tileWidth(width);
+
+    // A long range spaces its tiles out instead of growing the sheet
+    const std::int64_t span = to_unix - from_unix;
+    const std::int64_t base = config_.interval_sec;
+    const std::int64_t wanted = (span + base - 1) / base;
+    const std::int64_t step = base * ((wanted + config_.max_tiles - 1) / config_.max_tiles);
+    const int count = static_cast<int>((span + step - 1) / step);
+
+    std::vector<std::shared_ptr<const ThumbnailSprite>> sprites(sources.size());
+    std::vector<cv::Mat> decoded(sources.size());
+    std::vector<bool> tried(sources.size(), false);
+    std::vector<cv::Mat> tiles(static_cast<std::size_t>(count));
+    cv::Size tile_size;
+
+    std::size_t source = 0;
+    for (int i = 0; i < count; ++i) {
+        const std::int64_t at = from_unix + i * step;
+        // The last segment that started by then
+        while (source + 1 < sources.size() && sources[source + 1].start_unix <= at) ++source;
+        if (sources[source].start_unix > at) continue;
+
+        if (!tried[source]) {
+            tried[source] = true;
+            sprites[source] = segmentSprite(sources[source].path, width);
+            if (sprites[source]) {
+                const std::vector<unsigned char> bytes(sprites[source]->jpeg.begin(), sprites[source]->jpeg.end());
+                decoded[source] = cv::imdecode(bytes, cv::IMREAD_COLOR);
+            }
+        }
+        const auto& sprite = sprites[source];
+        if (!sprite || decoded[source].empty()) continue;
+        const std::int64_t slot = (at - sources[source].start_unix) / base;
+        // Past the end of the segment: a gap in the recording
+        if (slot >= sprite->count) continue;
+
+        const cv::Rect rect(static_cast<int>(slot) * sprite->tile_width, 0, sprite->tile_width, sprite->tile_height);
+        tiles[static_cast<std::size_t>(i)] = decoded[source](rect);
+        if (tile_size.width == 0) tile_size = rect.size();
+    }
+    if (tile_size.width == 0) return std::nullopt;
+
+    ThumbnailSheet sheet;
+    sheet.tile_width = tile_size.width;
+    sheet.tile_height = tile_size.height;
+    sheet.columns = std::min(config_.columns, count);
+    sheet.count = count;
+    sheet.interval_sec = static_cast<int>(step);
+    const int rows = (count + sheet.columns - 1) / sheet.columns;
+    cv::Mat image(rows * tile_size.height, sheet.columns * tile_size.width, CV_8UC3, cv::Scalar::all(0));
+    for (int i = 0; i < count; ++i) {
+        cv::Mat tile = tiles[static_cast<std::size_t>(i)];
+        if (tile.empty()) continue;
+        if (tile.size() != tile_size) {
+            // A camera whose resolution changed in between
+            cv::Mat scaled;
+            cv::resize(tile, scaled, tile_size, 0, 0, cv::INTER_AREA);
+            tile = scaled;
+        }
+        const cv::Rect rect((i % sheet.columns) * tile_size.width, (i / sheet.columns) * tile_size.height,
+                            tile_size.width, tile_size.height);
+        tile.copyTo(image(rect));
+    }
+    sheet.jpeg = encodeJpeg(image, config_.jpeg_quality);
+    if (sheet.jpeg.empty()) return std::nullopt;
+    return sheet;
+}
+
+std::shared_ptr<const ThumbnailSprite> ThumbnailCache::findInMemory(const std::string& key) {
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    auto it = memory_index_.find(key);
+    if (it == memory_index_.end()) return nullptr;
+    memory_.splice(memory_.begin(), memory_, it->second);
+    return it->second->second;
+}
+
+void ThumbnailCache::putInMemory(const std::string& key, std::shared_ptr<const ThumbnailSprite> sprite) {
+    const std::uint64_t bytes = sprite->jpeg.size();
+    if (bytes > memory_budget_) return;
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    if (memory_index_.count(key)) return;
+    memory_.emplace_front(key, std::move(sprite));
+    memory_index_[key] = memory_.begin();
+    memory_bytes_ += bytes;
+    while (memory_bytes_ > memory_budget_ && !memory_.empty()) {
+        memory_bytes_ -= memory_.back().second->jpeg.size();
+        memory_index_.erase(memory_.back().first);
+        memory_.pop_back();
+    }
+}
+
+std::shared_ptr<const ThumbnailSprite> ThumbnailCache::loadFromDisk(const std::string& key, int width) {
+    if (cache_dir_.empty()) return nullptr;
+    DiskEntry entry;
+    {
+        std::lock_guard<std::mutex> lock(disk_mutex_);
+        auto it = disk_index_.find(key);
+        if (it == disk_index_.end()) return nullptr;
+        disk_.splice(disk_.begin(), disk_, it->second);
+        entry = it->second->second;
+    }
+
+    std::ifstream in(entry.file, std::ios::binary);
+    auto sprite = std::make_shared<ThumbnailSprite>();
+    sprite->jpeg.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (!in.good() && !in.eof()) sprite->jpeg.clear();
+    if (sprite->jpeg.empty()) {
+        std::lock_guard<std::mutex> lock(disk_mutex_);
+        auto it = disk_index_.find(key);
+        if (it != disk_index_.end()) {
+            disk_bytes_ -= it->second->second.bytes;
+            disk_.erase(it->second);
+            disk_index_.erase(it);
+        }
+        return nullptr;
+    }
+    // The file's age orders the cache again after a restart
+    std::error_code ec;
+    fs::last_write_time(entry.file, fs::file_time_type::clock::now(), ec);
+    sprite->tile_width = width;
+    sprite->tile_height = entry.tile_height;
+    sprite->count = entry.count;
+    return sprite;
+}
+
+void ThumbnailCache::storeOnDisk(const std::string& key, const ThumbnailSprite& sprite, int width) {
+    if (cache_dir_.empty() || sprite.jpeg.size() > disk_budget_) return;
+    const fs::path dir = fs::path(cache_dir_) / std::to_string(width);
+    const std::string stem = key.substr(key.find('/') + 1);
+    const fs::path file = dir / (stem + "-" + std::to_string(sprite.count) + "x" +
+                                 std::to_string(sprite.tile_height) + ".jpg");
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    {
+        // Written aside and renamed, so a crash never leaves a torn sprite under the real name
+        const fs::path partial = file.string() + ".part";
+        std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+        out.write(sprite.jpeg.data(), static_cast<std::streamsize>(sprite.jpeg.size()));
+        out.close();
+        if (out) {
+            fs::rename(partial, file, ec);
+        }
+        if (!out || ec) {
+            fs::remove(partial, ec);
+            logRepeated(LogLevel::Warn, "thumbnails", "store") << "cannot write " << file.string();
+            return;
+        }
+    }
+
+    std::vector<std::string> evicted;
+    {
+        std::lock_guard<std::mutex> lock(disk_mutex_);
+        if (disk_index_.count(key)) return;
+        disk_.emplace_front(key, DiskEntry{file.string(), sprite.jpeg.size(), sprite.count, sprite.tile_height});
+        disk_index_[key] = disk_.begin();
+        disk_bytes_ += sprite.jpeg.size();
+        while (disk_bytes_ > disk_budget_ && disk_.size() > 1) {
+            disk_bytes_ -= disk_.back().second.bytes;
+            evicted.push_back(disk_.back().second.file);
+            disk_index_.erase(disk_.back().first);
+            disk_.pop_back();
+        }
+    }
+    for (const auto& path : evicted) {
+        fs::remove(path, ec);
+    }
+}
+
+void ThumbnailCache::scanDisk() {
+    fs::create_directories(cache_dir_);
+    struct Found {
+        std::string key;
+        DiskEntry entry;
+        fs::file_time_type used;
+    };
+    std::vector<Found> found;
+    for (const auto& dir : fs::directory_iterator(cache_dir_)) {
+        if (!dir.is_directory()) continue;
+        const std::string width = dir.path().filename().string();
+        for (const auto& file : fs::directory_iterator(dir.path())) {
+            std::error_code ec;
+            if (file.path().extension() != ".jpg") {
+                // Leftovers of an interrupted write
+                if (file.path().extension() == ".part") fs::remove(file.path(), ec);
+                continue;
+            }
+            Found item;
+            std::string key_part;
+            if (!parseDiskName(file.path().stem().string(), key_part, item.entry.count, item.entry.tile_height)) continue;
+            item.key = width + "/" + key_part;
+            item.entry.file = file.path().string();
+            item.entry.bytes = file.file_size(ec);
+            item.used = file.last_write_time(ec);
+            if (!ec) found.push_back(std::move(item));
+        }
+    }
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.used > b.used; });
+
+    std::lock_guard<std::mutex> lock(disk_mutex_);
+    for (auto& item : found) {
+        if (disk_bytes_ + item.entry.bytes > disk_budget_ || disk_index_.count(item.key)) {
+            std::error_code ec;
+            fs::remove(item.entry.file, ec);
+            continue;
+        }
+        disk_bytes_ += item.entry.bytes;
+        disk_.emplace_back(item.key, std::move(item.entry));
+        disk_index_[disk_.back().first] = std::prev(disk_.end());
+    }
+    logInfo("thumbnails") << disk_.size() << " cached sprite(s) in " << cache_dir_;
+}
+
+} // namespace buksan
@@ -0,0 +1,124 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include "ConfigLoader.h"
+#include "utils/Metrics.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace buksan {
+
+// Thumbnails of one segment in a single row of equal tiles; tile k shows the keyframe at or
+// before start + k * interval
+struct ThumbnailSprite {
+    std::string jpeg;
+    int tile_width{0};
+    int tile_height{0};
+    int count{0};
+};
+
+// A range of footage as one sheet: tile i shows from + i * interval_sec, in rows of `columns`.
+// Tiles with no footage are black.
+struct ThumbnailSheet {
+    std::string jpeg;
+    int tile_width{0};
+    int tile_height{0};
+    int columns{0};
+    int count{0};
+    int interval_sec{0};
+};
+
+struct ThumbnailSource {
+    std::string path;
+    std::int64_t start_unix{0};
+};
+
+// Segment sprites are made on first request by decoding only keyframes, scaled to the tile width,
+// and kept in two LRU caches with byte budgets: encoded JPEGs in memory and files on disk, which
+// survive restarts. A sprite is keyed by segment path, size and tile width; concurrent requests
+// for one key share a single build. Builds run on the cache's own worker threads via submit().
+class ThumbnailCache {
+public:
+    // An empty cache_dir keeps sprites in memory only
+    ThumbnailCache(const ThumbnailConfig& config, const std::string& cache_dir);
+    ~ThumbnailCache();
+
+    ThumbnailCache(const ThumbnailCache&) = delete;
+    ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+    // The configured width nearest to the requested one (0 picks the smallest)
+    int tileWidth(int requested) const;
+
+    // nullptr when the segment cannot be read
+    std::shared_ptr<const ThumbnailSprite> segmentSprite(const std::string& path, int width);
+    // Sources in time order; nullopt when none of them yields a thumbnail
+    std::optional<ThumbnailSheet> rangeSheet(const std::vector<ThumbnailSource>& sources,
+                                             std::int64_t from_unix, std::int64_t to_unix, int width);
+
+    // Runs the job on a worker thread; false once stopping
+    bool submit(std::function<void()> job);
+    // Joins the workers; queued jobs are dropped
+    void stop();
+
+private:
+    struct DiskEntry {
+        std::string file;
+        std::uint64_t bytes{0};
+        int count{0};
+        int tile_height{0};
+    };
+    using MemoryList = std::list<std::pair<std::string, std::shared_ptr<const ThumbnailSprite>>>;
+    using DiskList = std::list<std::pair<std::string, DiskEntry>>;
+
+    std::shared_ptr<const ThumbnailSprite> build(const std::string& path, int width) const;
+    std::shared_ptr<const ThumbnailSprite> findInMemory(const std::string& key);
+    void putInMemory(const std::string& key, std::shared_ptr<const ThumbnailSprite> sprite);
+    std::shared_ptr<const ThumbnailSprite> loadFromDisk(const std::string& key, int width);
+    void storeOnDisk(const std::string& key, const ThumbnailSprite& sprite, int width);
+    void scanDisk();
+    void runWorker();
+
+    ThumbnailConfig config_;
+    std::string cache_dir_;
+    std::uint64_t memory_budget_;
+    std::uint64_t disk_budget_;
+    Counter& hits_;
+    Counter& misses_;
+    Histogram& build_seconds_;
+
+    // Front is the most recently used
+    mutable std::mutex memory_mutex_;
+    MemoryList memory_;
+    std::unordered_map<std::string, MemoryList::iterator> memory_index_;
+    std::uint64_t memory_bytes_{0};
+
+    mutable std::mutex disk_mutex_;
+    DiskList disk_;
+    std::unordered_map<std::string, DiskList::iterator> disk_index_;
+    std::uint64_t disk_bytes_{0};
+
+    // Builds in progress, so a second request for the key waits for the first
+    std::mutex building_mutex_;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<const ThumbnailSprite>>> building_;
+
+    std::mutex jobs_mutex_;
+    std::condition_variable jobs_wake_;
+    std::deque<std::function<void()>> jobs_;
+    bool stopping_{false};
+    std::vector<std::thread> workers_;
+};
+
+} // namespace buksan
+
+#endif // THUMBNAILCACHE_H
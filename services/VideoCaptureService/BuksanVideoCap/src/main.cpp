@@ -1,5 +1,7 @@
 #include "ConfigLoader.h"
 #include "StorageManager.h"
+#include "StorageVolumes.h"
+#include "ThumbnailCache.h"
 #include "core/CameraManager.h"
 #include "db/PostgresConnectionPool.h"
 #include "repositories/postgres/PostgresCameraRepository.h"
@@ -9,16 +11,25 @@
 #include "services/MetadataSyncWorker.h"
 #include "services/NodeService.h"
 #include "services/RecordingService.h"
+#include "services/SegmentRegistrar.h"
+#include "utils/FileMetadataSyncQueue.h"
 #include "utils/InMemoryMetadataSyncQueue.h"
+#include "utils/Logger.h"
+#include "utils/Metrics.h"
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <csignal>
 #include <cstdlib>
 #include <fstream>
-#include <iostream>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #ifdef __linux__
 #include <unistd.h>
 #endif
@@ -30,16 +41,11 @@
 namespace {
 
 std::atomic<bool> shutdown_requested{false};
-buksan::CameraManager* g_manager = nullptr;
 
+// Only raises the flag: main() stops the cameras and drains the catalog writers itself. Once the
+// API runs, Crow takes SIGINT/SIGTERM over and run() returns instead.
 void signalHandler(int) {
     shutdown_requested.store(true);
-    if (g_manager) {
-        g_manager->stopAll();
-    }
-#ifdef BUKSAN_BUILD_API
-    exit(0);
-#endif
 }
 
 std::string findConfigPath(const std::string& fromArg) {
@@ -96,8 +102,11 @@ int main(int argc, char* argv[]) {
     std::unique_ptr<buksan::RecordingService> recordingService;
     std::unique_ptr<buksan::CameraService> cameraService;
     std::unique_ptr<buksan::NodeService> nodeService;
-    std::shared_ptr<buksan::InMemoryMetadataSyncQueue> metadataQueue;
+    std::shared_ptr<buksan::IMetadataSyncQueue> metadataQueue;
     std::unique_ptr<buksan::MetadataSyncWorker> metadataSyncWorker;
+    // Outlives the camera manager, which hands it the segments closed while cameras shut down
+    std::unique_ptr<buksan::SegmentRegistrar> segmentRegistrar;
+    std::unique_ptr<buksan::StorageManager> storage;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -119,56 +128,105 @@ int main(int argc, char* argv[]) {
     config_path = findConfigPath(config_path);
 
     buksan::CameraManager manager;
-    g_manager = &manager;
 
     std::signal(SIGINT, signalHandler);
     std::signal(SIGTERM, signalHandler);
 
     buksan::ConfigLoader loader(config_path);
     if (!loader.loaded()) {
-        std::cout << "Config error: " << loader.error() << " (file: " << config_path << ")" << std::endl;
+        buksan::logError("main") << "Config error: " << loader.error() << " (file: " << config_path << ")";
         return 1;
     }
-    int started = 0;
-    {
-        const auto& config = loader.config();
-        if (!config.storage_path.empty()) {
-            buksan::StorageManager storage(config.storage_path);
-            storage.ensureDirectory();
-            for (const auto& cam : config.cameras) {
-                if (cam.rtsp_url.empty()) continue;
-                if (manager.addCamera(cam.id, cam.rtsp_url, config.storage_path, 300)) {
-                    manager.startRecording(cam.id);
-                    ++started;
-                }
-            }
-        }
+    buksan::Logger::instance().configure(loader.config().log);
+    for (const auto& warning : loader.warnings()) {
+        buksan::logWarn("config") << warning;
     }
-    if (started > 0) {
-        std::cout << "Started " << started << " camera(s) from " << config_path << std::endl;
+    // Retention does not depend on the database: without the recording service the catalog
+    // callbacks throw, and StorageManager postpones what needs them
+    const std::string storagePath = loader.config().storage_path;
+    if (!storagePath.empty()) {
+        storage = std::make_unique<buksan::StorageManager>(loader.config().storage_volumes,
+                                                           loader.config().retention);
+        storage->ensureDirectory();
+        for (const auto& configCamera : loader.config().cameras) {
+            storage->setCameraQuota(configCamera.id, configCamera.retention);
+        }
+        storage->setProtectedPathsLookup([&recordingService](const std::vector<std::string>& paths) {
+            if (!recordingService) {
+                throw std::runtime_error("recording catalog unavailable");
+            }
+            return recordingService->findProtectedMediaFiles(paths);
+        });
+        storage->setDeletedPathsHandler([&recordingService](const std::vector<std::string>& paths) {
+            if (!recordingService) {
+                throw std::runtime_error("recording catalog unavailable");
+            }
+            recordingService->forgetMediaFiles(paths);
+        });
+        storage->setCatalogPageLookup([&recordingService](std::int64_t after, std::size_t limit) {
+            if (!recordingService) {
+                throw std::runtime_error("recording catalog unavailable");
+            }
+            std::vector<std::pair<std::int64_t, std::string>> page;
+            for (auto& ref : recordingService->listDeletableMediaFiles(after, limit)) {
+                page.emplace_back(ref.recordId, std::move(ref.mediaFile));
+            }
+            return page;
+        });
+        buksan::metrics().gaugeFunction("buksan_storage_indexed_bytes", "Bytes of recordings under retention", {},
+                                        [storage = storage.get()] {
+                                            return static_cast<double>(storage->stats().indexedBytes);
+                                        });
+        buksan::metrics().gaugeFunction("buksan_retention_deleted_bytes", "Bytes removed by retention since start", {},
+                                        [storage = storage.get()] {
+                                            return static_cast<double>(storage->stats().deletedBytes);
+                                        });
     }
 
     try {
         const std::string dbConnectionString = readEnvOrDefault(
             "BUKSAN_PG_DSN",
             "dbname=buksanspy user=postgres password=postgres host=127.0.0.1 port=5432");
-        const int poolSize = readEnvIntOrDefault("BUKSAN_PG_POOL_SIZE", 8);
+        buksan::PostgresPoolSettings poolSettings;
+        poolSettings.poolSize = static_cast<std::size_t>(readEnvIntOrDefault("BUKSAN_PG_POOL_SIZE", 8));
+        poolSettings.minIdle = static_cast<std::size_t>(readEnvIntOrDefault("BUKSAN_PG_MIN_IDLE", 2));
+        poolSettings.maxLifetime = std::chrono::seconds(readEnvIntOrDefault("BUKSAN_PG_MAX_LIFETIME_SECONDS", 1800));
+        poolSettings.healthCheckInterval =
+            std::chrono::seconds(readEnvIntOrDefault("BUKSAN_PG_HEALTH_CHECK_SECONDS", 30));
         const int retrySeconds = readEnvIntOrDefault("BUKSAN_METADATA_RETRY_SECONDS", 2);
-        const int retryBatch = readEnvIntOrDefault("BUKSAN_METADATA_RETRY_BATCH", 64);
+        buksan::MetadataCacheSettings cacheSettings;
+        cacheSettings.ttl = std::chrono::seconds(readEnvIntOrDefault("BUKSAN_METADATA_CACHE_TTL_SECONDS", 30));
+        cacheSettings.capacity = static_cast<std::size_t>(readEnvIntOrDefault("BUKSAN_METADATA_CACHE_SIZE", 4096));
+        const int retryBatch = readEnvIntOrDefault("BUKSAN_METADATA_RETRY_BATCH", 500);
 
-        pool = std::make_shared<buksan::PostgresConnectionPool>(dbConnectionString, static_cast<std::size_t>(poolSize));
-        metadataQueue = std::make_shared<buksan::InMemoryMetadataSyncQueue>();
+        pool = std::make_shared<buksan::PostgresConnectionPool>(dbConnectionString, poolSettings);
+        const std::string queueDir = readEnvOrDefault(
+            "BUKSAN_METADATA_QUEUE_DIR",
+            storagePath.empty() ? std::string() : storagePath + "/.metadata-queue");
+        if (!queueDir.empty()) {
+            try {
+                metadataQueue = std::make_shared<buksan::FileMetadataSyncQueue>(queueDir);
+            } catch (const std::exception& e) {
+                buksan::logWarn("main") << "Metadata queue at " << queueDir << " unavailable, keeping it in memory: " << e.what();
+            }
+        }
+        if (!metadataQueue) {
+            metadataQueue = std::make_shared<buksan::InMemoryMetadataSyncQueue>();
+        }
 
         auto recordingRepository = std::make_unique<buksan::PostgresRecordingRepository>(pool);
         auto cameraRepository = std::make_unique<buksan::PostgresCameraRepository>(pool);
         auto nodeRepository = std::make_unique<buksan::PostgresNodeRepository>(pool);
+        // After the repositories, so the warm connections come with their statements prepared
+        pool->start();
 
-        std::shared_ptr<buksan::IMetadataSyncQueue> queueAbstraction = metadataQueue;
-        recordingService = std::make_unique<buksan::RecordingService>(std::move(recordingRepository), std::move(queueAbstraction));
-        cameraService = std::make_unique<buksan::CameraService>(std::move(cameraRepository));
-        nodeService = std::make_unique<buksan::NodeService>(std::move(nodeRepository));
+        recordingService = std::make_unique<buksan::RecordingService>(std::move(recordingRepository), metadataQueue,
+                                                                      cacheSettings);
+        cameraService = std::make_unique<buksan::CameraService>(std::move(cameraRepository), cacheSettings);
+        nodeService = std::make_unique<buksan::NodeService>(std::move(nodeRepository), cacheSettings);
 
         std::vector<buksan::RegisterCameraCommand> cameraCommands;
+        std::vector<std::string> cameraIds;
         cameraCommands.reserve(loader.config().cameras.size());
         for (const auto& configCamera : loader.config().cameras) {
             if (configCamera.rtsp_url.empty()) {
@@ -181,32 +239,137 @@ int main(int argc, char* argv[]) {
             command.rtspUrl = configCamera.rtsp_url;
             command.status = "active";
             cameraCommands.push_back(std::move(command));
+            cameraIds.push_back(configCamera.id);
+        }
+        // A database that is down at startup must not stop recording; device ids are then
+        // resolved by the registrar once the catalog answers
+        std::vector<std::int64_t> deviceIds;
+        try {
+            deviceIds = cameraService->registerFromConfig(cameraCommands);
+        } catch (const std::exception& e) {
+            buksan::logWarn("main") << "Camera registration postponed: " << e.what();
+        }
+
+        segmentRegistrar = std::make_unique<buksan::SegmentRegistrar>(*recordingService);
+        for (std::size_t i = 0; i < deviceIds.size() && i < cameraIds.size(); ++i) {
+            segmentRegistrar->setDeviceId(cameraIds[i], deviceIds[i]);
+        }
+        std::unordered_map<std::string, buksan::RegisterCameraCommand> commandsById;
+        for (std::size_t i = 0; i < cameraCommands.size() && i < cameraIds.size(); ++i) {
+            commandsById.emplace(cameraIds[i], cameraCommands[i]);
         }
-        cameraService->registerFromConfig(cameraCommands);
+        const buksan::DeviceIdResolver resolveDeviceId =
+            [service = cameraService.get(), commandsById](const std::string& cameraId) -> std::optional<std::int64_t> {
+            const auto it = commandsById.find(cameraId);
+            if (it == commandsById.end()) {
+                return std::nullopt;
+            }
+            return service->registerCamera(it->second);
+        };
+        segmentRegistrar->setDeviceIdResolver(resolveDeviceId);
+        recordingService->setDeviceIdResolver(resolveDeviceId);
+        segmentRegistrar->start();
 
         metadataSyncWorker = std::make_unique<buksan::MetadataSyncWorker>(
             *recordingService,
             std::chrono::milliseconds(retrySeconds * 1000),
             static_cast<std::size_t>(retryBatch));
         metadataSyncWorker->start();
+        buksan::metrics().gaugeFunction("buksan_metadata_queue_pending", "Recordings waiting to be written to the database", {},
+                                        [service = recordingService.get()] {
+                                            return static_cast<double>(service->pendingQueueSize());
+                                        });
     } catch (const std::exception& e) {
-        std::cerr << "Database wiring failed: " << e.what() << std::endl;
+        buksan::logError("main") << "Database wiring failed: " << e.what();
         return 1;
     }
+    // Started once recordingService is settled, which its callbacks read without a lock
+    if (storage) {
+        storage->start();
+    }
+    manager.setSegmentHandler([registrar = segmentRegistrar.get(), storage = storage.get()](
+                                  const std::string& cameraId, const buksan::SegmentInfo& segment) {
+        if (storage) {
+            storage->segmentClosed(cameraId, segment.path, segment.sizeBytes, segment.endTime,
+                                   segment.alertId.has_value());
+        }
+        if (!registrar) {
+            return;
+        }
+        buksan::FinishedSegment finished;
+        finished.cameraId = cameraId;
+        finished.path = segment.path;
+        finished.startTime = segment.startTime;
+        finished.endTime = segment.endTime;
+        finished.sizeBytes = segment.sizeBytes;
+        finished.alertId = segment.alertId;
+        registrar->submit(std::move(finished));
+    });
+
+    int started = 0;
+    {
+        const auto& config = loader.config();
+        if (!config.storage_volumes.empty()) {
+            auto volumes = std::make_shared<buksan::StorageVolumes>(config.storage_volumes,
+                                                                    config.storage_placement,
+                                                                    config.storage_reserve_bytes);
+            manager.setStorageVolumes(volumes);
+            const bool transcoding = std::any_of(config.cameras.begin(), config.cameras.end(),
+                                                 [](const buksan::CameraConfig& cam) {
+                                                     return cam.record_mode == buksan::RecordMode::Transcode;
+                                                 });
+            if (transcoding) {
+                auto encoders = std::make_shared<buksan::EncoderPool>(config.encoder);
+                buksan::logInfo("main") << "Encoder pool: " << encoders->workerCount() << " worker(s), "
+                                        << config.encoder.codec << " preset " << config.encoder.preset;
+                manager.setEncoderPool(std::move(encoders));
+            }
+            for (const auto& cam : config.cameras) {
+                if (cam.rtsp_url.empty()) continue;
+                if (manager.addCamera(cam, volumes, 300)) {
+                    manager.startRecording(cam.id);
+                    ++started;
+                }
+            }
+        }
+    }
+    if (started > 0) {
+        buksan::logInfo("main") << "Started " << started << " camera(s) from " << config_path;
+    }
 
 #ifdef BUKSAN_BUILD_API
     if (run_api) {
-        std::cout << "API: http://0.0.0.0:" << api_port << "/api/v1" << std::endl;
+        buksan::logInfo("main") << "API: http://0.0.0.0:" << api_port << "/api/v1";
         buksan::HttpServer server(manager, *recordingService, *cameraService, *nodeService, api_port);
-        server.run();
-        return 0;
-    }
+        server.setCameraRegisteredHandler([registrar = segmentRegistrar.get()](const std::string& cameraId,
+                                                                              std::int64_t deviceId) {
+            if (registrar) {
+                registrar->setDeviceId(cameraId, deviceId);
+            }
+        });
+        const auto& config = loader.config();
+        std::string thumbnailDir = config.thumbnails.cache_dir;
+        if (thumbnailDir.empty() && !config.storage_path.empty()) {
+            thumbnailDir = config.storage_path + "/.thumbnails";
+        }
+        server.setThumbnailCache(std::make_shared<buksan::ThumbnailCache>(config.thumbnails, thumbnailDir));
+        if (!shutdown_requested.load()) {
+            server.run();
+        }
+    } else
 #endif
-
-    while (!shutdown_requested.load()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    {
+        while (!shutdown_requested.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
     }
 
+    // The segments closed here still have to reach the catalog (or its durable queue)
+    buksan::logInfo("main") << "Shutting down";
+    manager.stopAll();
+    if (segmentRegistrar) {
+        segmentRegistrar->stop();
+    }
     if (metadataSyncWorker) {
         metadataSyncWorker->stop();
     }
@@ -10,11 +10,22 @@
 #endif
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
 #include <memory>
 #include <vector>
 
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
 #include "crow/http_parser_merged.h"
 #include "crow/common.h"
 #include "crow/compression.h"
@@ -78,6 +89,10 @@ namespace crow
 
         ~Connection()
         {
+#ifdef __linux__
+            if (file_fd_ >= 0)
+                ::close(file_fd_);
+#endif
             queue_length_--;
 #ifdef CROW_ENABLE_DEBUG
             connectionCount--;
@@ -263,12 +278,19 @@ namespace crow
             }
 #endif
 
+            if (res.is_stream_type())
+                add_keep_alive_ = false; // the connection ends with the body
+
             prepare_buffers();
 
             if (res.is_static_type())
             {
                 do_write_static();
             }
+            else if (res.is_stream_type())
+            {
+                do_write_stream();
+            }
             else
             {
                 do_write_general();
@@ -292,37 +314,272 @@ namespace crow
 
         void do_write_static()
         {
-            asio::write(adaptor_.socket(), buffers_);
+            if (!res.file_info.prefix.empty())
+                buffers_.emplace_back(res.file_info.prefix.data(), res.file_info.prefix.size());
+#ifdef __linux__
+            if (Adaptor::supports_sendfile && res.file_info.statResult == 0)
+            {
+                start_send_file();
+                return;
+            }
+#endif
+            error_code ec;
+            asio::write(adaptor_.socket(), buffers_, ec);
 
-            if (res.file_info.statResult == 0)
+            bool complete = !ec;
+            if (!ec && res.file_info.statResult == 0)
             {
-                std::ifstream is(res.file_info.path.c_str(), std::ios::in | std::ios::binary);
-                std::vector<asio::const_buffer> buffers{1};
-                char buf[16384];
-                is.read(buf, sizeof(buf));
-                while (is.gcount() > 0)
+                complete = send_file_buffered();
+            }
+            if (close_connection_ || !complete)
+            {
+                // A body shorter than the announced Content-Length leaves the connection unusable
+                adaptor_.shutdown_readwrite();
+                adaptor_.close();
+                CROW_LOG_DEBUG << this << " from write (static)";
+            }
+
+            res.end();
+            res.clear();
+            buffers_.clear();
+            parser_.clear();
+        }
+
+        /// Copy the file range through a fixed 16KB buffer; used where the kernel cannot write to the socket directly.
+        bool send_file_buffered()
+        {
+            std::ifstream is(res.file_info.path.c_str(), std::ios::in | std::ios::binary);
+            is.seekg(static_cast<std::streamoff>(res.file_info.offset), std::ios::beg);
+            std::vector<asio::const_buffer> buffers{1};
+            char buf[16384];
+            uint64_t remaining = res.file_info.length;
+            while (remaining > 0 && is.good())
+            {
+                is.read(buf, static_cast<std::streamsize>(std::min<uint64_t>(remaining, sizeof(buf))));
+                if (is.gcount() <= 0)
+                    break;
+                buffers[0] = asio::buffer(buf, static_cast<std::size_t>(is.gcount()));
+                error_code ec = do_write_sync(buffers);
+                if (ec)
                 {
-                    buffers[0] = asio::buffer(buf, is.gcount());
-                    error_code ec = do_write_sync(buffers);
-                    if (ec) {
-                        CROW_LOG_ERROR << ec << " - buffer write error happened while sending content of file "
-                                       << res.file_info.path << ". Writing stopped premature.";
-                        break;
-                    }
-                    is.read(buf, sizeof(buf));
+                    CROW_LOG_ERROR << ec << " - buffer write error happened while sending content of file "
+                                   << res.file_info.path << ". Writing stopped premature.";
+                    return false;
                 }
+                remaining -= static_cast<uint64_t>(is.gcount());
+            }
+            return remaining == 0;
+        }
+
+#ifdef __linux__
+        /// Send the headers, then hand the file range to the kernel with sendfile(2): no user-space copies
+        /// and constant memory per transfer. When the socket is full the io loop waits for it to become
+        /// writable, so no thread is held and a paused player keeps its connection for as long as it
+        /// stays connected. Reading the next request resumes once the body is out.
+        void start_send_file()
+        {
+            file_fd_ = ::open(res.file_info.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file_fd_ < 0)
+            {
+                CROW_LOG_ERROR << "cannot open " << res.file_info.path << " for sending";
+                finish_send_file(false);
+                return;
             }
-            if (close_connection_)
+            cancel_deadline_timer();
+            file_writing_ = true;
+            file_offset_ = static_cast<off_t>(res.file_info.offset);
+            file_remaining_ = res.file_info.length;
+
+            auto self = this->shared_from_this();
+            asio::async_write(
+              adaptor_.socket(), buffers_,
+              [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                  if (ec)
+                  {
+                      self->finish_send_file(false);
+                      return;
+                  }
+                  self->send_file_chunk();
+              });
+        }
+
+        void send_file_chunk()
+        {
+            const int out = adaptor_.raw_socket().native_handle();
+            while (file_remaining_ > 0)
             {
+                const std::size_t chunk = static_cast<std::size_t>(std::min<uint64_t>(file_remaining_, 1u << 30));
+                const ssize_t sent = ::sendfile(out, file_fd_, &file_offset_, chunk);
+                if (sent > 0)
+                {
+                    file_remaining_ -= static_cast<uint64_t>(sent);
+                    continue;
+                }
+                if (sent < 0 && errno == EINTR)
+                    continue;
+                if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    auto self = this->shared_from_this();
+                    adaptor_.raw_socket().async_wait(
+                      asio::socket_base::wait_write,
+                      [self](const error_code& ec) {
+                          if (ec)
+                          {
+                              self->finish_send_file(false);
+                              return;
+                          }
+                          self->send_file_chunk();
+                      });
+                    return;
+                }
+                if (sent == 0)
+                {
+                    CROW_LOG_ERROR << res.file_info.path << " was truncated while sending";
+                }
+                else if (errno != EPIPE && errno != ECONNRESET)
+                {
+                    CROW_LOG_ERROR << "sendfile failed for " << res.file_info.path << ": errno " << errno;
+                }
+                finish_send_file(false);
+                return;
+            }
+            finish_send_file(true);
+        }
+
+        void finish_send_file(bool complete)
+        {
+            if (file_fd_ >= 0)
+            {
+                ::close(file_fd_);
+                file_fd_ = -1;
+            }
+            file_writing_ = false;
+            if (close_connection_ || !complete)
+            {
+                // A body shorter than the announced Content-Length leaves the connection unusable
                 adaptor_.shutdown_readwrite();
                 adaptor_.close();
-                CROW_LOG_DEBUG << this << " from write (static)";
+                CROW_LOG_DEBUG << this << " from write (sendfile)";
             }
 
             res.end();
             res.clear();
             buffers_.clear();
             parser_.clear();
+
+            if (need_to_start_read_after_complete_)
+            {
+                need_to_start_read_after_complete_ = false;
+                if (adaptor_.is_open())
+                {
+                    start_deadline();
+                    do_read();
+                }
+            }
+        }
+#endif
+
+        /// Send the headers, then the response's body source piece by piece as HTTP chunks.
+        /// Writes are asynchronous, so a long-lived body holds no io thread; the source keeps the
+        /// connection alive through its notifier until the body ends or the client goes away.
+        void do_write_stream()
+        {
+            cancel_deadline_timer();
+            close_connection_ = true;
+            stream_ = std::move(res.stream_source_);
+            stream_head_.clear();
+            for (const auto& buffer : buffers_)
+                stream_head_.append(static_cast<const char*>(buffer.data()), buffer.size());
+            buffers_.clear();
+            res.clear();
+            parser_.clear();
+
+            auto self = this->shared_from_this();
+            asio::io_context* io_context = &adaptor_.get_io_context();
+            stream_->set_notifier([self, io_context] {
+                asio::post(*io_context, [self] {
+                    self->pump_stream();
+                });
+            });
+            stream_writing_ = true;
+            asio::async_write(
+              adaptor_.socket(), asio::buffer(stream_head_),
+              [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                  self->stream_writing_ = false;
+                  if (ec)
+                  {
+                      self->end_stream();
+                      return;
+                  }
+                  self->pump_stream();
+              });
+        }
+
+        void pump_stream()
+        {
+            if (!stream_ || stream_writing_)
+                return;
+            if (!adaptor_.is_open())
+            {
+                end_stream();
+                return;
+            }
+
+            bool finished = false;
+            std::shared_ptr<const std::string> piece = stream_->pull(finished);
+            while (piece && piece->empty())
+                piece = stream_->pull(finished);
+
+            auto self = this->shared_from_this();
+            if (!piece)
+            {
+                if (!finished)
+                    return; // the notifier brings us back
+                static const std::string last_chunk = "0\r\n\r\n";
+                stream_writing_ = true;
+                asio::async_write(
+                  adaptor_.socket(), asio::buffer(last_chunk),
+                  [self](const error_code& /*ec*/, std::size_t /*bytes_transferred*/) {
+                      self->stream_writing_ = false;
+                      self->end_stream();
+                  });
+                return;
+            }
+
+            char size_line[24];
+            const int length = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", piece->size());
+            stream_chunk_size_.assign(size_line, static_cast<std::size_t>(length));
+            stream_piece_ = std::move(piece);
+            static const std::string chunk_end = "\r\n";
+            std::array<asio::const_buffer, 3> buffers{
+              asio::buffer(stream_chunk_size_), asio::buffer(*stream_piece_), asio::buffer(chunk_end)};
+            stream_writing_ = true;
+            asio::async_write(
+              adaptor_.socket(), buffers,
+              [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                  self->stream_writing_ = false;
+                  self->stream_piece_.reset();
+                  if (ec)
+                  {
+                      self->end_stream();
+                      return;
+                  }
+                  self->pump_stream();
+              });
+        }
+
+        void end_stream()
+        {
+            if (stream_)
+            {
+                // The source drops the notifier here, which releases the connection
+                stream_->closed();
+                stream_.reset();
+            }
+            stream_piece_.reset();
+            adaptor_.shutdown_readwrite();
+            adaptor_.close();
+            CROW_LOG_DEBUG << this << " from write (body source)";
         }
 
         void do_write_general()
@@ -412,7 +669,7 @@ namespace crow
                       self->parser_.done();
                       // adaptor will close after write
                   }
-                  else if (!self->need_to_call_after_handlers_)
+                  else if (!self->need_to_call_after_handlers_ && !self->file_writing_)
                   {
                       self->start_deadline();
                       self->do_read();
@@ -524,6 +781,19 @@ namespace crow
         std::string date_str_;
         std::string res_body_copy_;
 
+        std::shared_ptr<response::body_source> stream_;
+        std::string stream_head_;
+        std::string stream_chunk_size_;
+        std::shared_ptr<const std::string> stream_piece_;
+        bool stream_writing_{};
+
+#ifdef __linux__
+        int file_fd_ = -1;
+        off_t file_offset_{};
+        uint64_t file_remaining_{};
+#endif
+        bool file_writing_{};
+
         detail::task_timer::identifier_type task_id_{};
 
         bool continue_requested{};
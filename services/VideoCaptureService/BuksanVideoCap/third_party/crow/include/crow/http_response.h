@@ -4,6 +4,9 @@
 #include <ios>
 #include <fstream>
 #include <sstream>
+#include <cstdint>
+#include <functional>
+#include <memory>
 // S_ISREG is not defined for windows
 // This defines it like suggested in https://stackoverflow.com/a/62371749
 #if defined(_MSC_VER)
@@ -56,6 +59,21 @@ namespace crow
         bool skip_body = false;            ///< Whether this is a response to a HEAD request.
         bool manual_length_header = false; ///< Whether Crow should automatically add a "Content-Length" header.
 
+        /// Source of a body that is produced while it is sent (live media), written with chunked transfer encoding.
+        ///
+        /// The connection pulls pieces on its own io thread and writes each one straight from the shared buffer.
+        struct body_source
+        {
+            virtual ~body_source() = default;
+            /// Next piece, or nullptr if none is ready; `finished` set with nullptr ends the body.
+            virtual std::shared_ptr<const std::string> pull(bool& finished) = 0;
+            /// Called once before the first pull(). After pull() returned nullptr without finishing,
+            /// the source calls `notify` (from any thread) when it has something again.
+            virtual void set_notifier(std::function<void()> notify) = 0;
+            /// The body ended or the client went away; nothing is pulled afterwards.
+            virtual void closed() = 0;
+        };
+
         /// Set the value of an existing header in the response.
         void set_header(std::string key, std::string value)
         {
@@ -179,6 +197,7 @@ namespace crow
             headers = std::move(r.headers);
             completed_ = r.completed_;
             file_info = std::move(r.file_info);
+            stream_source_ = std::move(r.stream_source_);
             return *this;
         }
 
@@ -195,6 +214,7 @@ namespace crow
             headers.clear();
             completed_ = false;
             file_info = static_file_info{};
+            stream_source_.reset();
         }
 
         /// Return a "Temporary Redirect" response.
@@ -291,6 +311,9 @@ namespace crow
             std::string path = "";
             struct stat statbuf;
             int statResult;
+            uint64_t offset = 0;
+            uint64_t length = 0;
+            std::string prefix; ///< Sent right after the headers, ahead of the file range
         };
 
         /// Return a static file as the response body, the content_type may be specified explicitly.
@@ -312,6 +335,9 @@ namespace crow
             if (file_info.statResult == 0 && S_ISREG(file_info.statbuf.st_mode))
             {
                 code = 200;
+                file_info.offset = 0;
+                file_info.length = static_cast<uint64_t>(file_info.statbuf.st_size);
+                file_info.prefix.clear();
                 this->add_header("Content-Length", std::to_string(file_info.statbuf.st_size));
 
                 if (content_type.empty())
@@ -336,6 +362,60 @@ namespace crow
             }
         }
 
+        /// Send the body from `source` with chunked transfer encoding; the connection is closed when it ends.
+        void set_body_source(std::shared_ptr<body_source> source, std::string content_type = "")
+        {
+            stream_source_ = std::move(source);
+            body.clear();
+#ifdef CROW_ENABLE_COMPRESSION
+            compressed = false;
+#endif
+            headers.erase("Content-Length");
+            this->set_header("Transfer-Encoding", "chunked");
+            manual_length_header = true;
+            if (!content_type.empty())
+            {
+                this->set_header("Content-Type", content_type);
+            }
+        }
+
+        bool is_stream_type() const
+        {
+            return stream_source_ != nullptr;
+        }
+
+        /// Return `length` bytes of a file starting at `offset` as the response body (path is not sanitized),
+        /// optionally preceded by `prefix`.
+        /// The status code is left to the caller so it can answer 206 with its own Content-Range.
+        /// Returns false (and leaves the response untouched) if the file is missing or the range lies outside it.
+        bool set_static_file_range_unsafe(std::string path, uint64_t offset, uint64_t length, std::string content_type = "",
+                                          std::string prefix = "")
+        {
+            static_file_info info;
+            info.path = std::move(path);
+            info.statResult = stat(info.path.c_str(), &info.statbuf);
+            if (info.statResult != 0 || !S_ISREG(info.statbuf.st_mode))
+                return false;
+            const uint64_t size = static_cast<uint64_t>(info.statbuf.st_size);
+            if (offset > size || length > size - offset)
+                return false;
+
+            info.offset = offset;
+            info.length = length;
+            info.prefix = std::move(prefix);
+            const uint64_t content_length = info.prefix.size() + length;
+            file_info = std::move(info);
+#ifdef CROW_ENABLE_COMPRESSION
+            compressed = false;
+#endif
+            this->set_header("Content-Length", std::to_string(content_length));
+            if (!content_type.empty())
+            {
+                this->set_header("Content-Type", content_type);
+            }
+            return true;
+        }
+
     private:
         void write_header_into_buffer(std::vector<asio::const_buffer>& buffers, std::string& content_length_buffer, bool add_keep_alive, const std::string& server_name)
         {
@@ -419,7 +499,7 @@ namespace crow
                 buffers.emplace_back(crlf.data(), crlf.size());
             }
 
-            if (!manual_length_header && !headers.count("content-length"))
+            if (!manual_length_header && !stream_source_ && !headers.count("content-length"))
             {
                 content_length_buffer = std::to_string(body.size());
                 static std::string content_length_tag = "Content-Length: ";
@@ -456,5 +536,6 @@ namespace crow
         std::function<void()> complete_request_handler_;
         std::function<bool()> is_alive_helper_;
         static_file_info file_info;
+        std::shared_ptr<body_source> stream_source_;
     };
 } // namespace crow
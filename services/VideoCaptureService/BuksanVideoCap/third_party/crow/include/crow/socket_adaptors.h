@@ -39,6 +39,8 @@ namespace crow
     struct SocketAdaptor
     {
         using context = void;
+        /// Bytes written to raw_socket() reach the peer unchanged, so the kernel may send files directly.
+        static constexpr bool supports_sendfile = true;
         SocketAdaptor(asio::io_context& io_context, context*):
           socket_(io_context)
         {}
@@ -111,6 +113,7 @@ namespace crow
     struct UnixSocketAdaptor
     {
         using context = void;
+        static constexpr bool supports_sendfile = true;
         UnixSocketAdaptor(asio::io_context& io_context, context*):
           socket_(io_context)
         {
@@ -183,6 +186,7 @@ namespace crow
     struct SSLAdaptor
     {
         using context = asio::ssl::context;
+        static constexpr bool supports_sendfile = false;
         using ssl_socket_t = asio::ssl::stream<tcp::socket>;
         SSLAdaptor(asio::io_context& io_context, context* ctx):
           ssl_socket_(new ssl_socket_t(io_context, *ctx))
@@ -0,0 +1,470 @@
+#include "utils/FileMetadataSyncQueue.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace buksan {
+
+namespace {
+
+const std::size_t kRecordHeaderSize = 8;
+const std::uint32_t kMaxRecordSize = 1024 * 1024;
+const char* const kCursorFile = "cursor";
+const char* const kSegmentExtension = ".log";
+
+std::uint32_t crc32(const char* data, std::size_t size) {
+    static const std::array<std::uint32_t, 256> table = [] {
+        std::array<std::uint32_t, 256> t{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    std::uint32_t crc = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void putU32(std::string& out, std::uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void putI64(std::string& out, std::int64_t value) {
+    const auto bits = static_cast<std::uint64_t>(value);
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((bits >> (8 * i)) & 0xFF));
+    }
+}
+
+void putString(std::string& out, const std::string& value) {
+    putU32(out, static_cast<std::uint32_t>(value.size()));
+    out += value;
+}
+
+void putOptional(std::string& out, const std::optional<std::int64_t>& value) {
+    out.push_back(value.has_value() ? 1 : 0);
+    putI64(out, value.value_or(0));
+}
+
+class Reader {
+public:
+    Reader(const char* data, std::size_t size) : data_(data), size_(size) {}
+
+    bool u32(std::uint32_t& value) {
+        if (size_ - pos_ < 4) return false;
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<std::uint32_t>(static_cast<unsigned char>(data_[pos_ + i])) << (8 * i);
+        }
+        pos_ += 4;
+        return true;
+    }
+
+    bool i64(std::int64_t& value) {
+        if (size_ - pos_ < 8) return false;
+        std::uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i) {
+            bits |= static_cast<std::uint64_t>(static_cast<unsigned char>(data_[pos_ + i])) << (8 * i);
+        }
+        value = static_cast<std::int64_t>(bits);
+        pos_ += 8;
+        return true;
+    }
+
+    bool string(std::string& value) {
+        std::uint32_t length = 0;
+        if (!u32(length) || size_ - pos_ < length) return false;
+        value.assign(data_ + pos_, length);
+        pos_ += length;
+        return true;
+    }
+
+    bool optional(std::optional<std::int64_t>& value) {
+        if (size_ - pos_ < 1) return false;
+        const bool present = data_[pos_++] != 0;
+        std::int64_t raw = 0;
+        if (!i64(raw)) return false;
+        value = present ? std::optional<std::int64_t>(raw) : std::nullopt;
+        return true;
+    }
+
+    bool done() const { return pos_ == size_; }
+
+private:
+    const char* data_;
+    std::size_t size_;
+    std::size_t pos_{0};
+};
+
+std::string encodeRecord(const CreateRecordingCommand& command) {
+    std::string payload;
+    payload.reserve(64 + command.mediaFile.size());
+    putI64(payload, command.userId);
+    putI64(payload, command.unixTime);
+    putString(payload, command.mediaFile);
+    putOptional(payload, command.alertId);
+    putI64(payload, command.deviceId);
+    putString(payload, command.timeValue);
+    putString(payload, command.dateValue);
+    putOptional(payload, command.mandatoryMark);
+    putOptional(payload, command.endUnixTime);
+    putOptional(payload, command.sizeBytes);
+    putString(payload, command.cameraId);
+
+    std::string record;
+    record.reserve(kRecordHeaderSize + payload.size());
+    putU32(record, static_cast<std::uint32_t>(payload.size()));
+    putU32(record, crc32(payload.data(), payload.size()));
+    record += payload;
+    return record;
+}
+
+bool decodePayload(const char* data, std::size_t size, CreateRecordingCommand& command) {
+    Reader reader(data, size);
+    return reader.i64(command.userId) &&
+           reader.i64(command.unixTime) &&
+           reader.string(command.mediaFile) &&
+           reader.optional(command.alertId) &&
+           reader.i64(command.deviceId) &&
+           reader.string(command.timeValue) &&
+           reader.string(command.dateValue) &&
+           reader.optional(command.mandatoryMark) &&
+           (reader.done() ||
+            (reader.optional(command.endUnixTime) && reader.optional(command.sizeBytes) &&
+             (reader.done() || (reader.string(command.cameraId) && reader.done()))));
+}
+
+bool writeAll(int fd, const std::string& data) {
+    std::size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+void syncDirectory(const std::string& directory) {
+    const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+std::vector<std::uint64_t> listSegments(const std::string& directory) {
+    std::vector<std::uint64_t> segments;
+    for (const auto& item : std::filesystem::directory_iterator(directory)) {
+        if (!item.is_regular_file() || item.path().extension() != kSegmentExtension) {
+            continue;
+        }
+        const std::string stem = item.path().stem().string();
+        if (stem.empty() || !std::all_of(stem.begin(), stem.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+            continue;
+        }
+        segments.push_back(std::stoull(stem));
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+} // namespace
+
+struct FileMetadataSyncQueue::SegmentFile {
+    std::uint64_t sequence{0};
+    int fd{-1};
+    std::uint64_t size{0};
+    bool dirty{false};
+
+    ~SegmentFile() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+};
+
+FileMetadataSyncQueue::FileMetadataSyncQueue(std::string directory, FileMetadataSyncQueueOptions options)
+    : directory_(std::move(directory))
+    , options_(options) {
+    if (directory_.empty()) {
+        throw std::invalid_argument("FileMetadataSyncQueue requires a directory");
+    }
+    std::filesystem::create_directories(directory_);
+
+    cursor_ = readCursor();
+    std::vector<std::uint64_t> existing = listSegments(directory_);
+    segments_.assign(existing.begin(), existing.end());
+
+    // A fresh segment per run: a torn tail left by a crash is never appended to
+    const std::uint64_t next = std::max(existing.empty() ? 0 : existing.back(), cursor_.segment) + 1;
+    active_ = openSegment(next);
+    segments_.push_back(next);
+
+    if (existing.empty()) {
+        replayed_.store(true);
+    } else {
+        replayThread_ = std::thread(&FileMetadataSyncQueue::replay, this, std::move(existing), cursor_, next);
+    }
+    syncThread_ = std::thread(&FileMetadataSyncQueue::syncLoop, this);
+}
+
+FileMetadataSyncQueue::~FileMetadataSyncQueue() {
+    if (replayThread_.joinable()) {
+        replayThread_.join();
+    }
+    running_.store(false);
+    wake_.notify_all();
+    if (syncThread_.joinable()) {
+        syncThread_.join();
+    }
+}
+
+std::string FileMetadataSyncQueue::segmentPath(std::uint64_t sequence) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020llu", static_cast<unsigned long long>(sequence));
+    return (std::filesystem::path(directory_) / (std::string(name) + kSegmentExtension)).string();
+}
+
+std::shared_ptr<FileMetadataSyncQueue::SegmentFile> FileMetadataSyncQueue::openSegment(std::uint64_t sequence) {
+    const std::string path = segmentPath(sequence);
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("FileMetadataSyncQueue: cannot open " + path);
+    }
+    auto segment = std::make_shared<SegmentFile>();
+    segment->sequence = sequence;
+    segment->fd = fd;
+    segment->size = static_cast<std::uint64_t>(::lseek(fd, 0, SEEK_END));
+    syncDirectory(directory_);
+    return segment;
+}
+
+FileMetadataSyncQueue::LogPosition FileMetadataSyncQueue::readCursor() const {
+    LogPosition cursor;
+    std::ifstream input(std::filesystem::path(directory_) / kCursorFile);
+    if (!(input >> cursor.segment >> cursor.offset)) {
+        return {};
+    }
+    return cursor;
+}
+
+bool FileMetadataSyncQueue::writeCursor(LogPosition cursor) {
+    const std::string path = (std::filesystem::path(directory_) / kCursorFile).string();
+    const std::string temporary = path + ".tmp";
+    const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ++writeErrors_;
+        return false;
+    }
+    const std::string text = std::to_string(cursor.segment) + " " + std::to_string(cursor.offset) + "\n";
+    const bool written = writeAll(fd, text) && ::fdatasync(fd) == 0;
+    ::close(fd);
+    if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        ++writeErrors_;
+        return false;
+    }
+    return true;
+}
+
+void FileMetadataSyncQueue::replay(std::vector<std::uint64_t> segments, LogPosition cursor, std::uint64_t firstLiveSegment) {
+    std::vector<Entry> recovered;
+    for (const std::uint64_t sequence : segments) {
+        if (sequence < cursor.segment) {
+            continue;
+        }
+        std::ifstream input(segmentPath(sequence), std::ios::binary);
+        const std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+        std::size_t offset = sequence == cursor.segment ? static_cast<std::size_t>(cursor.offset) : 0;
+        while (offset + kRecordHeaderSize <= data.size()) {
+            Reader header(data.data() + offset, kRecordHeaderSize);
+            std::uint32_t length = 0;
+            std::uint32_t checksum = 0;
+            header.u32(length);
+            header.u32(checksum);
+            const char* payload = data.data() + offset + kRecordHeaderSize;
+            // A short, oversized or corrupt record is the torn tail of an interrupted write
+            if (length > kMaxRecordSize || data.size() - offset - kRecordHeaderSize < length ||
+                crc32(payload, length) != checksum) {
+                break;
+            }
+
+            Entry entry;
+            if (!decodePayload(payload, length, entry.command)) {
+                break;
+            }
+            offset += kRecordHeaderSize + length;
+            entry.end = {sequence, offset};
+            recovered.push_back(std::move(entry));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (recovered.empty()) {
+        // Nothing left from earlier runs: move the cursor past their segments so they get deleted
+        cursor_ = {firstLiveSegment, 0};
+        cursorDirty_ = true;
+    }
+    entries_.insert(entries_.begin(),
+                    std::make_move_iterator(recovered.begin()),
+                    std::make_move_iterator(recovered.end()));
+    replayed_.store(true);
+}
+
+void FileMetadataSyncQueue::enqueue(CreateRecordingCommand command) {
+    const std::string record = encodeRecord(command);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_->size > 0 && active_->size + record.size() > options_.segmentBytes) {
+        try {
+            auto next = openSegment(active_->sequence + 1);
+            retired_.push_back(std::move(active_));
+            active_ = std::move(next);
+            segments_.push_back(active_->sequence);
+        } catch (const std::exception&) {
+            // Keep appending to the current segment rather than losing the entry
+            ++writeErrors_;
+        }
+    }
+
+    Entry entry;
+    entry.command = std::move(command);
+    if (writeAll(active_->fd, record)) {
+        active_->size += record.size();
+        active_->dirty = true;
+        entry.end = {active_->sequence, active_->size};
+    } else {
+        // Cut off a partial record so later appends stay readable; the entry lives in memory only
+        if (::ftruncate(active_->fd, static_cast<off_t>(active_->size)) != 0) {
+            ++writeErrors_;
+        }
+        ++writeErrors_;
+    }
+    entries_.push_back(std::move(entry));
+}
+
+bool FileMetadataSyncQueue::tryDequeue(CreateRecordingCommand& command) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!replayed_.load() || entries_.empty()) {
+        return false;
+    }
+    command = entries_.front().command;
+    acknowledgeLocked(1);
+    return true;
+}
+
+std::size_t FileMetadataSyncQueue::peekBatch(std::size_t maxCount, std::vector<CreateRecordingCommand>& batch) {
+    batch.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!replayed_.load()) {
+        return 0;
+    }
+    const std::size_t count = std::min(maxCount, entries_.size());
+    batch.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        batch.push_back(entries_[i].command);
+    }
+    return count;
+}
+
+void FileMetadataSyncQueue::acknowledge(std::size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    acknowledgeLocked(count);
+}
+
+void FileMetadataSyncQueue::acknowledgeLocked(std::size_t count) {
+    count = std::min(count, entries_.size());
+    for (std::size_t i = 0; i < count; ++i) {
+        const LogPosition end = entries_.front().end;
+        if (end.segment != 0) {
+            cursor_ = end;
+            cursorDirty_ = true;
+        }
+        entries_.pop_front();
+    }
+}
+
+std::size_t FileMetadataSyncQueue::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+void FileMetadataSyncQueue::syncLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait_for(lock, options_.syncInterval, [this] { return !running_.load(); });
+        const bool stopping = !running_.load();
+
+        std::shared_ptr<SegmentFile> active;
+        if (active_->dirty) {
+            active = active_;
+            active_->dirty = false;
+        }
+        std::vector<std::shared_ptr<SegmentFile>> retired;
+        retired.swap(retired_);
+
+        std::optional<LogPosition> cursor;
+        std::vector<std::uint64_t> obsolete;
+        if (replayed_.load()) {
+            if (cursorDirty_) {
+                cursor = cursor_;
+                cursorDirty_ = false;
+            }
+            // Everything before the cursor's segment has been acknowledged
+            while (!segments_.empty() && segments_.front() < cursor_.segment) {
+                obsolete.push_back(segments_.front());
+                segments_.pop_front();
+            }
+        }
+        lock.unlock();
+
+        for (const auto& segment : retired) {
+            ::fdatasync(segment->fd);
+        }
+        retired.clear();
+        if (active) {
+            ::fdatasync(active->fd);
+        }
+        const bool cursorWritten = !cursor || writeCursor(*cursor);
+        if (cursorWritten) {
+            for (const std::uint64_t sequence : obsolete) {
+                std::error_code ec;
+                std::filesystem::remove(segmentPath(sequence), ec);
+            }
+        }
+
+        lock.lock();
+        if (!cursorWritten) {
+            // A restart replays from the old cursor on disk, so the segments it points into must stay
+            // until a later round gets the new one written
+            cursorDirty_ = true;
+            segments_.insert(segments_.begin(), obsolete.begin(), obsolete.end());
+        }
+        if (stopping) {
+            break;
+        }
+    }
+}
+
+} // namespace buksan
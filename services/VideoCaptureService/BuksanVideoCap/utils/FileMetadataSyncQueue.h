@@ -0,0 +1,88 @@
+#ifndef UTILS_FILEMETADATASYNCQUEUE_H
+#define UTILS_FILEMETADATASYNCQUEUE_H
+
+#include "repositories/interfaces/IMetadataSyncQueue.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace buksan {
+
+struct FileMetadataSyncQueueOptions {
+    std::size_t segmentBytes{4 * 1024 * 1024};
+    std::chrono::milliseconds syncInterval{200};
+};
+
+// Persistent metadata queue: an append-only log split into numbered segment files plus a cursor file
+// with the position of the last acknowledged entry. Enqueue appends to the page cache only;
+// a background thread fdatasyncs the log in batches, persists the cursor and deletes fully
+// acknowledged segments. Entries left from a previous run are replayed in the background.
+class FileMetadataSyncQueue final : public IMetadataSyncQueue {
+public:
+    explicit FileMetadataSyncQueue(std::string directory, FileMetadataSyncQueueOptions options = {});
+    ~FileMetadataSyncQueue() override;
+
+    FileMetadataSyncQueue(const FileMetadataSyncQueue&) = delete;
+    FileMetadataSyncQueue& operator=(const FileMetadataSyncQueue&) = delete;
+
+    void enqueue(CreateRecordingCommand command) override;
+    bool tryDequeue(CreateRecordingCommand& command) override;
+    // Returns nothing until the previous run's entries are replayed, so they go out first
+    std::size_t peekBatch(std::size_t maxCount, std::vector<CreateRecordingCommand>& batch) override;
+    void acknowledge(std::size_t count) override;
+    std::size_t size() const override;
+
+    bool replayed() const { return replayed_.load(); }
+    std::uint64_t writeErrors() const { return writeErrors_.load(); }
+
+private:
+    struct LogPosition {
+        std::uint64_t segment{0};
+        std::uint64_t offset{0};
+    };
+
+    struct Entry {
+        CreateRecordingCommand command;
+        LogPosition end;
+    };
+
+    struct SegmentFile;
+
+    void replay(std::vector<std::uint64_t> segments, LogPosition cursor, std::uint64_t firstLiveSegment);
+    void syncLoop();
+    std::shared_ptr<SegmentFile> openSegment(std::uint64_t sequence);
+    std::string segmentPath(std::uint64_t sequence) const;
+    LogPosition readCursor() const;
+    bool writeCursor(LogPosition cursor);
+    void acknowledgeLocked(std::size_t count);
+
+    std::string directory_;
+    FileMetadataSyncQueueOptions options_;
+
+    mutable std::mutex mutex_;
+    std::deque<Entry> entries_;
+    std::deque<std::uint64_t> segments_;
+    std::shared_ptr<SegmentFile> active_;
+    std::vector<std::shared_ptr<SegmentFile>> retired_;
+    LogPosition cursor_;
+    bool cursorDirty_{false};
+
+    std::atomic<bool> replayed_{false};
+    std::atomic<std::uint64_t> writeErrors_{0};
+    std::atomic<bool> running_{true};
+    std::condition_variable wake_;
+    std::thread replayThread_;
+    std::thread syncThread_;
+};
+
+} // namespace buksan
+
+#endif // UTILS_FILEMETADATASYNCQUEUE_H
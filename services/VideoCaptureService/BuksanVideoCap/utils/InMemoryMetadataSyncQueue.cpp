@@ -1,4 +1,5 @@
 #include "utils/InMemoryMetadataSyncQueue.h"
+#include <algorithm>
 
 namespace buksan {
 
@@ -17,6 +18,19 @@ bool InMemoryMetadataSyncQueue::tryDequeue(CreateRecordingCommand& command) {
     return true;
 }
 
+std::size_t InMemoryMetadataSyncQueue::peekBatch(std::size_t maxCount, std::vector<CreateRecordingCommand>& batch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::size_t count = std::min(maxCount, queue_.size());
+    batch.assign(queue_.begin(), queue_.begin() + static_cast<std::ptrdiff_t>(count));
+    return count;
+}
+
+void InMemoryMetadataSyncQueue::acknowledge(std::size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    count = std::min(count, queue_.size());
+    queue_.erase(queue_.begin(), queue_.begin() + static_cast<std::ptrdiff_t>(count));
+}
+
 std::size_t InMemoryMetadataSyncQueue::size() const {
     std::lock_guard<std::mutex> lock(mutex_);
     return queue_.size();
@@ -11,6 +11,8 @@ class InMemoryMetadataSyncQueue final : public IMetadataSyncQueue {
 public:
     void enqueue(CreateRecordingCommand command) override;
     bool tryDequeue(CreateRecordingCommand& command) override;
+    std::size_t peekBatch(std::size_t maxCount, std::vector<CreateRecordingCommand>& batch) override;
+    void acknowledge(std::size_t count) override;
     std::size_t size() const override;
 
 private:
@@ -0,0 +1,326 @@
+#include "utils/Logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+
+namespace buksan {
+
+namespace {
+const std::size_t thread_buffer_lines = 1024;
+const auto writer_interval = std::chrono::milliseconds(20);
+
+const char* levelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Debug: return "debug";
+    case LogLevel::Info: return "info";
+    case LogLevel::Warn: return "warn";
+    case LogLevel::Error: return "error";
+    }
+    return "info";
+}
+
+const char* levelLabel(LogLevel level) {
+    switch (level) {
+    case LogLevel::Debug: return "DEBUG";
+    case LogLevel::Info: return "INFO ";
+    case LogLevel::Warn: return "WARN ";
+    case LogLevel::Error: return "ERROR";
+    }
+    return "INFO ";
+}
+
+void appendJsonString(std::string& out, const std::string& value) {
+    out += '"';
+    for (const char c : value) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                out += escaped;
+            } else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+}
+
+void writeOut(const std::string& data) {
+    const char* p = data.data();
+    std::size_t left = data.size();
+    while (left > 0) {
+        const ssize_t n = ::write(STDOUT_FILENO, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p += n;
+        left -= static_cast<std::size_t>(n);
+    }
+}
+}
+
+bool parseLogLevel(const std::string& value, LogLevel& level) {
+    if (value == "debug") {
+        level = LogLevel::Debug;
+        return true;
+    }
+    if (value == "info") {
+        level = LogLevel::Info;
+        return true;
+    }
+    if (value == "warn") {
+        level = LogLevel::Warn;
+        return true;
+    }
+    if (value == "error") {
+        level = LogLevel::Error;
+        return true;
+    }
+    return false;
+}
+
+bool parseLogFormat(const std::string& value, LogFormat& format) {
+    if (value == "text") {
+        format = LogFormat::Text;
+        return true;
+    }
+    if (value == "json") {
+        format = LogFormat::Json;
+        return true;
+    }
+    return false;
+}
+
+Logger& Logger::instance() {
+    // Never destroyed: threads may still log while static objects are torn down at exit
+    static Logger* logger = [] {
+        auto* created = new Logger();
+        std::atexit([] { Logger::instance().stop(); });
+        return created;
+    }();
+    return *logger;
+}
+
+Logger::Logger() {
+    configure(LogOptions{});
+    writer_ = std::thread(&Logger::run, this);
+}
+
+void Logger::configure(const LogOptions& options) {
+    level_.store(options.level);
+    format_.store(options.format);
+    repeatIntervalNs_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(options.repeatInterval).count());
+}
+
+Logger::ThreadBuffer& Logger::localBuffer() {
+    struct Holder {
+        std::shared_ptr<ThreadBuffer> buffer;
+        ~Holder() {
+            // The writer drops the buffer once it is empty
+            if (buffer) buffer->retired.store(true);
+        }
+    };
+    thread_local Holder holder;
+    if (!holder.buffer) {
+        holder.buffer = std::make_shared<ThreadBuffer>(thread_buffer_lines);
+        std::lock_guard<std::mutex> lock(buffersMutex_);
+        buffers_.push_back(holder.buffer);
+    }
+    return *holder.buffer;
+}
+
+void Logger::write(LogLevel level, const std::string& tag, const std::string& message) {
+    if (!enabled(level)) return;
+    const auto now = std::chrono::system_clock::now();
+    Record record;
+    record.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    record.line = format(level, tag, message, now);
+
+    if (!running_.load()) {
+        writeOut(record.line);
+        return;
+    }
+    ThreadBuffer& buffer = localBuffer();
+    if (!buffer.ring.tryPush(std::move(record))) {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool Logger::admitRepeated(const std::string& tag, const std::string& key, std::uint64_t& suppressed) {
+    const auto now = std::chrono::steady_clock::now();
+    const auto interval = std::chrono::nanoseconds(repeatIntervalNs_.load());
+    std::lock_guard<std::mutex> lock(repeatMutex_);
+    auto [it, inserted] = repeats_.try_emplace(tag + '\x1f' + key);
+    RepeatState& state = it->second;
+    if (!inserted && now - state.last < interval) {
+        ++state.suppressed;
+        return false;
+    }
+    suppressed = state.suppressed;
+    state.suppressed = 0;
+    state.last = now;
+    return true;
+}
+
+std::string Logger::format(LogLevel level, const std::string& tag, const std::string& message,
+                           std::chrono::system_clock::time_point time) const {
+    const std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+    const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+    std::tm local{};
+    localtime_r(&seconds, &local);
+
+    char stamp[48];
+    std::string line;
+    line.reserve(message.size() + tag.size() + 64);
+    if (format_.load(std::memory_order_relaxed) == LogFormat::Json) {
+        char zone[8];
+        std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &local);
+        std::strftime(zone, sizeof(zone), "%z", &local);
+        char full[64];
+        std::snprintf(full, sizeof(full), "%s.%03d%s", stamp, static_cast<int>(millis), zone);
+        line += "{\"time\":\"";
+        line += full;
+        line += "\",\"level\":\"";
+        line += levelName(level);
+        line += '"';
+        if (!tag.empty()) {
+            line += ",\"tag\":";
+            appendJsonString(line, tag);
+        }
+        line += ",\"message\":";
+        appendJsonString(line, message);
+        line += "}\n";
+        return line;
+    }
+
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+    char full[64];
+    std::snprintf(full, sizeof(full), "%s.%03d %s ", stamp, static_cast<int>(millis), levelLabel(level));
+    line += full;
+    if (!tag.empty()) {
+        line += '[';
+        line += tag;
+        line += "] ";
+    }
+    line += message;
+    line += '\n';
+    return line;
+}
+
+void Logger::flush() {
+    std::unique_lock<std::mutex> lock(wakeMutex_);
+    if (!running_.load()) return;
+    const std::uint64_t ticket = ++flushRequests_;
+    wake_.notify_one();
+    drained_.wait(lock, [&] { return flushesDone_ >= ticket || !running_.load(); });
+}
+
+void Logger::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        if (!running_.exchange(false)) return;
+    }
+    wake_.notify_one();
+    if (writer_.joinable()) writer_.join();
+    drained_.notify_all();
+}
+
+void Logger::run() {
+    std::unique_lock<std::mutex> lock(wakeMutex_);
+    while (true) {
+        const std::uint64_t requested = flushRequests_;
+        const bool last_pass = !running_.load();
+        lock.unlock();
+        while (drain()) {
+        }
+        lock.lock();
+        flushesDone_ = requested;
+        drained_.notify_all();
+        if (last_pass) break;
+        wake_.wait_for(lock, writer_interval, [&] { return !running_.load() || flushRequests_ != flushesDone_; });
+    }
+}
+
+bool Logger::drain() {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex_);
+        buffers = buffers_;
+    }
+
+    std::vector<Record> records;
+    std::uint64_t dropped = 0;
+    Record record;
+    for (const auto& buffer : buffers) {
+        while (buffer->ring.tryPop(record)) {
+            records.push_back(std::move(record));
+        }
+        dropped += buffer->dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    {
+        // A retired buffer gets no more lines, so once it reads empty it can go
+        std::lock_guard<std::mutex> lock(buffersMutex_);
+        buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+                                      [](const std::shared_ptr<ThreadBuffer>& buffer) {
+                                          return buffer->retired.load() && buffer->ring.size() == 0;
+                                      }),
+                       buffers_.end());
+    }
+
+    if (records.empty() && dropped == 0) return false;
+
+    // Each ring is in order already; merging them by time keeps the output chronological
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Record& a, const Record& b) { return a.timeNs < b.timeNs; });
+    std::string out;
+    for (const auto& r : records) {
+        out += r.line;
+    }
+    if (dropped > 0) {
+        out += format(LogLevel::Warn, "log", std::to_string(dropped) + " line(s) dropped, log buffers full",
+                      std::chrono::system_clock::now());
+    }
+    writeOut(out);
+    return true;
+}
+
+LogLine::LogLine(LogLevel level, std::string tag, bool admitted, std::uint64_t suppressed)
+    : level_(level)
+    , tag_(std::move(tag))
+    , suppressed_(suppressed)
+{
+    if (admitted && Logger::instance().enabled(level)) {
+        stream_.emplace();
+    }
+}
+
+LogLine::~LogLine() {
+    if (!stream_) return;
+    if (suppressed_ > 0) {
+        *stream_ << " (" << suppressed_ << " similar suppressed)";
+    }
+    try {
+        Logger::instance().write(level_, tag_, stream_->str());
+    } catch (...) {
+    }
+}
+
+LogLine logRepeated(LogLevel level, std::string tag, const std::string& key) {
+    std::uint64_t suppressed = 0;
+    Logger& logger = Logger::instance();
+    const bool admitted = logger.enabled(level) && logger.admitRepeated(tag, key, suppressed);
+    return LogLine(level, std::move(tag), admitted, suppressed);
+}
+
+} // namespace buksan
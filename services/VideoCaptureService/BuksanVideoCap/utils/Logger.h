@@ -0,0 +1,143 @@
+#ifndef UTILS_LOGGER_H
+#define UTILS_LOGGER_H
+
+#include "utils/SpscRing.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace buksan {
+
+enum class LogLevel {
+    Debug,
+    Info,
+    Warn,
+    Error
+};
+
+bool parseLogLevel(const std::string& value, LogLevel& level);
+
+enum class LogFormat {
+    Text,
+    Json
+};
+
+bool parseLogFormat(const std::string& value, LogFormat& format);
+
+struct LogOptions {
+    LogLevel level{LogLevel::Info};
+    LogFormat format{LogFormat::Text};
+    // Repeated messages (logRepeated) with the same tag and key are written at most once per interval
+    std::chrono::seconds repeatInterval{30};
+};
+
+// Process-wide asynchronous logger. Each thread formats its lines into its own lock-free ring;
+// a background thread collects the rings and writes them to stdout in batches, so logging
+// never waits for the terminal or the log shipper. A full ring drops lines rather than block,
+// and the drop count is reported by the writer.
+class Logger {
+public:
+    static Logger& instance();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    void configure(const LogOptions& options);
+    bool enabled(LogLevel level) const { return level >= level_.load(std::memory_order_relaxed); }
+    void write(LogLevel level, const std::string& tag, const std::string& message);
+    // False while the same tag and key was admitted less than repeatInterval ago;
+    // suppressed receives how many were held back before this one
+    bool admitRepeated(const std::string& tag, const std::string& key, std::uint64_t& suppressed);
+
+    // Waits until everything logged so far is written
+    void flush();
+    // Drains and stops the writer; later lines are written synchronously
+    void stop();
+
+private:
+    struct Record {
+        std::int64_t timeNs{0};
+        std::string line;
+    };
+
+    struct ThreadBuffer {
+        explicit ThreadBuffer(std::size_t capacity) : ring(capacity) {}
+        SpscRing<Record> ring;
+        std::atomic<std::uint64_t> dropped{0};
+        std::atomic<bool> retired{false};
+    };
+
+    struct RepeatState {
+        std::chrono::steady_clock::time_point last;
+        std::uint64_t suppressed{0};
+    };
+
+    Logger();
+
+    ThreadBuffer& localBuffer();
+    std::string format(LogLevel level, const std::string& tag, const std::string& message,
+                       std::chrono::system_clock::time_point time) const;
+    void run();
+    bool drain();
+
+    std::atomic<LogLevel> level_{LogLevel::Info};
+    std::atomic<LogFormat> format_{LogFormat::Text};
+    std::atomic<std::int64_t> repeatIntervalNs_{0};
+
+    std::mutex buffersMutex_;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+
+    std::mutex repeatMutex_;
+    std::unordered_map<std::string, RepeatState> repeats_;
+
+    std::mutex wakeMutex_;
+    std::condition_variable wake_;
+    std::condition_variable drained_;
+    std::uint64_t flushRequests_{0};
+    std::uint64_t flushesDone_{0};
+    std::atomic<bool> running_{true};
+    std::thread writer_;
+};
+
+// Collects one line with operator<< and hands it to the logger when destroyed.
+// Nothing is formatted when the level is disabled.
+class LogLine {
+public:
+    LogLine(LogLevel level, std::string tag, bool admitted = true, std::uint64_t suppressed = 0);
+    ~LogLine();
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        if (stream_) *stream_ << value;
+        return *this;
+    }
+
+private:
+    LogLevel level_;
+    std::string tag_;
+    std::uint64_t suppressed_{0};
+    std::optional<std::ostringstream> stream_;
+};
+
+inline LogLine logDebug(std::string tag) { return LogLine(LogLevel::Debug, std::move(tag)); }
+inline LogLine logInfo(std::string tag) { return LogLine(LogLevel::Info, std::move(tag)); }
+inline LogLine logWarn(std::string tag) { return LogLine(LogLevel::Warn, std::move(tag)); }
+inline LogLine logError(std::string tag) { return LogLine(LogLevel::Error, std::move(tag)); }
+// For messages that can repeat every second (reconnect loops): see Logger::admitRepeated
+LogLine logRepeated(LogLevel level, std::string tag, const std::string& key);
+
+} // namespace buksan
+
+#endif // UTILS_LOGGER_H
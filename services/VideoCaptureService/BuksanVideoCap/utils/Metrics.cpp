@@ -0,0 +1,205 @@
+#include "utils/Metrics.h"
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace buksan {
+
+namespace metrics_detail {
+std::size_t shardIndex() {
+    static std::atomic<std::size_t> nextThread{0};
+    thread_local const std::size_t index = nextThread.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return index;
+}
+} // namespace metrics_detail
+
+namespace {
+
+std::string escapeLabelValue(const std::string& value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (const char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+std::string labelString(const MetricLabels& labels) {
+    std::string out;
+    for (const auto& [key, value] : labels) {
+        if (!out.empty()) {
+            out += ',';
+        }
+        out += key + "=\"" + escapeLabelValue(value) + "\"";
+    }
+    return out;
+}
+
+void writeSample(std::ostringstream& out, const std::string& name, const std::string& labels, double value) {
+    out << name;
+    if (!labels.empty()) {
+        out << '{' << labels << '}';
+    }
+    out << ' ' << value << '\n';
+}
+
+std::string withLabel(const std::string& labels, const std::string& extra) {
+    return labels.empty() ? extra : labels + "," + extra;
+}
+
+} // namespace
+
+std::uint64_t Counter::value() const {
+    std::uint64_t total = 0;
+    for (const auto& shard : shards_) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+Histogram::Histogram(std::vector<double> bounds)
+    : bounds_(std::move(bounds)) {
+    std::sort(bounds_.begin(), bounds_.end());
+    shards_.reserve(metrics_detail::kShards);
+    for (std::size_t i = 0; i < metrics_detail::kShards; ++i) {
+        // The last bucket is +Inf
+        shards_.push_back(std::make_unique<Shard>(bounds_.size() + 1));
+    }
+}
+
+void Histogram::observe(double value) {
+    Shard& shard = *shards_[metrics_detail::shardIndex()];
+    const std::size_t bucket = static_cast<std::size_t>(
+        std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin());
+    shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    double sum = shard.sum.load(std::memory_order_relaxed);
+    while (!shard.sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {
+    }
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snapshot;
+    snapshot.cumulative.assign(bounds_.size() + 1, 0);
+    for (const auto& shard : shards_) {
+        for (std::size_t i = 0; i < shard->counts.size(); ++i) {
+            snapshot.cumulative[i] += shard->counts[i].load(std::memory_order_relaxed);
+        }
+        snapshot.sum += shard->sum.load(std::memory_order_relaxed);
+    }
+    for (std::size_t i = 1; i < snapshot.cumulative.size(); ++i) {
+        snapshot.cumulative[i] += snapshot.cumulative[i - 1];
+    }
+    snapshot.count = snapshot.cumulative.back();
+    return snapshot;
+}
+
+const std::vector<double>& MetricsRegistry::latencyBuckets() {
+    static const std::vector<double> buckets{
+        0.0001, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+    return buckets;
+}
+
+MetricsRegistry::Series& MetricsRegistry::seriesLocked(const std::string& name,
+                                                       const std::string& help,
+                                                       Type type,
+                                                       const MetricLabels& labels) {
+    auto family = families_.find(name);
+    if (family == families_.end()) {
+        family = families_.emplace(name, Family{help, type, {}}).first;
+    } else if (family->second.type != type) {
+        throw std::invalid_argument("metric " + name + " already registered with another type");
+    }
+    return family->second.series[labelString(labels)];
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& help, const MetricLabels& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Series& series = seriesLocked(name, help, Type::Counter, labels);
+    if (!series.counter) {
+        series.counter = std::make_unique<Counter>();
+    }
+    return *series.counter;
+}
+
+Gauge& MetricsRegistry::gauge(const std::string& name, const std::string& help, const MetricLabels& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Series& series = seriesLocked(name, help, Type::Gauge, labels);
+    if (!series.gauge) {
+        series.gauge = std::make_unique<Gauge>();
+    }
+    return *series.gauge;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string& name,
+                                      const std::string& help,
+                                      const MetricLabels& labels,
+                                      const std::vector<double>& bounds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Series& series = seriesLocked(name, help, Type::Histogram, labels);
+    if (!series.histogram) {
+        series.histogram = std::make_unique<Histogram>(bounds);
+    }
+    return *series.histogram;
+}
+
+void MetricsRegistry::gaugeFunction(const std::string& name,
+                                    const std::string& help,
+                                    const MetricLabels& labels,
+                                    std::function<double()> read) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    seriesLocked(name, help, Type::Gauge, labels).read = std::move(read);
+}
+
+std::string MetricsRegistry::render() const {
+    std::ostringstream out;
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& [name, family] : families_) {
+        const char* type = family.type == Type::Counter ? "counter"
+                         : family.type == Type::Gauge   ? "gauge"
+                                                        : "histogram";
+        out << "# HELP " << name << ' ' << family.help << '\n';
+        out << "# TYPE " << name << ' ' << type << '\n';
+
+        for (const auto& [labels, series] : family.series) {
+            if (series.counter) {
+                writeSample(out, name, labels, static_cast<double>(series.counter->value()));
+            } else if (series.read) {
+                writeSample(out, name, labels, series.read());
+            } else if (series.gauge) {
+                writeSample(out, name, labels, series.gauge->value());
+            } else if (series.histogram) {
+                const auto snapshot = series.histogram->snapshot();
+                const auto& bounds = series.histogram->bounds();
+                for (std::size_t i = 0; i < bounds.size(); ++i) {
+                    std::ostringstream le;
+                    le << "le=\"" << bounds[i] << '"';
+                    writeSample(out, name + "_bucket", withLabel(labels, le.str()),
+                                static_cast<double>(snapshot.cumulative[i]));
+                }
+                const auto total = static_cast<double>(snapshot.count);
+                writeSample(out, name + "_bucket", withLabel(labels, "le=\"+Inf\""), total);
+                writeSample(out, name + "_sum", labels, snapshot.sum);
+                writeSample(out, name + "_count", labels, total);
+            }
+        }
+    }
+    return out.str();
+}
+
+MetricsRegistry& metrics() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+} // namespace buksan
@@ -0,0 +1,148 @@
+#ifndef UTILS_METRICS_H
+#define UTILS_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace buksan {
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+namespace metrics_detail {
+constexpr std::size_t kShards = 16;
+// Fixed per thread, so concurrent writers mostly land on different cache lines
+std::size_t shardIndex();
+}
+
+class Counter {
+public:
+    void inc(std::uint64_t n = 1) {
+        shards_[metrics_detail::shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    std::uint64_t value() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<std::uint64_t> value{0};
+    };
+    std::array<Shard, metrics_detail::kShards> shards_;
+};
+
+class Gauge {
+public:
+    void set(double value) { value_.store(value, std::memory_order_relaxed); }
+    double value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> value_{0.0};
+};
+
+class Histogram {
+public:
+    struct Snapshot {
+        std::vector<std::uint64_t> cumulative;
+        std::uint64_t count{0};
+        double sum{0.0};
+    };
+
+    explicit Histogram(std::vector<double> bounds);
+
+    void observe(double value);
+    template <typename Rep, typename Period>
+    void observe(std::chrono::duration<Rep, Period> elapsed) {
+        observe(std::chrono::duration<double>(elapsed).count());
+    }
+
+    const std::vector<double>& bounds() const { return bounds_; }
+    Snapshot snapshot() const;
+
+private:
+    struct alignas(64) Shard {
+        explicit Shard(std::size_t buckets) : counts(buckets) {}
+        std::vector<std::atomic<std::uint64_t>> counts;
+        std::atomic<double> sum{0.0};
+    };
+
+    std::vector<double> bounds_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+// Observes the time from construction to destruction.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram)
+        : histogram_(histogram)
+        , start_(std::chrono::steady_clock::now()) {
+    }
+    ~ScopedTimer() { histogram_.observe(std::chrono::steady_clock::now() - start_); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Process-wide set of metric families rendered in the Prometheus text format.
+// Lookups take a lock, so hot paths fetch their series once and keep the reference;
+// series are never removed and references stay valid for the life of the process.
+class MetricsRegistry {
+public:
+    static const std::vector<double>& latencyBuckets();
+
+    Counter& counter(const std::string& name, const std::string& help, const MetricLabels& labels = {});
+    Gauge& gauge(const std::string& name, const std::string& help, const MetricLabels& labels = {});
+    Histogram& histogram(const std::string& name,
+                         const std::string& help,
+                         const MetricLabels& labels = {},
+                         const std::vector<double>& bounds = latencyBuckets());
+    // Read at scrape time, for values another component already keeps
+    void gaugeFunction(const std::string& name,
+                       const std::string& help,
+                       const MetricLabels& labels,
+                       std::function<double()> read);
+
+    std::string render() const;
+
+private:
+    enum class Type {
+        Counter,
+        Gauge,
+        Histogram
+    };
+
+    struct Series {
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+        std::function<double()> read;
+    };
+
+    struct Family {
+        std::string help;
+        Type type;
+        std::map<std::string, Series> series;
+    };
+
+    Series& seriesLocked(const std::string& name, const std::string& help, Type type, const MetricLabels& labels);
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family> families_;
+};
+
+MetricsRegistry& metrics();
+
+} // namespace buksan
+
+#endif // UTILS_METRICS_H
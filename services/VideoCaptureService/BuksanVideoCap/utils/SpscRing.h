@@ -0,0 +1,69 @@
+#ifndef UTILS_SPSCRING_H
+#define UTILS_SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace buksan {
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(std::size_t capacity)
+        : slots_(roundUpPowerOfTwo(capacity < 2 ? 2 : capacity))
+        , mask_(slots_.size() - 1) {
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    bool tryPush(T&& item) {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= slots_.size()) {
+            return false;
+        }
+        slots_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& item) {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(slots_[head & mask_]);
+        slots_[head & mask_] = T{};
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t size() const {
+        const std::size_t tail = tail_.load(std::memory_order_acquire);
+        const std::size_t head = head_.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    std::size_t capacity() const { return slots_.size(); }
+
+private:
+    static std::size_t roundUpPowerOfTwo(std::size_t value) {
+        std::size_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    std::vector<T> slots_;
+    const std::size_t mask_;
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0};
+};
+
+} // namespace buksan
+
+#endif // UTILS_SPSCRING_H
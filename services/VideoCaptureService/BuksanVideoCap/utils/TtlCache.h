@@ -0,0 +1,160 @@
+#ifndef UTILS_TTLCACHE_H
+#define UTILS_TTLCACHE_H
+
+#include "utils/Metrics.h"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace buksan {
+
+struct MetadataCacheSettings {
+    // Zero turns caching off; every lookup then goes to the repository
+    std::chrono::seconds ttl{30};
+    std::size_t capacity{4096};
+};
+
+// Bounded read-through cache for metadata rows. Keys are spread over shards, each with its own
+// lock and LRU order, so concurrent lookups of different rows do not contend. Entries expire
+// after the TTL; writers erase what they change. Hits and misses are counted per cache name.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class ShardedTtlCache {
+public:
+    ShardedTtlCache(const std::string& name, MetadataCacheSettings settings)
+        : ttl_(settings.ttl)
+        , shardCapacity_(settings.capacity / kShards > 0 ? settings.capacity / kShards : 1)
+        , hits_(metrics().counter("buksan_metadata_cache_hits_total", "Metadata lookups served from memory",
+                                  {{"cache", name}}))
+        , misses_(metrics().counter("buksan_metadata_cache_misses_total", "Metadata lookups sent to the database",
+                                    {{"cache", name}})) {
+    }
+
+    ShardedTtlCache(const ShardedTtlCache&) = delete;
+    ShardedTtlCache& operator=(const ShardedTtlCache&) = delete;
+
+    bool enabled() const { return ttl_.count() > 0; }
+
+    std::optional<Value> get(const Key& key) {
+        if (!enabled()) {
+            return std::nullopt;
+        }
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            misses_.inc();
+            return std::nullopt;
+        }
+        if (Clock::now() >= it->second->expiresAt) {
+            shard.entries.erase(it->second);
+            shard.index.erase(it);
+            misses_.inc();
+            return std::nullopt;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        hits_.inc();
+        return it->second->value;
+    }
+
+    void put(const Key& key, Value value) {
+        if (!enabled()) {
+            return;
+        }
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.entries.erase(it->second);
+            shard.index.erase(it);
+        }
+        shard.entries.push_front(Entry{key, std::move(value), Clock::now() + ttl_});
+        shard.index.emplace(key, shard.entries.begin());
+        while (shard.entries.size() > shardCapacity_) {
+            shard.index.erase(shard.entries.back().key);
+            shard.entries.pop_back();
+        }
+    }
+
+    // Looks the key up and, on a miss, loads it and keeps the result; an empty result is not kept,
+    // so a row created later is found at once
+    template <typename Loader>
+    std::optional<Value> getOrLoad(const Key& key, Loader&& load) {
+        if (auto cached = get(key)) {
+            return cached;
+        }
+        std::optional<Value> loaded = load();
+        if (loaded) {
+            put(key, *loaded);
+        }
+        return loaded;
+    }
+
+    void erase(const Key& key) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.entries.erase(it->second);
+            shard.index.erase(it);
+        }
+    }
+
+    template <typename Predicate>
+    void eraseIf(Predicate&& predicate) {
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+                if (predicate(it->key, it->value)) {
+                    shard.index.erase(it->key);
+                    it = shard.entries.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    void clear() {
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.index.clear();
+            shard.entries.clear();
+        }
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr std::size_t kShards = 16;
+
+    struct Entry {
+        Key key;
+        Value value;
+        Clock::time_point expiresAt;
+    };
+
+    // Front is the most recently used
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index;
+    };
+
+    Shard& shardFor(const Key& key) { return shards_[Hash{}(key) % kShards]; }
+
+    std::chrono::seconds ttl_;
+    std::size_t shardCapacity_;
+    Counter& hits_;
+    Counter& misses_;
+    std::array<Shard, kShards> shards_;
+};
+
+} // namespace buksan
+
+#endif // UTILS_TTLCACHE_H